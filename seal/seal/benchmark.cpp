@@ -0,0 +1,258 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include "slots.h"
+#include "polyarith.h"
+#include "bootstrapping.h"
+#include "stats.h"
+#include "seal/seal.h"
+#if __has_include(<sys/resource.h>)
+#include <sys/resource.h>
+#define HAS_GETRUSAGE
+#endif
+
+// Benchmarks the bootstrapping stages and some of the underlying primitives.
+// This is built as separate executable (see the Makefile target benchmark) from the same sources as seal.cpp,
+// and prints one JSON object per benchmark and parameter set, so that results can be compared between versions.
+//
+// Usage: benchmark [--repetitions n] [--filter substring] [--transform-cache directory]
+
+using namespace seal;
+
+namespace {
+
+	volatile uint64_t benchmark_sink = 0;
+
+	uint64_t peak_resident_kilobytes()
+	{
+#ifdef HAS_GETRUSAGE
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) == 0) {
+			return static_cast<uint64_t>(usage.ru_maxrss);
+		}
+#endif
+		return 0;
+	}
+
+	struct BenchmarkOptions {
+		size_t repetitions = 5;
+		std::string filter;
+		std::string transform_cache_directory;
+	};
+
+	class BenchmarkRunner {
+
+		BenchmarkOptions options;
+		std::shared_ptr<BootstrapStats> stats;
+
+	public:
+		BenchmarkRunner(BenchmarkOptions options) : options(std::move(options)), stats(std::make_shared<BootstrapStats>()) {}
+
+		const BenchmarkOptions& get_options() const noexcept
+		{
+			return options;
+		}
+
+		/**
+		 * The stats object into which all operations of the benchmarked functions are recorded;
+		 * Bootstrappers must use this object via Bootstrapper::set_stats().
+		*/
+		const std::shared_ptr<BootstrapStats>& get_stats() const noexcept
+		{
+			return stats;
+		}
+
+		bool is_enabled(const std::string& parameters, const std::string& name) const
+		{
+			return (parameters + "/" + name).find(options.filter) != std::string::npos;
+		}
+
+		/**
+		 * Calls f the configured number of times and prints the wall times, together with the operation
+		 * counts of the last repetition, the growth of the global memory pool and the peak resident set size.
+		*/
+		void run(const std::string& parameters, const std::string& name, const std::function<void()>& f)
+		{
+			if (!is_enabled(parameters, name)) {
+				return;
+			}
+			std::vector<double> milliseconds;
+			uint64_t pool_bytes = 0;
+			for (size_t i = 0; i < options.repetitions; ++i) {
+				stats->reset();
+				BootstrapStatsScope scope(stats.get());
+				const size_t initial_pool_bytes = MemoryManager::GetPool().alloc_byte_count();
+				const auto start = std::chrono::steady_clock::now();
+				f();
+				const auto end = std::chrono::steady_clock::now();
+				milliseconds.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+				pool_bytes = std::max<uint64_t>(pool_bytes, MemoryManager::GetPool().alloc_byte_count() - initial_pool_bytes);
+			}
+			std::vector<double> sorted = milliseconds;
+			std::sort(sorted.begin(), sorted.end());
+			double total = 0;
+			for (double time : milliseconds) {
+				total += time;
+			}
+
+			std::cout << "{ \"parameters\": \"" << parameters << "\", \"benchmark\": \"" << name << "\""
+				<< ", \"repetitions\": " << milliseconds.size()
+				<< ", \"min_ms\": " << sorted.front()
+				<< ", \"median_ms\": " << sorted[sorted.size() / 2]
+				<< ", \"mean_ms\": " << total / milliseconds.size()
+				<< ", \"max_ms\": " << sorted.back()
+				<< ", \"key_switch_operations\": " << stats->key_switch_operations()
+				<< ", \"multiply_operations\": " << stats->multiply_operations()
+				<< ", \"multiply_plain_operations\": " << stats->multiply_plain_operations()
+				<< ", \"pool_allocated_bytes\": " << pool_bytes
+				<< ", \"peak_resident_kilobytes\": " << peak_resident_kilobytes()
+				<< " }" << std::endl;
+		}
+	};
+
+	poly benchmark_poly(const SlotRing& slot_ring, uint64_t seed)
+	{
+		poly result;
+		result.resize(slot_ring.N());
+		for (size_t i = 0; i < result.size(); ++i) {
+			result[i] = slot_ring.R().scalar_mod.reduce(i * i * seed + 7 * i + seed);
+		}
+		return result;
+	}
+
+	void benchmark_poly_arithmetic(BenchmarkRunner& runner, const std::string& parameters, const SlotRing& slot_ring)
+	{
+		const poly lhs = benchmark_poly(slot_ring, 3);
+		const poly rhs = benchmark_poly(slot_ring, 5);
+		runner.run(parameters, "poly_mul_mod", [&]() {
+			benchmark_sink = poly_mul_mod(lhs, rhs, slot_ring.R().scalar_mod, slot_ring.R().poly_mod)[0];
+		});
+		const SlotRing::RawAuto g1_automorphism = slot_ring.raw_auto(1, 0);
+		runner.run(parameters, "g1_automorphism", [&]() {
+			benchmark_sink = g1_automorphism(lhs)[0];
+		});
+	}
+
+	void benchmark_bootstrapping(BenchmarkRunner& runner, const std::string& parameters, std::shared_ptr<const SlotRing> slot_ring,
+		const std::function<std::unique_ptr<PolyEvaluator>(const SlotRing&)>& digit_extractor)
+	{
+		EncryptionParameters parms(scheme_type::bfv);
+		parms.set_poly_modulus_degree(slot_ring->N());
+		parms.set_coeff_modulus(CoeffModulus::BFVDefault(slot_ring->N()));
+		parms.set_plain_modulus(slot_ring->prime());
+		SEALContext context(parms, true, sec_level_type::none);
+
+		KeyGenerator keygen(context);
+		SecretKey sk = keygen.secret_key();
+		PublicKey pk;
+		keygen.create_public_key(pk);
+		Encryptor encryptor(context, pk);
+
+		const auto create_bootstrapper = [&]() {
+			std::unique_ptr<Bootstrapper> result = std::make_unique<Bootstrapper>(context, slot_ring, digit_extractor(*slot_ring));
+			result->set_thread_pool(std::make_shared<ThreadPool>());
+			result->set_stats(runner.get_stats());
+			if (runner.get_options().transform_cache_directory.size() > 0) {
+				result->set_transform_cache_directory(runner.get_options().transform_cache_directory);
+			}
+			return result;
+		};
+
+		runner.run(parameters, "initialize", [&]() {
+			create_bootstrapper()->initialize();
+		});
+
+		const bool requires_bootstrapper = runner.is_enabled(parameters, "create_bootstrapping_key") ||
+			runner.is_enabled(parameters, "slots_to_coeffs") || runner.is_enabled(parameters, "homomorphic_noisy_decrypt") ||
+			runner.is_enabled(parameters, "coeffs_to_slots") || runner.is_enabled(parameters, "slotwise_digit_extract");
+		if (!requires_bootstrapper) {
+			return;
+		}
+		std::unique_ptr<Bootstrapper> bootstrapper = create_bootstrapper();
+		bootstrapper->initialize();
+		bootstrapper->precompute();
+
+		BootstrappingKey bk;
+		runner.run(parameters, "create_bootstrapping_key", [&]() {
+			bootstrapper->create_bootstrapping_key(sk, bk);
+		});
+		if (!runner.is_enabled(parameters, "create_bootstrapping_key")) {
+			bootstrapper->create_bootstrapping_key(sk, bk);
+		}
+
+		const SlotRing basic_slot_ring = slot_ring->change_exponent(1);
+		poly data = basic_slot_ring.from_slot_value({ 1 }, 0);
+		poly_add(data, basic_slot_ring.from_slot_value({ 2 }, 1), basic_slot_ring.R().scalar_mod);
+		Ciphertext x_enc;
+		encryptor.encrypt(Plaintext{ gsl::span<const uint64_t>(data) }, x_enc);
+
+		// compute the input of each stage once, so that every stage can be benchmarked on its own
+		Ciphertext in_coeffs, noisy_dec, in_slots, digit_extracted;
+		bootstrapper->slots_to_coeffs(x_enc, bk, in_coeffs, MemoryManager::GetPool() DEBUG_PASS(sk));
+		bootstrapper->homomorphic_noisy_decrypt(in_coeffs, bk, noisy_dec, MemoryManager::GetPool() DEBUG_PASS(sk));
+		bootstrapper->coeffs_to_slots(noisy_dec, bk, in_slots, MemoryManager::GetPool() DEBUG_PASS(sk));
+
+		runner.run(parameters, "slots_to_coeffs", [&]() {
+			bootstrapper->slots_to_coeffs(x_enc, bk, in_coeffs, MemoryManager::GetPool() DEBUG_PASS(sk));
+		});
+		runner.run(parameters, "homomorphic_noisy_decrypt", [&]() {
+			bootstrapper->homomorphic_noisy_decrypt(in_coeffs, bk, noisy_dec, MemoryManager::GetPool() DEBUG_PASS(sk));
+		});
+		runner.run(parameters, "coeffs_to_slots", [&]() {
+			bootstrapper->coeffs_to_slots(noisy_dec, bk, in_slots, MemoryManager::GetPool() DEBUG_PASS(sk));
+		});
+		runner.run(parameters, "slotwise_digit_extract", [&]() {
+			bootstrapper->slotwise_digit_extract(in_slots, bk, digit_extracted, MemoryManager::GetPool() DEBUG_PASS(sk));
+		});
+	}
+
+	BenchmarkOptions parse_options(int argc, char** argv)
+	{
+		BenchmarkOptions result;
+		for (int i = 1; i < argc; ++i) {
+			const std::string arg = argv[i];
+			if (i + 1 >= argc) {
+				throw std::invalid_argument("Missing value for option " + arg);
+			}
+			if (arg == "--repetitions") {
+				result.repetitions = std::stoul(argv[++i]);
+				if (result.repetitions == 0) {
+					throw std::invalid_argument("At least one repetition is required");
+				}
+			}
+			else if (arg == "--filter") {
+				result.filter = argv[++i];
+			}
+			else if (arg == "--transform-cache") {
+				result.transform_cache_directory = argv[++i];
+			}
+			else {
+				throw std::invalid_argument("Unknown option " + arg);
+			}
+		}
+		return result;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	BenchmarkRunner runner(parse_options(argc, argv));
+
+	// there is no digit extraction polynomial for small_test_parameters(), so only benchmark the arithmetic
+	benchmark_poly_arithmetic(runner, "small_test_parameters", *small_test_parameters());
+
+	std::shared_ptr<const SlotRing> p_127 = p_127_test_parameters();
+	benchmark_poly_arithmetic(runner, "p_127_test_parameters", *p_127);
+	benchmark_bootstrapping(runner, "p_127_test_parameters", p_127, [](const SlotRing& slot_ring) { return p_127_test_parameters_digit_extractor(slot_ring); });
+
+	std::shared_ptr<const SlotRing> p_257 = p_257_test_parameters();
+	benchmark_poly_arithmetic(runner, "p_257_test_parameters", *p_257);
+	benchmark_bootstrapping(runner, "p_257_test_parameters", p_257, [](const SlotRing& slot_ring) { return p_257_test_parameters_digit_extractor(slot_ring); });
+
+	return 0;
+}
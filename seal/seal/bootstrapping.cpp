@@ -1,45 +1,45 @@
 #include "bootstrapping.h"
+#include "powercache.h"
 #include "seal/util/scalingvariant.h"
 #include "seal/util/polyarithsmallmod.h"
+#include <mutex>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <limits>
 
 using namespace seal;
 
-// See the issue https://github.com/microsoft/SEAL/issues/592
-void fast_exponentiate(const Ciphertext& ciphertext, size_t exponent, const Evaluator& evaluator, const RelinKeys& rk, Ciphertext& result) {
-	// we let result uninitialized until we have to, this is represented by result_is_one == true
-	bool result_is_one = true;
-	
-	// a classical square-and-multiply algorithm
-	for (int64_t i = std::numeric_limits<size_t>::digits - 1; i >= 0; --i) {
-		if (!result_is_one) {
-			evaluator.square_inplace(result);
-			evaluator.relinearize_inplace(result, rk); log_relin();
-		}
-		if (((exponent >> i) & 1) == 1) {
-			// multiplying ciphertext to the result here will cause it to be
-			// squared exactly i times
-			if (!result_is_one) {
-				evaluator.multiply_inplace(result, ciphertext);
-				evaluator.relinearize_inplace(result, rk); log_relin();
-			}
-			else {
-				result = ciphertext;
-				result_is_one = false;
-			}
-		}
+// We do not use SEAL's exponentiate, see the issue https://github.com/microsoft/SEAL/issues/592;
+// Instead, we take the power from the cache, so that intermediate powers can be reused.
+// If relinearize_result is false and the power is not yet cached, the last product is not relinearized.
+void fast_exponentiate(PowerCache& powers, size_t exponent, Ciphertext& result, bool relinearize_result = true) {
+	if (relinearize_result) {
+		result = powers.power(exponent);
+	}
+	else {
+		powers.power_unrelinearized(exponent, result);
 	}
 }
 
 void Bootstrapper::homomorphic_noisy_decrypt(const Ciphertext& ciphertext, const BootstrappingKey& bk, Ciphertext& destination, MemoryPoolHandle pool DEBUG_PARAMS) const
 {
-	// ciphertext is validated in convert_ciphertext_plain()
+	pool = stage_pool(pool);
+	BootstrapStageTimer timer(stats.get(), BootstrapStage::noisy_decrypt, pool, destination);
 	if (!bk.is_valid_for(context_chain.target_context())) {
 		throw std::invalid_argument("Invalid bootstrapping key");
 	}
-	seal::Plaintext ciphertext_as_plaintext[2];
+	homomorphic_noisy_decrypt_unchecked(ciphertext, bk, destination, pool);
+}
+
+void Bootstrapper::homomorphic_noisy_decrypt_unchecked(const Ciphertext& ciphertext, const BootstrappingKey& bk, Ciphertext& destination, MemoryPoolHandle pool) const
+{
+	// ciphertext is validated in convert_ciphertext_plain()
+	seal::Plaintext ciphertext_as_plaintext[2] = { seal::Plaintext(pool), seal::Plaintext(pool) };
 	context_chain.convert_ciphertext_plain(ciphertext, ciphertext_as_plaintext, pool);
-	bootstrapping_evaluator().multiply_plain(bk.encrypted_sk, ciphertext_as_plaintext[1], destination, pool);
-	bootstrapping_evaluator().add_plain_inplace(destination, ciphertext_as_plaintext[0]);
+	bootstrapping_evaluator().multiply_plain(bk.encrypted_sk, ciphertext_as_plaintext[1], destination, pool); log_multiply_plain();
+	bootstrapping_evaluator().add_plain_inplace(destination, ciphertext_as_plaintext[0], pool);
 }
 
 Bootstrapper::Bootstrapper(const seal::SEALContext& bootstrapped_context, std::shared_ptr<const SlotRing> slot_ring, std::unique_ptr<PolyEvaluator> digit_extract_poly, MemoryPoolHandle pool)
@@ -56,6 +56,7 @@ Bootstrapper::Bootstrapper(const seal::SEALContext& bootstrapped_context, std::s
 	else {
 		trace_op = std::make_unique<SlotwiseTrace>(*slot_ring, 0, log2_exact(slot_ring->slot_rank() / 2));
 	}
+	update_galois_key_plan(0);
 }
 
 void Bootstrapper::create_bootstrapping_key(const seal::SecretKey& sk, BootstrappingKey& bk, bool allow_uninitialized_for_test) const
@@ -69,41 +70,157 @@ void Bootstrapper::create_bootstrapping_key(const seal::SecretKey& sk, Bootstrap
 	SecretKey bootstrapping_sk;
 	context_chain.convert_sk(sk, bootstrapping_sk);
 
+	// symmetric encryption does not require a public key
+	Encryptor enc(context_chain.target_context(), bootstrapping_sk);
+	seal::Ciphertext enc_sk;
+	enc.encrypt_symmetric(sk_plain, enc_sk, pool);
+
 	KeyGenerator keygen(context_chain.target_context(), bootstrapping_sk);
-	PublicKey pk;
-	keygen.create_public_key(pk);
+	RelinKeys rk;
+	keygen.create_relin_keys(rk);
+	GaloisKeys gk;
+	keygen.create_galois_keys(std::vector<uint32_t>{}, gk);
 
-	Encryptor enc(context_chain.target_context(), pk);
-	seal::Ciphertext enc_sk;
-	enc.encrypt(sk_plain, enc_sk, pool);
+	const GaloisKeyPlan& plan = galois_key_plan();
+	std::cout << "creating " << plan.key_elements().size() << " galois keys, requiring at most " << plan.key_switch_count() << " key-switches per bootstrapping" << std::endl;
+	create_galois_keys(bootstrapping_sk, plan.key_elements(), gk, nullptr);
 
-	std::vector<uint32_t> galois_elements;
-	auto digit_extract_galois_elements = digit_extract_poly->galois_elements();
-	galois_elements.insert(galois_elements.end(), digit_extract_galois_elements.cbegin(), digit_extract_galois_elements.cend());
+	bk.encrypted_sk = std::move(enc_sk);
+	bk.gk = std::move(gk);
+	bk.rk = std::move(rk);
+	create_context_keys(bk);
+}
 
-	if (coefficients_to_slots != nullptr) {
-		auto lin_transform_galois_elements = coefficients_to_slots->galois_elements();
-		galois_elements.insert(galois_elements.end(), lin_transform_galois_elements.cbegin(), lin_transform_galois_elements.cend());
-		lin_transform_galois_elements = slots_to_coefficients->galois_elements();
-		galois_elements.insert(galois_elements.end(), lin_transform_galois_elements.cbegin(), lin_transform_galois_elements.cend());
+void Bootstrapper::update_bootstrapping_key(const seal::SecretKey& sk, BootstrappingKey& bk, const std::function<void(uint32_t)>& on_key_created) const
+{
+	if (!bk.is_valid_for(context_chain.target_context())) {
+		throw std::invalid_argument("Invalid bootstrapping key");
+	}
+	SecretKey bootstrapping_sk;
+	context_chain.convert_sk(sk, bootstrapping_sk);
+
+	std::vector<uint32_t> missing_elements;
+	for (uint32_t galois_elt : galois_key_elements(BootstrapStage::bootstrap)) {
+		if (!bk.gk.has_key(galois_elt)) {
+			missing_elements.push_back(galois_elt);
+		}
 	}
+	if (missing_elements.size() == 0) {
+		return;
+	}
+	create_galois_keys(bootstrapping_sk, missing_elements, bk.gk, on_key_created);
+	create_context_keys(bk);
+}
 
-	auto trace_op_galois_elements = trace_op->galois_elements();
-	galois_elements.insert(galois_elements.end(), trace_op_galois_elements.cbegin(), trace_op_galois_elements.cend());
-	std::sort(galois_elements.begin(), galois_elements.end());
-	const auto end = std::unique(galois_elements.begin(), galois_elements.end());
-	galois_elements.resize(end - galois_elements.begin());
-	std::cout << "creating " << galois_elements.size() << " galois keys" << std::endl;
+void Bootstrapper::create_galois_keys(const seal::SecretKey& bootstrapping_sk, const std::vector<uint32_t>& galois_elements, seal::GaloisKeys& gk, const std::function<void(uint32_t)>& on_key_created) const
+{
+	// every worker has its own key generator, and writes the keys of its elements to their (distinct) entries of gk
+	const size_t worker_count = thread_pool == nullptr ? 1 : std::min(galois_elements.size(), thread_pool->thread_count() + 1);
+	std::mutex callback_mutex;
+	parallel_for(thread_pool.get(), 0, worker_count, [&](size_t w) {
+		KeyGenerator keygen(context_chain.target_context(), bootstrapping_sk);
+		for (size_t i = w; i < galois_elements.size(); i += worker_count) {
+			GaloisKeys single_key;
+			keygen.create_galois_keys(std::vector<uint32_t>{ galois_elements[i] }, single_key);
+			const size_t index = GaloisKeys::get_index(galois_elements[i]);
+			gk.data()[index] = std::move(single_key.data()[index]);
+			if (on_key_created) {
+				std::unique_lock<std::mutex> lock(callback_mutex);
+				on_key_created(galois_elements[i]);
+			}
+		}
+	});
+}
 
-	GaloisKeys gk;
-	keygen.create_galois_keys(galois_elements, gk);
+std::vector<uint32_t> Bootstrapper::galois_elements(BootstrapStage stage) const
+{
+	std::vector<uint32_t> result = galois_element_uses(stage);
+	std::sort(result.begin(), result.end());
+	const auto end = std::unique(result.begin(), result.end());
+	result.resize(end - result.begin());
+	return result;
+}
 
-	RelinKeys rk;
-	keygen.create_relin_keys(rk);
+std::vector<uint32_t> Bootstrapper::galois_element_uses(BootstrapStage stage) const
+{
+	std::vector<uint32_t> result;
+	const auto add_elements = [&result](const std::vector<uint32_t>& elements, size_t use_count) {
+		for (size_t i = 0; i < use_count; ++i) {
+			result.insert(result.end(), elements.cbegin(), elements.cend());
+		}
+	};
+	// all components apply each of their automorphisms once per call, as a single key-switch
+	if ((stage == BootstrapStage::slots_to_coeffs || stage == BootstrapStage::bootstrap) && slots_to_coefficients != nullptr) {
+		add_elements(slots_to_coefficients->galois_elements(), 1);
+	}
+	if (stage == BootstrapStage::coeffs_to_slots || stage == BootstrapStage::bootstrap) {
+		if (coefficients_to_slots != nullptr) {
+			add_elements(coefficients_to_slots->galois_elements(), 1);
+		}
+		add_elements(trace_op->galois_elements(), 1);
+	}
+	if (stage == BootstrapStage::digit_extract || stage == BootstrapStage::bootstrap) {
+		// lane i of slotwise_digit_extract() evaluates the digit extraction polynomial in e - 1 - i steps
+		const size_t digits_to_remove = slot_ring->exponent() - 1;
+		add_elements(digit_extract_poly->galois_elements(), digits_to_remove * (digits_to_remove + 1) / 2);
+	}
+	return result;
+}
 
-	bk.encrypted_sk = std::move(enc_sk);
-	bk.gk = std::move(gk);
-	bk.rk = std::move(rk);
+void Bootstrapper::update_galois_key_plan(size_t budget_bytes)
+{
+	const std::vector<uint32_t> uses = galois_element_uses(BootstrapStage::bootstrap);
+	size_t max_key_count = uses.size();
+	if (budget_bytes != 0) {
+		max_key_count = budget_bytes / GaloisKeyPlan::key_byte_count(context_chain.target_context());
+	}
+	key_plan = std::make_unique<GaloisKeyPlan>(uses, max_key_count, poly_modulus_degree());
+	galois_key_budget = budget_bytes;
+}
+
+const GaloisKeyPlan& Bootstrapper::galois_key_plan() const noexcept
+{
+	return *key_plan;
+}
+
+std::vector<uint32_t> Bootstrapper::galois_key_elements(BootstrapStage stage) const
+{
+	if (galois_key_budget == 0) {
+		return galois_elements(stage);
+	}
+	std::vector<uint32_t> result;
+	for (uint32_t galois_elt : galois_elements(stage)) {
+		const std::vector<uint32_t> decomposition = key_plan->decomposition(galois_elt);
+		result.insert(result.end(), decomposition.begin(), decomposition.end());
+	}
+	std::sort(result.begin(), result.end());
+	const auto end = std::unique(result.begin(), result.end());
+	result.resize(end - result.begin());
+	return result;
+}
+
+void Bootstrapper::create_context_keys(BootstrappingKey& bk) const
+{
+	// SEAL requires the parms_id of the keys to match the context, so we cannot share the key data between
+	// the contexts; however, we only copy the keys that are actually used in each context
+	const size_t target_index = context_chain.size() - 1;
+	// if bk was only partially loaded, there are no keys for the other stages to copy
+	const auto present_in_bk = [&bk](std::vector<uint32_t> elements) {
+		const auto end = std::remove_if(elements.begin(), elements.end(), [&bk](uint32_t galois_elt) { return !bk.gk.has_key(galois_elt); });
+		elements.erase(end, elements.end());
+		return elements;
+	};
+	const std::vector<uint32_t> digit_extract_galois_elements = present_in_bk(galois_key_elements(BootstrapStage::digit_extract));
+	const std::vector<uint32_t> slots_to_coeffs_galois_elements = present_in_bk(galois_key_elements(BootstrapStage::slots_to_coeffs));
+	bk.context_gk.clear();
+	bk.context_rk.clear();
+	bk.context_gk.resize(target_index);
+	bk.context_rk.resize(target_index);
+	for (size_t i = 0; i < target_index; ++i) {
+		// context 0 is used for slots-to-coeffs, the others for digit extraction
+		context_chain.convert_kswitchkey(bk.gk, bk.context_gk[i], i, i == 0 ? slots_to_coeffs_galois_elements : digit_extract_galois_elements);
+		context_chain.convert_kswitchkey(bk.rk, bk.context_rk[i], i);
+	}
 }
 
 void Bootstrapper::create_secret_key(const seal::SecretKey& base_sk, seal::SecretKey& destination) const
@@ -111,7 +228,7 @@ void Bootstrapper::create_secret_key(const seal::SecretKey& base_sk, seal::Secre
 	context_chain.convert_sk(base_sk, destination);
 }
 
-std::unique_ptr<PolyEvaluator> p_127_test_parameters_digit_extractor(const SlotRing& slot_ring)
+poly p_127_test_parameters_evaluation_element(const SlotRing& slot_ring)
 {
 	assert(slot_ring.prime() == 127);
 	assert(slot_ring.exponent() == 3);
@@ -129,13 +246,30 @@ std::unique_ptr<PolyEvaluator> p_127_test_parameters_digit_extractor(const SlotR
 	for (; index_it != indices.end(); ++index_it, ++coeff_it) {
 		element[*index_it] = *coeff_it;
 	}
-	
+	return element;
+}
+
+std::unique_ptr<PolyEvaluator> p_127_test_parameters_digit_extractor(const SlotRing& slot_ring)
+{
+	poly element = p_127_test_parameters_evaluation_element(slot_ring);
 	poly correction_poly = { util::negate_uint_mod(63, slot_ring.R().scalar_mod) };
 	size_t log2_exponent = 7;
 	return std::make_unique<P127PolyEvaluator>(slot_ring, std::move(element), std::move(correction_poly), log2_exponent);
 }
 
-std::unique_ptr<PolyEvaluator> p_257_test_parameters_digit_extractor(const SlotRing& slot_ring)
+std::unique_ptr<PolyEvaluator> p_127_test_parameters_paterson_stockmeyer_digit_extractor(const SlotRing& slot_ring)
+{
+	poly element = p_127_test_parameters_evaluation_element(slot_ring);
+	// the formula is N(evaluation_element - x) - 63 - x^128
+	poly correction_poly;
+	correction_poly.resize(129);
+	correction_poly[0] = util::negate_uint_mod(63, slot_ring.R().scalar_mod);
+	correction_poly[128] = util::negate_uint_mod(1, slot_ring.R().scalar_mod);
+	size_t log2_exponent = 7;
+	return std::make_unique<PatersonStockmeyerPolyEvaluator>(slot_ring, std::move(element), log2_exponent, 0, std::move(correction_poly));
+}
+
+poly p_257_test_parameters_evaluation_element(const SlotRing& slot_ring)
 {
 	assert(slot_ring.prime() == 257);
 	assert(slot_ring.exponent() <= 3);
@@ -153,23 +287,33 @@ std::unique_ptr<PolyEvaluator> p_257_test_parameters_digit_extractor(const SlotR
 	for (; index_it != indices.end(); ++index_it, ++coeff_it) {
 		element[*index_it] = slot_ring.R().scalar_mod.reduce(*coeff_it);
 	}
+	return element;
+}
 
+std::unique_ptr<PolyEvaluator> p_257_test_parameters_digit_extractor(const SlotRing& slot_ring)
+{
+	poly element = p_257_test_parameters_evaluation_element(slot_ring);
 	poly correction_poly = { 0, util::negate_uint_mod(3, slot_ring.R().scalar_mod) };
 	size_t log2_exponent = 8;
 	return std::make_unique<P257CorrectionPolyEvaluator>(slot_ring, std::move(element), std::move(correction_poly), log2_exponent);
 }
 
+std::unique_ptr<PolyEvaluator> p_257_test_parameters_paterson_stockmeyer_digit_extractor(const SlotRing& slot_ring)
+{
+	poly element = p_257_test_parameters_evaluation_element(slot_ring);
+	// the formula is x * N(evaluation_element - x) - 3x
+	poly correction_poly = { 0, util::negate_uint_mod(3, slot_ring.R().scalar_mod) };
+	size_t log2_exponent = 8;
+	return std::make_unique<PatersonStockmeyerPolyEvaluator>(slot_ring, std::move(element), log2_exponent, 1, std::move(correction_poly));
+}
+
 P127PolyEvaluator::P127PolyEvaluator(const SlotRing& slot_ring, poly evaluation_element, poly correction_poly, size_t log2_exponent)
 	: slot_ring(slot_ring), correction_poly(std::move(correction_poly)), log2_exponent(log2_exponent), norm_op(slot_ring, log2_exact(slot_ring.slot_rank()) - log2_exponent)
 {
 	if (evaluation_element.size() != slot_ring.slot_rank()) {
 		throw std::invalid_argument("Elements must have slot_rank() coefficients.");
 	}
-	poly slotted_evaluation_element;
-	SEAL_ITERATE(util::iter(size_t(0)), slot_ring.slot_group_len(), [&slotted_evaluation_element, &evaluation_element, &slot_ring](auto I) {
-		poly_add(slotted_evaluation_element, slot_ring.from_slot_value(evaluation_element, I), slot_ring.R().scalar_mod);
-	});
-	this->evaluation_element = std::move(slotted_evaluation_element);
+	this->evaluation_element = slot_ring.from_slot_value_in_all_slots(evaluation_element);
 }
 
 poly P127PolyEvaluator::operator()(const poly& x) const
@@ -178,48 +322,37 @@ poly P127PolyEvaluator::operator()(const poly& x) const
 }
 
 /**
- * Homomorphically evaluates the polynomial at x. This uses Horner's schema
- * with very bad multiplicative depth, so use only for very smal polynomials!
- * (we only use it for degree-1-polynomial I think)
+ * Homomorphically evaluates the polynomial at x and adds the result to destination, as the sum
+ * of the cached powers of x scaled by the coefficients. This has depth ceil(log2(deg)), but requires
+ * all powers up to the degree, so use PatersonStockmeyerPolyEvaluator for large dense polynomials.
 */
-void naive_add_poly_eval_inplace(Ciphertext& destination, const poly& poly, const Ciphertext& x, const Evaluator& eval, const RelinKeys& rk, const Modulus& plain_modulus) {
+void add_poly_eval_inplace(Ciphertext& destination, const poly& poly, PowerCache& powers, const Evaluator& eval, const Modulus& plain_modulus, MemoryPoolHandle pool) {
 	if (poly.size() == 0) {
 		return;
 	}
 	assert(poly[poly.size() - 1] != 0);
 
-	Ciphertext correction;
-	bool is_correction_set = false;
-	Plaintext current;
-	current.resize(1);
-	// this loop will not go over the constant coefficient - we include that later
-	SEAL_ITERATE(poly.rbegin(), poly.size() - 1, [&](auto& I) {
-		current[0] = plain_modulus.reduce(I);
-		if (is_correction_set) {
-			eval.add_plain_inplace(correction, current);
-			eval.multiply_inplace(correction, x);
-			eval.relinearize_inplace(correction, rk); log_relin();
-		}
-		else if (current[0] != 0) {
-			eval.multiply_plain(x, current, correction);
-			is_correction_set = true;
+	Plaintext current(1, pool);
+	Ciphertext tmp(pool);
+	for (size_t i = 1; i < poly.size(); ++i) {
+		current[0] = plain_modulus.reduce(poly[i]);
+		if (current[0] != 0) {
+			eval.multiply_plain(powers.power(i), current, tmp, pool); log_multiply_plain();
+			eval.add_inplace(destination, tmp);
 		}
-	});
-	if (is_correction_set) {
-		eval.add_inplace(destination, correction);
 	}
-	current[0] = poly[0];
-	eval.add_plain_inplace(destination, current);
+	current[0] = plain_modulus.reduce(poly[0]);
+	eval.add_plain_inplace(destination, current, pool);
 }
 
-void P127PolyEvaluator::apply_ciphertext(const Ciphertext& in, const SEALContext& context, const Evaluator& eval, const GaloisKeys& gk, const RelinKeys& rk, Ciphertext& destination) const
+void P127PolyEvaluator::apply_ciphertext(const Ciphertext& in, const SEALContext& context, const Evaluator& eval, const GaloisKeys& gk, const RelinKeys& rk, Ciphertext& destination, MemoryPoolHandle pool) const
 {
 	if (!is_metadata_valid_for(in, context)) {
 		throw std::invalid_argument("Invalid ciphertext");
 	}
 
 	const Modulus& plain_modulus = context.first_context_data()->parms().plain_modulus();
-	Plaintext evaluation_element(gsl::span(this->evaluation_element));
+	Plaintext evaluation_element(gsl::span(this->evaluation_element), pool);
 	util::modulo_poly_coeffs(
 		util::ConstCoeffIter(this->evaluation_element.data()), 
 		this->evaluation_element.size(), 
@@ -228,16 +361,21 @@ void P127PolyEvaluator::apply_ciphertext(const Ciphertext& in, const SEALContext
 	);
 	
 	// first, compute the norm of (evaluation_element - in); this is the result up to a correction delta
-	Ciphertext tmp;
-	eval.sub_plain(in, evaluation_element, tmp);
+	Ciphertext tmp(pool);
+	eval.sub_plain(in, evaluation_element, tmp, pool);
 	eval.negate_inplace(tmp);
-	norm_op.apply_ciphertext(tmp, eval, gk, rk, destination);
+	// both products are left unrelinearized, so we only relinearize once after combining them
+	norm_op.apply_ciphertext(tmp, eval, gk, rk, destination, false, pool);
 
-	// then compute the correction
-	naive_add_poly_eval_inplace(destination, correction_poly, in, eval, rk, plain_modulus);
+	// then compute the correction; the powers of in are shared with x^(2^log2_exponent)
+	PowerCache powers(in, eval, rk, pool);
+	add_poly_eval_inplace(destination, correction_poly, powers, eval, plain_modulus, pool);
 
-	fast_exponentiate(in, (size_t)1 << log2_exponent, eval, rk, tmp);
+	fast_exponentiate(powers, (size_t)1 << log2_exponent, tmp, false);
 	eval.sub_inplace(destination, tmp);
+	if (destination.size() > 2) {
+		eval.relinearize_inplace(destination, rk, pool); log_relin();
+	}
 }
 
 std::vector<uint32_t> P127PolyEvaluator::galois_elements() const
@@ -245,15 +383,24 @@ std::vector<uint32_t> P127PolyEvaluator::galois_elements() const
 	return norm_op.galois_elements();
 }
 
-SlotwiseNorm::SlotwiseNorm(const SlotRing& slot_ring, size_t subfield_index_log2) : slot_ring(slot_ring), subfield_index_log2(subfield_index_log2)
+SlotwiseNorm::SlotwiseNorm(const SlotRing& slot_ring, size_t subfield_index_log2)
+	: slot_ring(slot_ring), subfield_index_log2(subfield_index_log2)
 {
+	for (size_t i = 0; i < level_count(); ++i) {
+		galois_elts.push_back(static_cast<uint32_t>(seal::util::exponentiate_uint_mod(slot_ring.prime(), (size_t)1 << i, slot_ring.index_mod())));
+	}
+}
+
+size_t SlotwiseNorm::level_count() const
+{
+	return log2_exact(slot_ring.slot_rank()) - subfield_index_log2;
 }
 
 poly SlotwiseNorm::operator()(const poly& x) const
 {
 	poly current = x;
 	poly copy;
-	for (size_t i = 0; i < log2_exact(slot_ring.slot_rank()) - subfield_index_log2; ++i) {
+	for (size_t i = 0; i < level_count(); ++i) {
 		copy = slot_ring.frobenius((size_t)1 << i)(current);
 		current = poly_mul_mod(
 			current,
@@ -265,24 +412,174 @@ poly SlotwiseNorm::operator()(const poly& x) const
 	return current;
 }
 
-void SlotwiseNorm::apply_ciphertext(const Ciphertext& in, const Evaluator& eval, const GaloisKeys& gk, const RelinKeys& rk, Ciphertext& destination) const
+void SlotwiseNorm::apply_ciphertext(const Ciphertext& in, const Evaluator& eval, const GaloisKeys& gk, const RelinKeys& rk, Ciphertext& destination, bool relinearize_result, MemoryPoolHandle pool) const
 {
 	destination = in;
-	seal::Ciphertext copy;
-	for (size_t i = 0; i < log2_exact(slot_ring.slot_rank()) - subfield_index_log2; ++i) {
-		eval.apply_galois(destination, static_cast<uint32_t>(seal::util::exponentiate_uint_mod(slot_ring.prime(), (size_t)1 << i, slot_ring.index_mod())), gk, copy); log_galois();
-		eval.multiply_inplace(destination, copy);
-		eval.relinearize_inplace(destination, rk); log_relin();
+	Ciphertext conjugate(pool);
+	for (size_t i = 0; i < level_count(); ++i) {
+		apply_galois_composed(eval, destination, galois_elts[i], gk, conjugate, pool); log_galois();
+		eval.multiply_inplace(destination, conjugate, pool); log_multiply();
+		if (i + 1 < level_count() || relinearize_result) {
+			eval.relinearize_inplace(destination, rk, pool); log_relin();
+		}
 	}
 }
 
-std::vector<uint32_t> SlotwiseNorm::galois_elements() const
+const std::vector<uint32_t>& SlotwiseNorm::galois_elements() const noexcept
 {
-	std::vector<uint32_t> result;
-	for (size_t i = 0; i < log2_exact(slot_ring.slot_rank()) - subfield_index_log2; ++i) {
-		result.push_back(static_cast<uint32_t>(seal::util::exponentiate_uint_mod(slot_ring.prime(), (size_t)1 << i, slot_ring.index_mod())));
+	return galois_elts;
+}
+
+const seal::GaloisKeys& BootstrappingKey::galois_keys(size_t context_index) const
+{
+	if (context_index == context_gk.size()) {
+		return gk;
 	}
-	return result;
+	else if (context_index > context_gk.size()) {
+		throw std::invalid_argument("Context index out of range or context keys not created");
+	}
+	return context_gk[context_index];
+}
+
+const seal::RelinKeys& BootstrappingKey::relin_keys(size_t context_index) const
+{
+	if (context_index == context_rk.size()) {
+		return rk;
+	}
+	else if (context_index > context_rk.size()) {
+		throw std::invalid_argument("Context index out of range or context keys not created");
+	}
+	return context_rk[context_index];
+}
+
+namespace {
+
+	constexpr uint64_t bootstrapping_key_magic = 0x594b544f4f425347; // "GSBOOTKY" in little endian
+	constexpr uint64_t bootstrapping_key_version = 1;
+	constexpr size_t bootstrapping_key_header_len = 4;
+
+	// header layout of the bootstrapping key format, in uint64_t words; it is followed by the encrypted secret key,
+	// the relinearization keys and galois_key_count records, each consisting of the galois element, the number of
+	// key-switching key components, the size in bytes of the following serialized components, and the components
+	enum BootstrappingKeyHeader {
+		bk_header_magic = 0, bk_header_version, bk_header_galois_key_count, bk_header_galois_index_count
+	};
+
+	constexpr size_t galois_record_header_len = 3;
+
+	enum GaloisRecordHeader {
+		record_header_galois_elt = 0, record_header_component_count, record_header_byte_count
+	};
+}
+
+void BootstrappingKey::save(std::ostream& stream, compr_mode_type compr_mode) const
+{
+	size_t galois_key_count = 0;
+	for (const std::vector<PublicKey>& keys : gk.data()) {
+		if (keys.size() > 0) {
+			galois_key_count += 1;
+		}
+	}
+	uint64_t header[bootstrapping_key_header_len] = { 0 };
+	header[bk_header_magic] = bootstrapping_key_magic;
+	header[bk_header_version] = bootstrapping_key_version;
+	header[bk_header_galois_key_count] = galois_key_count;
+	header[bk_header_galois_index_count] = gk.data().size();
+	stream.write(reinterpret_cast<const char*>(header), sizeof(header));
+	encrypted_sk.save(stream, compr_mode);
+	rk.save(stream, compr_mode);
+
+	for (size_t i = 0; i < gk.data().size(); ++i) {
+		const std::vector<PublicKey>& keys = gk.data()[i];
+		if (keys.size() == 0) {
+			continue;
+		}
+		// only the serialized key of the current galois element is buffered, to know its size in advance
+		std::stringstream record;
+		for (const PublicKey& key : keys) {
+			key.save(record, compr_mode);
+		}
+		const std::string record_data = record.str();
+		uint64_t record_header[galois_record_header_len] = { 0 };
+		record_header[record_header_galois_elt] = 2 * i + 1;
+		record_header[record_header_component_count] = keys.size();
+		record_header[record_header_byte_count] = record_data.size();
+		assert(GaloisKeys::get_index(static_cast<uint32_t>(record_header[record_header_galois_elt])) == i);
+		stream.write(reinterpret_cast<const char*>(record_header), sizeof(record_header));
+		stream.write(record_data.data(), record_data.size());
+	}
+	if (stream.fail()) {
+		throw std::runtime_error("Failed to write bootstrapping key");
+	}
+}
+
+void BootstrappingKey::load(const SEALContext& context, std::istream& stream)
+{
+	load(context, stream, [](uint32_t) { return true; });
+}
+
+void BootstrappingKey::load(const SEALContext& context, std::istream& stream, const std::vector<uint32_t>& galois_elements)
+{
+	load(context, stream, [&galois_elements](uint32_t galois_elt) {
+		return std::find(galois_elements.begin(), galois_elements.end(), galois_elt) != galois_elements.end();
+	});
+}
+
+void BootstrappingKey::load(const SEALContext& context, std::istream& stream, const std::function<bool(uint32_t)>& is_required)
+{
+	uint64_t header[bootstrapping_key_header_len];
+	stream.read(reinterpret_cast<char*>(header), sizeof(header));
+	if (stream.fail() || header[bk_header_magic] != bootstrapping_key_magic || header[bk_header_version] != bootstrapping_key_version) {
+		throw std::invalid_argument("Not a bootstrapping key or wrong version");
+	}
+	if (header[bk_header_galois_key_count] > header[bk_header_galois_index_count]) {
+		throw std::invalid_argument("Invalid bootstrapping key header");
+	}
+	Ciphertext new_encrypted_sk;
+	new_encrypted_sk.load(context, stream);
+	RelinKeys new_rk;
+	new_rk.load(context, stream);
+
+	GaloisKeys new_gk;
+	new_gk.parms_id() = context.key_parms_id();
+	new_gk.data().resize(header[bk_header_galois_index_count]);
+	for (size_t i = 0; i < header[bk_header_galois_key_count]; ++i) {
+		uint64_t record_header[galois_record_header_len];
+		stream.read(reinterpret_cast<char*>(record_header), sizeof(record_header));
+		if (stream.fail()) {
+			throw std::invalid_argument("Bootstrapping key is truncated");
+		}
+		const uint64_t galois_elt = record_header[record_header_galois_elt];
+		if (galois_elt % 2 == 0 || galois_elt > std::numeric_limits<uint32_t>::max() || GaloisKeys::get_index(static_cast<uint32_t>(galois_elt)) >= new_gk.data().size()) {
+			throw std::invalid_argument("Invalid galois element in bootstrapping key");
+		}
+		if (!is_required(static_cast<uint32_t>(galois_elt))) {
+			stream.ignore(record_header[record_header_byte_count]);
+			continue;
+		}
+		std::vector<PublicKey>& keys = new_gk.data()[GaloisKeys::get_index(static_cast<uint32_t>(galois_elt))];
+		keys.resize(record_header[record_header_component_count]);
+		for (PublicKey& key : keys) {
+			key.load(context, stream);
+		}
+	}
+	if (stream.fail()) {
+		throw std::invalid_argument("Bootstrapping key is truncated");
+	}
+	if (!is_metadata_valid_for(new_gk, context)) {
+		throw std::invalid_argument("Galois keys are not valid for the context");
+	}
+	encrypted_sk = std::move(new_encrypted_sk);
+	rk = std::move(new_rk);
+	gk = std::move(new_gk);
+	context_gk.clear();
+	context_rk.clear();
+}
+
+void Bootstrapper::load_bootstrapping_key(std::istream& stream, BootstrappingKey& bk, BootstrapStage stage) const
+{
+	bk.load(context_chain.target_context(), stream, galois_key_elements(stage));
+	create_context_keys(bk);
 }
 
 bool BootstrappingKey::is_valid_for(const seal::SEALContext& context) const
@@ -290,90 +587,356 @@ bool BootstrappingKey::is_valid_for(const seal::SEALContext& context) const
 	return is_metadata_valid_for(gk, context) && is_metadata_valid_for(rk, context) && is_metadata_valid_for(encrypted_sk, context) && is_buffer_valid(gk) && is_buffer_valid(rk) && is_buffer_valid(encrypted_sk);
 }
 
+namespace {
+
+	// computes x -= y, after switching the one at the higher level down to the level of the other
+	void sub_at_common_level_inplace(const Evaluator& evaluator, Ciphertext& x, Ciphertext& y, MemoryPoolHandle pool)
+	{
+		if (x.coeff_modulus_size() > y.coeff_modulus_size()) {
+			evaluator.mod_switch_to_inplace(x, y.parms_id(), pool);
+		}
+		else if (y.coeff_modulus_size() > x.coeff_modulus_size()) {
+			evaluator.mod_switch_to_inplace(y, x.parms_id(), pool);
+		}
+		evaluator.sub_inplace(x, y);
+	}
+}
+
 void Bootstrapper::slotwise_digit_extract(const seal::Ciphertext& ciphertext, const BootstrappingKey& bk, seal::Ciphertext& destination, seal::MemoryPoolHandle pool DEBUG_PARAMS) const
 {
+	pool = stage_pool(pool);
+	BootstrapStageTimer timer(stats.get(), BootstrapStage::digit_extract, pool, destination);
 	const size_t digits_to_remove = slot_ring->exponent() - 1;
 	const size_t highest_digit_index = slot_ring->exponent() - 1;
 	util::Pointer<Ciphertext> worktable = util::allocate<Ciphertext>(digits_to_remove, pool);
 
 	// add modulus / 2 to perform rounding instead of flooring
-	Plaintext shift;
-	shift.resize(1);
+	Plaintext shift(1, pool);
 	for (size_t i = 0; i < digits_to_remove; ++i) {
 		shift.data()[0] *= slot_ring->prime();
 		shift.data()[0] += slot_ring->prime() / 2;
 	}
 	destination = ciphertext;
-	bootstrapping_evaluator().add_plain_inplace(destination, shift);
+	bootstrapping_evaluator().add_plain_inplace(destination, shift, pool);
 
-	SEAL_ITERATE(iter(worktable), digits_to_remove, [&destination](auto& I) {
-		I = destination;
+	SEAL_ITERATE(iter(worktable), digits_to_remove, [&destination, &pool](auto& I) {
+		I = Ciphertext(destination, pool);
 	});
 
-	SEAL_ITERATE(iter(worktable, size_t(0)), digits_to_remove, [&](auto I) {
-		const size_t current_index = std::get<1>(I);
-		Ciphertext& current = std::get<0>(I);
+	//tex:
+	//The lane with index $i$ computes $J = 1, ..., e - 1 - i$ digit extraction steps starting from worktable[i], and the
+	//result of step $J$ is subtracted from worktable[i + J]. Hence, lane $i$ can start as soon as all
+	//lanes $k < i$ have performed step $i - k$, which gives a "diagonal" schedule with a critical path of only $e - 1$ steps.
+	//We build this dependency graph explicitly, with one task per digit extraction step.
+	std::vector<Ciphertext> lane_current(digits_to_remove);
+	std::mutex subtraction_mutex;
+	// the results are eventually switched to the target context, so its plaintext modulus must fit into the remaining modulus
+	const int plain_modulus_bits = bootstrapping_context().first_context_data()->parms().plain_modulus().bit_count();
+	TaskGraph graph;
+	// step_task[i][J - 1] is the task of step J in lane i
+	std::vector<std::vector<size_t>> step_task(digits_to_remove);
+
+	for (size_t current_index = 0; current_index < digits_to_remove; ++current_index) {
 		const size_t context_index = context_chain.size() - current_index - 1;
-		const Evaluator& evaluator = context_chain.get_evaluator(context_index);
-		const SEALContext& context = context_chain.get_context(context_index);
-		RelinKeys rk;
-		GaloisKeys gk;
-		context_chain.convert_kswitchkey(bk.galois_keys(), gk, context_index);
-		context_chain.convert_kswitchkey(bk.relin_keys(), rk, context_index);
-		Ciphertext tmp;
-		context_chain.divide_exact_switch_inplace(current, current_index);
-
-		SEAL_ITERATE(util::iter(size_t(1)), highest_digit_index - current_index, [&](auto J) {
-			digit_extract_poly->apply_ciphertext(current, context, evaluator, gk, rk, tmp);
-			current = tmp;
-			if (current_index + J < digits_to_remove) {
-				context_chain.multiply_switch_inplace(tmp, current_index);
-				bootstrapping_evaluator().sub_inplace(worktable[current_index + J], tmp);
-			}
-		});
-		DEBUG_LOG_NOISE_BUDGET(context_chain, current);
-		context_chain.multiply_switch_inplace(current, current_index);
-		bootstrapping_evaluator().sub_inplace(destination, current);
-	});
+
+		std::vector<size_t> first_step_dependencies;
+		for (size_t k = 0; k < current_index; ++k) {
+			first_step_dependencies.push_back(step_task[k][current_index - k - 1]);
+		}
+
+		const size_t step_count = highest_digit_index - current_index;
+		for (size_t J = 1; J <= step_count; ++J) {
+			const std::vector<size_t> dependencies = J == 1 ? first_step_dependencies : std::vector<size_t>{ step_task[current_index].back() };
+			step_task[current_index].push_back(graph.add_task([&, current_index, context_index, J, step_count]() {
+				const Evaluator& evaluator = context_chain.get_evaluator(context_index);
+				const SEALContext& context = context_chain.get_context(context_index);
+				const GaloisKeys& gk = bk.galois_keys(context_index);
+				const RelinKeys& rk = bk.relin_keys(context_index);
+				// the task runs on a worker thread, whose own pool is used in thread-local mode
+				const MemoryPoolHandle task_pool = stage_pool(pool);
+				Ciphertext& current = lane_current[current_index];
+				if (J == 1) {
+					current = std::move(worktable[current_index]);
+					context_chain.divide_exact_switch_inplace(current, current_index);
+				}
+				if (digit_extract_step_modulus_bits != 0) {
+					const size_t remaining_steps = step_count - J + 1;
+					context_chain.mod_switch_to_bits_inplace(current, static_cast<int>(remaining_steps + 1) * digit_extract_step_modulus_bits + plain_modulus_bits, task_pool);
+				}
+				Ciphertext tmp(task_pool);
+				digit_extract_poly->apply_ciphertext(current, context, evaluator, gk, rk, tmp, task_pool);
+				current = tmp;
+				if (current_index + J < digits_to_remove) {
+					context_chain.multiply_switch_inplace(tmp, current_index);
+					std::unique_lock<std::mutex> lock(subtraction_mutex);
+					sub_at_common_level_inplace(bootstrapping_evaluator(), worktable[current_index + J], tmp, task_pool);
+				}
+				if (J == step_count) {
+					DEBUG_LOG_NOISE_BUDGET(context_chain, current);
+					context_chain.multiply_switch_inplace(current, current_index);
+					std::unique_lock<std::mutex> lock(subtraction_mutex);
+					sub_at_common_level_inplace(bootstrapping_evaluator(), destination, current, task_pool);
+				}
+			}, dependencies));
+		}
+	}
+	graph.run(thread_pool.get());
 
 	context_chain.divide_exact_switch_inplace(destination, digits_to_remove);
 }
 
 void Bootstrapper::slots_to_coeffs(const seal::Ciphertext& ciphertext, const BootstrappingKey& bk, seal::Ciphertext& destination, seal::MemoryPoolHandle pool DEBUG_PARAMS) const
 {
-	GaloisKeys base_gk;
-	context_chain.convert_kswitchkey(bk.galois_keys(), base_gk, 0);
-	slots_to_coefficients->apply_ciphertext(ciphertext, context_chain.get_evaluator(0), base_gk, destination);
+	pool = stage_pool(pool);
+	BootstrapStageTimer timer(stats.get(), BootstrapStage::slots_to_coeffs, pool, destination);
+	slots_to_coefficients->apply_ciphertext(ciphertext, context_chain.get_context(0), context_chain.get_evaluator(0), bk.galois_keys(0), destination, thread_pool.get(), pool, use_thread_local_pools);
 }
 
 void Bootstrapper::coeffs_to_slots(const seal::Ciphertext& ciphertext, const BootstrappingKey& bk, seal::Ciphertext& destination, seal::MemoryPoolHandle pool DEBUG_PARAMS) const
 {
-	seal::Ciphertext tmp;
-	// first we remove all the coefficients "to discard" by applying the trace
-	trace_op->apply_ciphertext(ciphertext, bootstrapping_evaluator(), bk.galois_keys(), tmp);
-	// fix the constant factor introduced by trace
-	const uint64_t error_factor = slot_ring->R().scalar_mod.reduce(trace_op->field_index());
-	const uint64_t correction_factor = inv_mod(error_factor, slot_ring->R().scalar_mod);
-	Plaintext factor;
-	factor.resize(1);
-	factor[0] = correction_factor;
-	bootstrapping_evaluator().multiply_plain_inplace(tmp, factor, pool);
-	coefficients_to_slots->apply_ciphertext(tmp, bootstrapping_evaluator(), bk.galois_keys(), destination);
+	pool = stage_pool(pool);
+	BootstrapStageTimer timer(stats.get(), BootstrapStage::coeffs_to_slots, pool, destination);
+	seal::Ciphertext tmp(pool);
+	// first we remove all the coefficients "to discard" by applying the trace;
+	// the constant factor introduced by the trace is already fixed by the coefficients of the transform, see initialize()
+	trace_op->apply_ciphertext(ciphertext, bootstrapping_evaluator(), bk.galois_keys(), tmp, pool);
+	coefficients_to_slots->apply_ciphertext(tmp, bootstrapping_context(), bootstrapping_evaluator(), bk.galois_keys(), destination, thread_pool.get(), pool, use_thread_local_pools);
+}
+
+void Bootstrapper::bootstrap(const seal::Ciphertext& ciphertext, const BootstrappingKey& bk, seal::Ciphertext& destination, seal::MemoryPoolHandle pool DEBUG_PARAMS) const
+{
+	if (!bk.is_valid_for(context_chain.target_context())) {
+		throw std::invalid_argument("Invalid bootstrapping key");
+	}
+	bootstrap_unchecked(ciphertext, bk, destination, pool DEBUG_PASS(debug_sk));
+}
+
+void Bootstrapper::bootstrap_unchecked(const seal::Ciphertext& ciphertext, const BootstrappingKey& bk, seal::Ciphertext& destination, seal::MemoryPoolHandle pool DEBUG_PARAMS) const
+{
+	pool = stage_pool(pool);
+	BootstrapStageTimer timer(stats.get(), BootstrapStage::bootstrap, pool, destination);
+	if (coefficients_to_slots == nullptr) {
+		throw std::logic_error("Bootstrapper not initialized");
+	}
+	Ciphertext in_coeffs(pool);
+	slots_to_coeffs(ciphertext, bk, in_coeffs, pool DEBUG_PASS(debug_sk));
+	Ciphertext noisy_dec(pool);
+	{
+		BootstrapStageTimer timer(stats.get(), BootstrapStage::noisy_decrypt, pool, noisy_dec);
+		homomorphic_noisy_decrypt_unchecked(in_coeffs, bk, noisy_dec, pool);
+	}
+	in_coeffs.release();
+	Ciphertext in_slots(pool);
+	coeffs_to_slots(noisy_dec, bk, in_slots, pool DEBUG_PASS(debug_sk));
+	noisy_dec.release();
+	slotwise_digit_extract(in_slots, bk, destination, pool DEBUG_PASS(debug_sk));
+}
+
+void Bootstrapper::bootstrap_batch(std::span<const seal::Ciphertext> ciphertexts, const BootstrappingKey& bk, std::vector<seal::Ciphertext>& destinations, seal::MemoryPoolHandle pool DEBUG_PARAMS) const
+{
+	// validating the key requires a pass over all the key material, so do it only once
+	if (!bk.is_valid_for(context_chain.target_context())) {
+		throw std::invalid_argument("Invalid bootstrapping key");
+	}
+	destinations.resize(ciphertexts.size());
+	// the single bootstraps use the same thread pool, but since the calling thread always takes part
+	// in the work, this is fine; if the batch is large enough, most of the parallelism comes from here.
+	// In thread-local mode, bootstrap_unchecked() replaces pool by the pool of the executing thread
+	parallel_for(thread_pool.get(), 0, ciphertexts.size(), [&](size_t i) {
+		destinations[i] = Ciphertext(stage_pool(pool));
+		bootstrap_unchecked(ciphertexts[i], bk, destinations[i], pool DEBUG_PASS(debug_sk));
+	});
+}
+
+namespace {
+
+	std::unique_ptr<CompiledSubringLinearTransform> load_or_compile_transform(
+		const std::string& cache_directory,
+		const std::string& name, 
+		std::shared_ptr<const SlotRing> slot_ring, 
+		CompiledSubringLinearTransform(*compile)(std::shared_ptr<const SlotRing>, ThreadPool*, size_t),
+		ThreadPool* thread_pool,
+		size_t active_slot_count
+	) {
+		if (cache_directory.empty()) {
+			return std::make_unique<CompiledSubringLinearTransform>(compile(slot_ring, thread_pool, active_slot_count));
+		}
+		std::ostringstream filename;
+		filename << name << "_p" << slot_ring->prime() << "_e" << slot_ring->exponent() << "_N" << slot_ring->N();
+		if (active_slot_count != 0) {
+			filename << "_k" << active_slot_count;
+		}
+		filename << "_" << std::hex << slot_ring->parameter_hash() << ".bin";
+		const std::filesystem::path path = std::filesystem::path(cache_directory) / filename.str();
+
+		if (std::filesystem::exists(path)) {
+			try {
+				MappedFile file(path.string());
+				return std::make_unique<CompiledSubringLinearTransform>(CompiledSubringLinearTransform::load_mapped(slot_ring, file));
+			}
+			catch (const std::invalid_argument& e) {
+				// outdated or corrupted, so compile it again and overwrite it
+				std::cout << "discarding cached transform " << path << ": " << e.what() << std::endl;
+			}
+		}
+
+		std::unique_ptr<CompiledSubringLinearTransform> result = std::make_unique<CompiledSubringLinearTransform>(compile(slot_ring, thread_pool, active_slot_count));
+
+		// write to a temporary file first, so that concurrent processes never see partially written files
+		std::error_code error;
+		std::filesystem::create_directories(cache_directory, error);
+		const std::filesystem::path tmp_path = path.string() + ".tmp" + std::to_string(std::random_device()());
+		{
+			std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+			result->save_mapped(out);
+			out.close();
+			if (!out) {
+				std::filesystem::remove(tmp_path, error);
+				return result;
+			}
+		}
+		std::filesystem::rename(tmp_path, path, error);
+		if (error) {
+			std::filesystem::remove(tmp_path, error);
+		}
+		return result;
+	}
 }
 
 void Bootstrapper::initialize()
 {
 	if (coefficients_to_slots == nullptr) {
-		coefficients_to_slots = std::make_unique<CompiledSubringLinearTransform>(CompiledSubringLinearTransform::coeffs_to_slots(slot_ring));
-		slots_to_coefficients = std::make_unique<CompiledSubringLinearTransform>(CompiledSubringLinearTransform::slots_to_coeffs(slot_ring));
+		coefficients_to_slots = load_or_compile_transform(transform_cache_directory, "coeffs_to_slots", slot_ring, &CompiledSubringLinearTransform::coeffs_to_slots, thread_pool.get(), active_slot_count);
+		slots_to_coefficients = load_or_compile_transform(transform_cache_directory, "slots_to_coeffs", slot_ring, &CompiledSubringLinearTransform::slots_to_coeffs, thread_pool.get(), active_slot_count);
+		// the trace in coeffs_to_slots() multiplies by the field index, which we undo with the transform instead of a separate
+		// plaintext multiplication; the cached transform stays unscaled, as the trace is not part of it
+		const uint64_t error_factor = slot_ring->R().scalar_mod.reduce(trace_op->field_index());
+		coefficients_to_slots->multiply_scalar(inv_mod(error_factor, slot_ring->R().scalar_mod));
+		update_galois_key_plan(galois_key_budget);
 	}
 }
 
+void Bootstrapper::precompute()
+{
+	if (coefficients_to_slots == nullptr) {
+		throw std::logic_error("Bootstrapper not initialized");
+	}
+	const SEALContext& slots_to_coeffs_context = context_chain.get_context(0);
+	slots_to_coefficients->precompute(slots_to_coeffs_context, slots_to_coeffs_context.first_parms_id(), thread_pool.get());
+	coefficients_to_slots->precompute(bootstrapping_context(), bootstrapping_context().first_parms_id(), thread_pool.get());
+}
+
+void Bootstrapper::set_transform_cache_directory(std::string directory)
+{
+	transform_cache_directory = std::move(directory);
+}
+
+void Bootstrapper::set_stats(std::shared_ptr<BootstrapStats> stats)
+{
+	this->stats = std::move(stats);
+}
+
+void Bootstrapper::set_thread_pool(std::shared_ptr<ThreadPool> thread_pool)
+{
+	this->thread_pool = std::move(thread_pool);
+}
+
+void Bootstrapper::set_use_thread_local_pools(bool enabled)
+{
+	use_thread_local_pools = enabled;
+}
+
+seal::MemoryPoolHandle Bootstrapper::stage_pool(seal::MemoryPoolHandle pool) const
+{
+	return use_thread_local_pools ? thread_local_memory_pool() : pool;
+}
+
+void Bootstrapper::set_galois_key_budget(size_t budget_bytes)
+{
+	update_galois_key_plan(budget_bytes);
+}
+
+void Bootstrapper::set_digit_extract_step_modulus_bits(int bits)
+{
+	if (bits < 0) {
+		throw std::invalid_argument("Modulus bits per digit extraction step must not be negative");
+	}
+	digit_extract_step_modulus_bits = bits;
+}
+
+void Bootstrapper::set_active_slot_count(size_t count)
+{
+	if (count > slot_ring->slot_group_len()) {
+		throw std::invalid_argument("Active slot count exceeds the number of slots");
+	}
+	if (coefficients_to_slots != nullptr) {
+		throw std::logic_error("Active slot count must be set before initializing the bootstrapper");
+	}
+	active_slot_count = count;
+}
+
 const seal::SEALContext& Bootstrapper::bootstrapping_context() const
 {
 	return context_chain.target_context();
 }
 
+void test_slotwise_norm()
+{
+	EncryptionParameters parms(scheme_type::bfv);
+	SlotRing slot_ring = *p_257_test_parameters();
+	parms.set_poly_modulus_degree(slot_ring.N());
+	parms.set_coeff_modulus(CoeffModulus::BFVDefault(slot_ring.N()));
+	parms.set_plain_modulus(slot_ring.R().scalar_mod.value());
+	SEALContext context(parms);
+	const size_t subfield_index_log2 = log2_exact(slot_ring.slot_rank()) - 3;
+
+	KeyGenerator keygen(context);
+	SecretKey sk = keygen.secret_key();
+	PublicKey pk;
+	keygen.create_public_key(pk);
+	RelinKeys rk;
+	keygen.create_relin_keys(rk);
+
+	poly data;
+	poly_add(data, slot_ring.from_slot_value({ 5, 2, 0, 1 }, 0), slot_ring.R().scalar_mod);
+	poly_add(data, slot_ring.from_slot_value({ 3 * 257 + 1 }, 1), slot_ring.R().scalar_mod);
+	Plaintext x_plain{ gsl::span<const uint64_t>(data) };
+
+	Encryptor encryptor(context, pk);
+	Ciphertext x_enc;
+	encryptor.encrypt(x_plain, x_enc);
+	Evaluator eval(context);
+	Decryptor decryptor(context, sk);
+
+	poly expected = SlotwiseNorm(slot_ring, subfield_index_log2)(data);
+	expected.resize(slot_ring.N());
+
+	SlotwiseNorm norm(slot_ring, subfield_index_log2);
+	assert(norm.galois_elements().size() == 3);
+	GaloisKeys gk;
+	keygen.create_galois_keys(norm.galois_elements(), gk);
+
+	for (bool relinearize_result : { true, false }) {
+		BootstrapStats stats;
+		Ciphertext result_enc;
+		{
+			BootstrapStatsScope scope(&stats);
+			norm.apply_ciphertext(x_enc, eval, gk, rk, result_enc, relinearize_result);
+		}
+		assert(result_enc.size() == (relinearize_result ? 2 : 3));
+		// one galois key-switch per doubling step, which is minimal
+		assert(stats.galois_operations() == 3);
+		assert(stats.relin_operations() == (relinearize_result ? 3 : 2));
+
+		Plaintext result;
+		decryptor.decrypt(result_enc, result);
+		poly result_poly(result.data(), result.data() + result.coeff_count());
+		result_poly.resize(slot_ring.N());
+		assert(result_poly == expected);
+	}
+	std::cout << "test_slotwise_norm(): success" << std::endl;
+}
+
 void test_galois_poly_evaluator()
 {
 	{
@@ -465,6 +1028,108 @@ void test_galois_poly_evaluator()
 	std::cout << "test_galois_poly_evaluator(): success" << std::endl;
 }
 
+void test_paterson_stockmeyer_poly_evaluator()
+{
+	{
+		EncryptionParameters parms(scheme_type::bfv);
+		SlotRing slot_ring = *p_127_test_parameters();
+		parms.set_poly_modulus_degree(slot_ring.N());
+		parms.set_coeff_modulus(CoeffModulus::BFVDefault(slot_ring.N()));
+		parms.set_plain_modulus(127 * 127 * 127);
+		std::unique_ptr<PolyEvaluator> digit_extractor = p_127_test_parameters_paterson_stockmeyer_digit_extractor(slot_ring);
+		SEALContext context(parms);
+
+		KeyGenerator keygen(context);
+		SecretKey sk = keygen.secret_key();
+		PublicKey pk;
+		keygen.create_public_key(pk);
+		RelinKeys rk;
+		keygen.create_relin_keys(rk);
+		GaloisKeys gk;
+		keygen.create_galois_keys(digit_extractor->galois_elements(), gk);
+
+		poly data;
+		poly_add(data, slot_ring.from_slot_value({ 5 * 127 * 127 + 2 * 127 - 7 }, 0), slot_ring.R().scalar_mod);
+		poly_add(data, slot_ring.from_slot_value({ 127 * 127 + 66 }, 1), slot_ring.R().scalar_mod);
+		Plaintext x_plain{ gsl::span<const uint64_t>(data) };
+
+		Encryptor encryptor(context, pk);
+		Ciphertext x_enc;
+		encryptor.encrypt(x_plain, x_enc);
+
+		Ciphertext result_enc;
+		Evaluator eval(context);
+		digit_extractor->apply_ciphertext(x_enc, context, eval, gk, rk, result_enc);
+		assert(result_enc.size() == 2);
+
+		Decryptor decryptor(context, sk);
+		Plaintext result;
+		decryptor.decrypt(result_enc, result);
+
+		poly result_poly(result.data(), result.data() + result.coeff_count());
+		result_poly.resize(slot_ring.N());
+		poly expected;
+		poly_add(expected, slot_ring.from_slot_value({ 1822697 /* same as in test_galois_poly_evaluator() */ }, 0), slot_ring.R().scalar_mod);
+		poly_add(expected, slot_ring.from_slot_value({ 66 }, 1), slot_ring.R().scalar_mod);
+
+		assert(result_poly == expected);
+	}
+	{
+		EncryptionParameters parms(scheme_type::bfv);
+		SlotRing slot_ring = *p_257_test_parameters();
+		parms.set_poly_modulus_degree(slot_ring.N());
+		parms.set_coeff_modulus(CoeffModulus::BFVDefault(slot_ring.N()));
+		parms.set_plain_modulus(slot_ring.R().scalar_mod.value());
+		SEALContext context(parms);
+
+		KeyGenerator keygen(context);
+		SecretKey sk = keygen.secret_key();
+		PublicKey pk;
+		keygen.create_public_key(pk);
+		RelinKeys rk;
+		keygen.create_relin_keys(rk);
+
+		// a dense correction polynomial without constant coefficient (so the empty slots stay zero), compared against a plain evaluation
+		const Modulus& plain_modulus = slot_ring.R().scalar_mod;
+		poly correction_poly;
+		for (size_t i = 0; i < 11; ++i) {
+			correction_poly.push_back(plain_modulus.reduce(i * i * 1031 + 17 * i));
+		}
+		PatersonStockmeyerPolyEvaluator digit_extractor(slot_ring, p_257_test_parameters_evaluation_element(slot_ring), 8, 2, correction_poly);
+		GaloisKeys gk;
+		keygen.create_galois_keys(digit_extractor.galois_elements(), gk);
+
+		const uint64_t x = 5 * 257 * 257 + 6 * 257 - 3;
+		poly data;
+		poly_add(data, slot_ring.from_slot_value({ x }, 0), slot_ring.R().scalar_mod);
+		Plaintext x_plain{ gsl::span<const uint64_t>(data) };
+
+		Encryptor encryptor(context, pk);
+		Ciphertext x_enc;
+		encryptor.encrypt(x_plain, x_enc);
+
+		Ciphertext result_enc;
+		Evaluator eval(context);
+		digit_extractor.apply_ciphertext(x_enc, context, eval, gk, rk, result_enc);
+
+		// the first test case shows that x * N(evaluation_element - x) - 3 * x = 15521769
+		const uint64_t norm_times_x = util::add_uint_mod(15521769, util::multiply_uint_mod(3, x, plain_modulus), plain_modulus);
+		const uint64_t expected_value = util::add_uint_mod(util::multiply_uint_mod(norm_times_x, x, plain_modulus), poly_eval(correction_poly, x, plain_modulus), plain_modulus);
+
+		Decryptor decryptor(context, sk);
+		Plaintext result;
+		decryptor.decrypt(result_enc, result);
+
+		poly result_poly(result.data(), result.data() + result.coeff_count());
+		result_poly.resize(slot_ring.N());
+		poly expected;
+		poly_add(expected, slot_ring.from_slot_value({ expected_value }, 0), slot_ring.R().scalar_mod);
+
+		assert(result_poly == expected);
+	}
+	std::cout << "test_paterson_stockmeyer_poly_evaluator(): success" << std::endl;
+}
+
 void test_homomorphic_noisy_decrypt() {
 	{
 		EncryptionParameters parms(scheme_type::bfv);
@@ -472,7 +1137,8 @@ void test_homomorphic_noisy_decrypt() {
 		parms.set_poly_modulus_degree(slot_ring->N());
 		parms.set_coeff_modulus(CoeffModulus::BFVDefault(slot_ring->N()));
 		parms.set_plain_modulus(slot_ring->prime());
-		SEALContext context(parms, false, sec_level_type::none);
+		// with a modulus switching chain, to also convert a ciphertext below the first level
+		SEALContext context(parms, true, sec_level_type::none);
 
 		KeyGenerator keygen(context);
 		SecretKey sk = keygen.secret_key();
@@ -513,6 +1179,16 @@ void test_homomorphic_noisy_decrypt() {
 		for (size_t i = 1; i < noisy_x.coeff_count(); ++i) {
 			assert(div_rounded(noisy_x[i]) == 0);
 		}
+
+		// e.g. a bootstrapping result whose primes were dropped by set_digit_extract_step_modulus_bits()
+		evaluator.mod_switch_to_next_inplace(x_enc);
+		assert(x_enc.parms_id() != context.first_parms_id());
+		bootstrapper.homomorphic_noisy_decrypt(x_enc, bk, noisy_enc_x, MemoryManager::GetPool() DEBUG_PASS(sk));
+		decryptor.decrypt(noisy_enc_x, noisy_x);
+		assert(div_rounded(noisy_x[0]) == 4);
+		for (size_t i = 1; i < noisy_x.coeff_count(); ++i) {
+			assert(div_rounded(noisy_x[i]) == 0);
+		}
 	} 
 	{
 		EncryptionParameters parms(scheme_type::bfv);
@@ -574,7 +1250,7 @@ void test_slotwise_digit_extract() {
 	parms.set_coeff_modulus(CoeffModulus::BFVDefault(slot_ring->N()));
 	parms.set_plain_modulus(slot_ring->prime());
 	std::unique_ptr<PolyEvaluator> digit_extractor = p_127_test_parameters_digit_extractor(*slot_ring);
-	SEALContext context(parms, false);
+	SEALContext context(parms);
 
 	KeyGenerator keygen(context);
 	SecretKey sk = keygen.secret_key();
@@ -617,6 +1293,24 @@ void test_slotwise_digit_extract() {
 	poly_add(expected, result_slot_ring.from_slot_value({ 111 }, 63), result_slot_ring.R().scalar_mod);
 
 	assert(result_poly == expected);
+
+	// the lanes are now scheduled in parallel, the result must not change
+	bootstrapper.set_thread_pool(std::make_shared<ThreadPool>(4));
+	bootstrapper.slotwise_digit_extract(x_enc, bk, result_enc, MemoryManager::GetPool() DEBUG_PASS(sk));
+	decryptor.decrypt(result_enc, result);
+	result_poly = poly(result.data(), result.data() + result.coeff_count());
+	result_poly.resize(result_slot_ring.N());
+	assert(result_poly == expected);
+
+	// with this estimate, the steps after the first one of each lane run with one prime less
+	bootstrapper.set_digit_extract_step_modulus_bits(350);
+	bootstrapper.slotwise_digit_extract(x_enc, bk, result_enc, MemoryManager::GetPool() DEBUG_PASS(sk));
+	assert(result_enc.coeff_modulus_size() < x_enc.coeff_modulus_size());
+	decryptor.decrypt(result_enc, result);
+	result_poly = poly(result.data(), result.data() + result.coeff_count());
+	result_poly.resize(result_slot_ring.N());
+	assert(result_poly == expected);
+
 	std::cout << "test_slotwise_digit_extract(): success" << std::endl;
 }
 
@@ -678,6 +1372,197 @@ void test_coeffs_to_slots()
 	std::cout << "test_coeffs_to_slots(): success" << std::endl;
 }
 
+void test_bootstrap_batch()
+{
+	EncryptionParameters parms(scheme_type::bfv);
+	std::shared_ptr<const SlotRing> slot_ring = p_257_test_parameters();
+	SlotRing basic_slot_ring = slot_ring->change_exponent(1);
+	parms.set_poly_modulus_degree(slot_ring->N());
+	parms.set_coeff_modulus(CoeffModulus::BFVDefault(slot_ring->N()));
+	parms.set_plain_modulus(slot_ring->prime());
+	SEALContext context(parms);
+
+	KeyGenerator keygen(context);
+	SecretKey sk = keygen.secret_key();
+	PublicKey pk;
+	keygen.create_public_key(pk);
+	Encryptor encryptor(context, pk);
+	Decryptor decryptor(context, sk);
+
+	std::vector<Ciphertext> x_enc(3);
+	for (size_t i = 0; i < x_enc.size(); ++i) {
+		poly data;
+		poly_add(data, basic_slot_ring.from_slot_value({ 3 * i + 1 }, 0), basic_slot_ring.R().scalar_mod);
+		poly_add(data, basic_slot_ring.from_slot_value({ 100 + i }, 3), basic_slot_ring.R().scalar_mod);
+		Plaintext x_plain{ gsl::span<const uint64_t>(data) };
+		encryptor.encrypt(x_plain, x_enc[i]);
+	}
+
+	Bootstrapper bootstrapper(context, slot_ring, p_257_test_parameters_digit_extractor(*slot_ring));
+	bootstrapper.set_thread_pool(std::make_shared<ThreadPool>(4));
+	bootstrapper.initialize();
+	bootstrapper.precompute();
+	BootstrappingKey bk;
+	bootstrapper.create_bootstrapping_key(sk, bk);
+
+	std::vector<Ciphertext> result_enc;
+	const auto check_results = [&]() {
+		assert(result_enc.size() == x_enc.size());
+		for (size_t i = 0; i < x_enc.size(); ++i) {
+			Plaintext result;
+			decryptor.decrypt(result_enc[i], result);
+			poly result_poly(result.data(), result.data() + result.coeff_count());
+			result_poly.resize(basic_slot_ring.N());
+			assert(basic_slot_ring.extract_slot_value(result_poly, 0)[0] == 3 * i + 1);
+			assert(basic_slot_ring.extract_slot_value(result_poly, 3)[0] == 100 + i);
+			assert(is_zero(basic_slot_ring.extract_slot_value(result_poly, 1)));
+		}
+	};
+
+	// all stages allocate from the given pool
+	MemoryPoolHandle pool = MemoryManager::GetPool(mm_prof_opt::mm_force_new);
+	std::shared_ptr<BootstrapStats> stats = std::make_shared<BootstrapStats>();
+	bootstrapper.set_stats(stats);
+	bootstrapper.bootstrap_batch(x_enc, bk, result_enc, pool DEBUG_PASS(sk));
+	assert(pool.alloc_byte_count() > 0);
+	// with one key per element, the plan counts exactly the key-switches of the galois automorphisms
+	assert(stats->galois_operations() == x_enc.size() * bootstrapper.galois_key_plan().key_switch_count());
+	bootstrapper.set_stats(nullptr);
+	check_results();
+
+	// all temporaries, including those of the workers of the linear transforms, and the results come from the thread-local pools;
+	// SEAL creates the galois permutation tables in the global pool, but they already exist after the first batch
+	bootstrapper.set_use_thread_local_pools(true);
+	MemoryPoolHandle unused_pool = MemoryManager::GetPool(mm_prof_opt::mm_force_new);
+	const size_t global_allocated_bytes = MemoryManager::GetPool().alloc_byte_count();
+	bootstrapper.bootstrap_batch(x_enc, bk, result_enc, unused_pool DEBUG_PASS(sk));
+	assert(unused_pool.alloc_byte_count() == 0);
+	assert(MemoryManager::GetPool().alloc_byte_count() == global_allocated_bytes);
+	check_results();
+
+	std::cout << "test_bootstrap_batch(): success" << std::endl;
+}
+
+void test_bootstrap_active_slots()
+{
+	EncryptionParameters parms(scheme_type::bfv);
+	std::shared_ptr<const SlotRing> slot_ring = p_257_test_parameters();
+	SlotRing basic_slot_ring = slot_ring->change_exponent(1);
+	parms.set_poly_modulus_degree(slot_ring->N());
+	parms.set_coeff_modulus(CoeffModulus::BFVDefault(slot_ring->N()));
+	parms.set_plain_modulus(slot_ring->prime());
+	SEALContext context(parms);
+
+	KeyGenerator keygen(context);
+	SecretKey sk = keygen.secret_key();
+	PublicKey pk;
+	keygen.create_public_key(pk);
+	Encryptor encryptor(context, pk);
+	Decryptor decryptor(context, sk);
+
+	poly data;
+	poly_add(data, basic_slot_ring.from_slot_value({ 17 }, 0), basic_slot_ring.R().scalar_mod);
+	poly_add(data, basic_slot_ring.from_slot_value({ 200 }, 2), basic_slot_ring.R().scalar_mod);
+	Plaintext x_plain{ gsl::span<const uint64_t>(data) };
+	Ciphertext x_enc;
+	encryptor.encrypt(x_plain, x_enc);
+
+	Bootstrapper bootstrapper(context, slot_ring, p_257_test_parameters_digit_extractor(*slot_ring));
+	bootstrapper.set_active_slot_count(3);
+	bootstrapper.initialize();
+	BootstrappingKey bk;
+	bootstrapper.create_bootstrapping_key(sk, bk);
+
+	Ciphertext result_enc;
+	bootstrapper.bootstrap(x_enc, bk, result_enc, MemoryManager::GetPool() DEBUG_PASS(sk));
+
+	Plaintext result;
+	decryptor.decrypt(result_enc, result);
+	poly result_poly(result.data(), result.data() + result.coeff_count());
+	result_poly.resize(basic_slot_ring.N());
+	assert(basic_slot_ring.extract_slot_value(result_poly, 0)[0] == 17);
+	assert(is_zero(basic_slot_ring.extract_slot_value(result_poly, 1)));
+	assert(basic_slot_ring.extract_slot_value(result_poly, 2)[0] == 200);
+	for (size_t i = 3; i < basic_slot_ring.slot_group_len(); ++i) {
+		assert(is_zero(basic_slot_ring.extract_slot_value(result_poly, i)));
+	}
+
+	std::cout << "test_bootstrap_active_slots(): success" << std::endl;
+}
+
+void test_save_load_bootstrapping_key()
+{
+	EncryptionParameters parms(scheme_type::bfv);
+	std::shared_ptr<const SlotRing> slot_ring = p_127_test_parameters();
+	parms.set_poly_modulus_degree(slot_ring->N());
+	parms.set_coeff_modulus(CoeffModulus::BFVDefault(slot_ring->N()));
+	parms.set_plain_modulus(slot_ring->prime());
+	SEALContext context(parms, false, sec_level_type::none);
+
+	KeyGenerator keygen(context);
+	SecretKey sk = keygen.secret_key();
+	PublicKey pk;
+	keygen.create_public_key(pk);
+	Encryptor encryptor(context, pk);
+
+	std::vector<uint64_t> data = { 4 };
+	Ciphertext x_enc;
+	encryptor.encrypt(Plaintext{ gsl::span<const uint64_t>(data) }, x_enc);
+
+	Bootstrapper bootstrapper(context, slot_ring, p_127_test_parameters_digit_extractor(*slot_ring));
+	// dont initialize, as we do not require the linear transforms -> save time
+	BootstrappingKey bk;
+	bootstrapper.create_bootstrapping_key(sk, bk, true);
+
+	std::stringstream stream;
+	bk.save(stream);
+	const std::string saved = stream.str();
+
+	BootstrappingKey loaded;
+	std::stringstream in(saved);
+	bootstrapper.load_bootstrapping_key(in, loaded);
+	for (uint32_t galois_elt : bootstrapper.galois_elements(BootstrapStage::bootstrap)) {
+		assert(loaded.galois_keys().has_key(galois_elt));
+	}
+	// the result of the noisy decryption is deterministic, so must match exactly
+	Ciphertext expected, actual;
+	bootstrapper.homomorphic_noisy_decrypt(x_enc, bk, expected, MemoryManager::GetPool() DEBUG_PASS(sk));
+	bootstrapper.homomorphic_noisy_decrypt(x_enc, loaded, actual, MemoryManager::GetPool() DEBUG_PASS(sk));
+	assert(std::equal(expected.data(), expected.data() + expected.dyn_array().size(), actual.data()));
+
+	// a key with only the galois keys for a single stage
+	BootstrappingKey partial;
+	std::stringstream partial_in(saved);
+	bootstrapper.load_bootstrapping_key(partial_in, partial, BootstrapStage::coeffs_to_slots);
+	for (uint32_t galois_elt : bootstrapper.galois_elements(BootstrapStage::bootstrap)) {
+		const std::vector<uint32_t> stage_elements = bootstrapper.galois_elements(BootstrapStage::coeffs_to_slots);
+		const bool is_stage_element = std::find(stage_elements.begin(), stage_elements.end(), galois_elt) != stage_elements.end();
+		assert(partial.galois_keys().has_key(galois_elt) == is_stage_element);
+	}
+
+	// adding the missing keys in parallel gives the full key again
+	bootstrapper.set_thread_pool(std::make_shared<ThreadPool>(2));
+	size_t created_key_count = 0;
+	bootstrapper.update_bootstrapping_key(sk, partial, [&created_key_count](uint32_t) { created_key_count += 1; });
+	for (uint32_t galois_elt : bootstrapper.galois_elements(BootstrapStage::bootstrap)) {
+		assert(partial.galois_keys().has_key(galois_elt));
+	}
+	assert(created_key_count + bootstrapper.galois_elements(BootstrapStage::coeffs_to_slots).size() == bootstrapper.galois_elements(BootstrapStage::bootstrap).size());
+	bootstrapper.homomorphic_noisy_decrypt(x_enc, partial, actual, MemoryManager::GetPool() DEBUG_PASS(sk));
+	assert(std::equal(expected.data(), expected.data() + expected.dyn_array().size(), actual.data()));
+
+	bool has_thrown = false;
+	try {
+		BootstrappingKey invalid;
+		std::stringstream truncated(saved.substr(0, saved.size() / 2));
+		bootstrapper.load_bootstrapping_key(truncated, invalid);
+	}
+	catch (const std::exception&) {
+		has_thrown = true;
+	}
+	assert(has_thrown);
+	std::cout << "test_save_load_bootstrapping_key(): success" << std::endl;
+}
 
 SlotwiseTrace::SlotwiseTrace(const SlotRing& slot_ring, size_t source_subfield_index_log2, size_t target_subfield_index_log2) : slot_ring(slot_ring), source_subfield_index_log2(source_subfield_index_log2), target_subfield_index_log2(target_subfield_index_log2)
 {
@@ -699,12 +1584,12 @@ poly SlotwiseTrace::operator()(const poly& x) const
 	return current;
 }
 
-void SlotwiseTrace::apply_ciphertext(const Ciphertext& in, const Evaluator& eval, const GaloisKeys& gk, Ciphertext& destination) const
+void SlotwiseTrace::apply_ciphertext(const Ciphertext& in, const Evaluator& eval, const GaloisKeys& gk, Ciphertext& destination, MemoryPoolHandle pool) const
 {
 	destination = in;
-	seal::Ciphertext copy;
+	seal::Ciphertext copy(pool);
 	for (size_t i = log2_exact(slot_ring.slot_rank()) - target_subfield_index_log2; i < log2_exact(slot_ring.slot_rank()) - source_subfield_index_log2; ++i) {
-		eval.apply_galois(destination, static_cast<uint32_t>(seal::util::exponentiate_uint_mod(slot_ring.prime(), (size_t)1 << i, slot_ring.index_mod())), gk, copy); log_galois();
+		apply_galois_composed(eval, destination, static_cast<uint32_t>(seal::util::exponentiate_uint_mod(slot_ring.prime(), (size_t)1 << i, slot_ring.index_mod())), gk, copy, pool); log_galois();
 		eval.add_inplace(destination, copy);
 	}
 }
@@ -729,11 +1614,7 @@ P257CorrectionPolyEvaluator::P257CorrectionPolyEvaluator(const SlotRing& slot_ri
 	if (evaluation_element.size() != slot_ring.slot_rank()) {
 		throw std::invalid_argument("Elements must have slot_rank() coefficients.");
 	}
-	poly slotted_evaluation_element;
-	SEAL_ITERATE(util::iter(size_t(0)), slot_ring.slot_group_len(), [&slotted_evaluation_element, &evaluation_element, &slot_ring](auto I) {
-		poly_add(slotted_evaluation_element, slot_ring.from_slot_value(evaluation_element, I), slot_ring.R().scalar_mod);
-	});
-	this->evaluation_element = std::move(slotted_evaluation_element);
+	this->evaluation_element = slot_ring.from_slot_value_in_all_slots(evaluation_element);
 
 	if (correction_poly.size() != 0) {
 		constant_correction = correction_poly[0];
@@ -748,13 +1629,13 @@ poly P257CorrectionPolyEvaluator::operator()(const poly& x) const
 	throw std::invalid_argument("Unimplemented");
 }
 
-void P257CorrectionPolyEvaluator::apply_ciphertext(const seal::Ciphertext& in, const seal::SEALContext& context, const seal::Evaluator& eval, const seal::GaloisKeys& gk, const seal::RelinKeys& rk, seal::Ciphertext& destination) const
+void P257CorrectionPolyEvaluator::apply_ciphertext(const seal::Ciphertext& in, const seal::SEALContext& context, const seal::Evaluator& eval, const seal::GaloisKeys& gk, const seal::RelinKeys& rk, seal::Ciphertext& destination, seal::MemoryPoolHandle pool) const
 {
 	if (!is_metadata_valid_for(in, context)) {
 		throw std::invalid_argument("Invalid ciphertext");
 	}
 	const Modulus& plain_modulus = context.first_context_data()->parms().plain_modulus();
-	Plaintext evaluation_element(gsl::span(this->evaluation_element));
+	Plaintext evaluation_element(gsl::span(this->evaluation_element), pool);
 	util::modulo_poly_coeffs(
 		util::ConstCoeffIter(this->evaluation_element.data()),
 		this->evaluation_element.size(),
@@ -763,26 +1644,182 @@ void P257CorrectionPolyEvaluator::apply_ciphertext(const seal::Ciphertext& in, c
 	);
 
 	// first, compute the norm of (evaluation_element - in); this is the result up to a correction delta
-	Ciphertext tmp;
-	eval.sub_plain(in, evaluation_element, tmp);
+	Ciphertext tmp(pool);
+	eval.sub_plain(in, evaluation_element, tmp, pool);
 	eval.negate_inplace(tmp);
-	norm_op.apply_ciphertext(tmp, eval, gk, rk, destination);
+	norm_op.apply_ciphertext(tmp, eval, gk, rk, destination, true, pool);
 
 	// then compute non-constant part of the correction
-	naive_add_poly_eval_inplace(destination, correction_poly, in, eval, rk, plain_modulus);
+	PowerCache powers(in, eval, rk, pool);
+	add_poly_eval_inplace(destination, correction_poly, powers, eval, plain_modulus, pool);
 
 	// multiply by x
-	eval.multiply_inplace(destination, in);
-	eval.relinearize_inplace(destination, rk); log_relin();
+	eval.multiply_inplace(destination, powers.power(1), pool); log_multiply();
+	eval.relinearize_inplace(destination, rk, pool); log_relin();
 
 	// add constant part of correction
-	Plaintext correction_constant;
-	correction_constant.resize(1);
+	Plaintext correction_constant(1, pool);
 	correction_constant[0] = plain_modulus.reduce(constant_correction);
-	eval.add_plain_inplace(destination, correction_constant);
+	eval.add_plain_inplace(destination, correction_constant, pool);
 }
 
 std::vector<uint32_t> P257CorrectionPolyEvaluator::galois_elements() const
 {
 	return norm_op.galois_elements();
 }
+
+PatersonStockmeyerPolyEvaluator::PatersonStockmeyerPolyEvaluator(const SlotRing& slot_ring, poly evaluation_element, size_t log2_exponent, size_t norm_factor_degree, poly correction_poly)
+	: slot_ring(slot_ring), norm_factor_degree(norm_factor_degree), norm_op(slot_ring, log2_exact(slot_ring.slot_rank()) - log2_exponent), correction_poly(std::move(correction_poly)), baby_step_count(1)
+{
+	if (evaluation_element.size() != slot_ring.slot_rank()) {
+		throw std::invalid_argument("Elements must have slot_rank() coefficients.");
+	}
+	this->evaluation_element = slot_ring.from_slot_value_in_all_slots(evaluation_element);
+
+	poly_normalize(this->correction_poly);
+	// choose the number of baby steps as a power of two around sqrt(deg / 2), so that all giant steps are powers of two
+	while (2 * baby_step_count * baby_step_count < this->correction_poly.size()) {
+		baby_step_count *= 2;
+	}
+}
+
+poly PatersonStockmeyerPolyEvaluator::operator()(const poly& x) const
+{
+	throw std::invalid_argument("Unimplemented");
+}
+
+namespace {
+
+	/**
+	 * A polynomial evaluated at x, which can also be a constant, in which case no ciphertext is available.
+	 * If there is a ciphertext, it might not be relinearized.
+	*/
+	struct PartialEvaluation {
+		Ciphertext value;
+		bool is_constant = true;
+		uint64_t constant = 0;
+	};
+
+	void add_product(PartialEvaluation& result, const Ciphertext& lhs, const Ciphertext& rhs, const Evaluator& eval, MemoryPoolHandle pool)
+	{
+		if (result.is_constant) {
+			eval.multiply(lhs, rhs, result.value, pool); log_multiply();
+			result.is_constant = false;
+		}
+		else {
+			Ciphertext tmp(pool);
+			eval.multiply(lhs, rhs, tmp, pool); log_multiply();
+			eval.add_inplace(result.value, tmp);
+		}
+	}
+
+	void add_scaled(PartialEvaluation& result, const Ciphertext& x, uint64_t scale, const Evaluator& eval, MemoryPoolHandle pool)
+	{
+		if (scale == 0) {
+			return;
+		}
+		Plaintext scale_plain(1, pool);
+		scale_plain[0] = scale;
+		if (result.is_constant) {
+			eval.multiply_plain(x, scale_plain, result.value, pool); log_multiply_plain();
+			result.is_constant = false;
+		}
+		else {
+			Ciphertext tmp(pool);
+			eval.multiply_plain(x, scale_plain, tmp, pool); log_multiply_plain();
+			eval.add_inplace(result.value, tmp);
+		}
+	}
+
+	//tex:
+	//Evaluates $\sum_{begin \leq i < end} c_i x^{i - begin}$; If there are more than baby_step_count coefficients, the polynomial
+	//is split as $q(x) x^m + r(x)$ where $m$ is the largest baby_step_count $\cdot 2^j$ below its length.
+	PartialEvaluation paterson_stockmeyer(const poly& coefficients, size_t begin, size_t end, size_t baby_step_count, PowerCache& powers, const Evaluator& eval, const RelinKeys& rk, const Modulus& plain_modulus, MemoryPoolHandle pool)
+	{
+		PartialEvaluation result{ Ciphertext(pool) };
+		const size_t len = end - begin;
+		if (len == 0) {
+			return result;
+		}
+		else if (len <= baby_step_count) {
+			for (size_t i = 1; i < len; ++i) {
+				const uint64_t coefficient = plain_modulus.reduce(coefficients[begin + i]);
+				if (coefficient != 0) {
+					add_scaled(result, powers.power(i), coefficient, eval, pool);
+				}
+			}
+			result.constant = plain_modulus.reduce(coefficients[begin]);
+			return result;
+		}
+		size_t m = baby_step_count;
+		while (2 * m < len) {
+			m *= 2;
+		}
+		result = paterson_stockmeyer(coefficients, begin, begin + m, baby_step_count, powers, eval, rk, plain_modulus, pool);
+		PartialEvaluation high = paterson_stockmeyer(coefficients, begin + m, end, baby_step_count, powers, eval, rk, plain_modulus, pool);
+		const Ciphertext& giant_step = powers.power(m);
+		if (!high.is_constant) {
+			if (high.value.size() > 2) {
+				eval.relinearize_inplace(high.value, rk, pool); log_relin();
+			}
+			if (high.constant != 0) {
+				Plaintext constant(1, pool);
+				constant[0] = high.constant;
+				eval.add_plain_inplace(high.value, constant, pool);
+			}
+			add_product(result, high.value, giant_step, eval, pool);
+		}
+		else {
+			add_scaled(result, giant_step, high.constant, eval, pool);
+		}
+		return result;
+	}
+}
+
+void PatersonStockmeyerPolyEvaluator::apply_ciphertext(const seal::Ciphertext& in, const seal::SEALContext& context, const seal::Evaluator& eval, const seal::GaloisKeys& gk, const seal::RelinKeys& rk, seal::Ciphertext& destination, seal::MemoryPoolHandle pool) const
+{
+	if (!is_metadata_valid_for(in, context)) {
+		throw std::invalid_argument("Invalid ciphertext");
+	}
+	const Modulus& plain_modulus = context.first_context_data()->parms().plain_modulus();
+	Plaintext evaluation_element(gsl::span(this->evaluation_element), pool);
+	util::modulo_poly_coeffs(
+		util::ConstCoeffIter(this->evaluation_element.data()),
+		this->evaluation_element.size(),
+		plain_modulus,
+		util::CoeffIter(evaluation_element.data())
+	);
+
+	PowerCache powers(in, eval, rk, pool);
+
+	// the norm of (evaluation_element - in), multiplied with x^norm_factor_degree
+	Ciphertext tmp(pool);
+	eval.sub_plain(in, evaluation_element, tmp, pool);
+	eval.negate_inplace(tmp);
+	if (norm_factor_degree == 0) {
+		norm_op.apply_ciphertext(tmp, eval, gk, rk, destination, false, pool);
+	}
+	else {
+		norm_op.apply_ciphertext(tmp, eval, gk, rk, tmp, true, pool);
+		eval.multiply(tmp, powers.power(norm_factor_degree), destination, pool); log_multiply();
+	}
+
+	// the correction poly; the result is only relinearized once at the end
+	PartialEvaluation correction = paterson_stockmeyer(correction_poly, 0, correction_poly.size(), baby_step_count, powers, eval, rk, plain_modulus, pool);
+	if (!correction.is_constant) {
+		eval.add_inplace(destination, correction.value);
+	}
+	if (correction.constant != 0) {
+		Plaintext constant(1, pool);
+		constant[0] = correction.constant;
+		eval.add_plain_inplace(destination, constant, pool);
+	}
+	if (destination.size() > 2) {
+		eval.relinearize_inplace(destination, rk, pool); log_relin();
+	}
+}
+
+std::vector<uint32_t> PatersonStockmeyerPolyEvaluator::galois_elements() const
+{
+	return norm_op.galois_elements();
+}
@@ -2,6 +2,9 @@
 #include "seal/seal.h"
 #include "transform.h"
 #include "contextchain.h"
+#include "galoisplan.h"
+#include <span>
+#include <functional>
 
 inline void debug_decrypt_and_print(const seal::SEALContext& context, const seal::Ciphertext& ct, const seal::SecretKey& sk, const SlotRing& slot_ring) {
 	std::cout << std::endl << "=============== Out ==============" << std::endl << std::endl;
@@ -72,13 +75,21 @@ inline void debug_decrypt_and_print_raw(const ContextChain& context_chain, const
 #define DEBUG_DEC_PRINT_RAW(x, y)
 #define DEBUG_LOG_NOISE_BUDGET(x, y)
 
-/**
- * Encapsulates the computation of the norm in each slot
-*/
+//tex:
+//Encapsulates the computation of the norm in each slot, i.e. of $$N(x) = \prod_{j < 2^k} \sigma^j(x)$$
+//where $\sigma$ is the Frobenius automorphism and $k$ is the log2 of the relative degree of the slot field
+//over the subfield.
+//
+//The norm is computed by doubling, i.e. as $x_{i + 1} = x_i \sigma^{2^i}(x_i)$ starting from $x_0 = x$, which requires
+//$k$ key-switches; this is minimal, since each key-switch at most doubles the number of conjugates in the product.
 class SlotwiseNorm {
 
 	const SlotRing& slot_ring;
 	size_t subfield_index_log2;
+	// the galois element of each doubling step
+	std::vector<uint32_t> galois_elts;
+
+	size_t level_count() const;
 
 public:
 	SlotwiseNorm(const SlotRing& slot_ring, size_t subfield_index_log2);
@@ -87,8 +98,14 @@ public:
 	~SlotwiseNorm() = default;
 
 	poly operator()(const poly& x) const;
-	void apply_ciphertext(const seal::Ciphertext& in, const seal::Evaluator& eval, const seal::GaloisKeys& gk, const seal::RelinKeys& rk, seal::Ciphertext& destination) const;
-	std::vector<uint32_t> galois_elements() const;
+
+	/**
+	 * Computes the norm of the given size 2 ciphertext. If relinearize_result is false, the final product is
+	 * not relinearized and destination has size 3; this allows the caller to relinearize only once after
+	 * combining it with other products. All temporaries are allocated from pool.
+	*/
+	void apply_ciphertext(const seal::Ciphertext& in, const seal::Evaluator& eval, const seal::GaloisKeys& gk, const seal::RelinKeys& rk, seal::Ciphertext& destination, bool relinearize_result = true, seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool()) const;
+	const std::vector<uint32_t>& galois_elements() const noexcept;
 };
 
 /**
@@ -107,7 +124,7 @@ public:
 	~SlotwiseTrace() = default;
 
 	poly operator()(const poly& x) const;
-	void apply_ciphertext(const seal::Ciphertext& in, const seal::Evaluator& eval, const seal::GaloisKeys& gk, seal::Ciphertext& destination) const;
+	void apply_ciphertext(const seal::Ciphertext& in, const seal::Evaluator& eval, const seal::GaloisKeys& gk, seal::Ciphertext& destination, seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool()) const;
 	std::vector<uint32_t> galois_elements() const;
 	size_t field_index() const;
 };
@@ -126,7 +143,8 @@ public:
 	virtual ~PolyEvaluator() = default;
 
 	virtual poly operator()(const poly&) const = 0;
-	virtual void apply_ciphertext(const seal::Ciphertext& in, const seal::SEALContext& context, const seal::Evaluator& eval, const seal::GaloisKeys& gk, const seal::RelinKeys& rk, seal::Ciphertext& dst) const = 0;
+	// all temporaries are allocated from pool; implementations repeat the default argument, since it is bound statically
+	virtual void apply_ciphertext(const seal::Ciphertext& in, const seal::SEALContext& context, const seal::Evaluator& eval, const seal::GaloisKeys& gk, const seal::RelinKeys& rk, seal::Ciphertext& dst, seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool()) const = 0;
 	virtual std::vector<uint32_t> galois_elements() const = 0;
 };
 
@@ -147,7 +165,7 @@ public:
 	virtual ~P127PolyEvaluator() = default;
 
 	virtual poly operator()(const poly& x) const;
-	virtual void apply_ciphertext(const seal::Ciphertext& in, const seal::SEALContext& context, const seal::Evaluator& eval, const seal::GaloisKeys& gk, const seal::RelinKeys& rk, seal::Ciphertext& destination) const;
+	virtual void apply_ciphertext(const seal::Ciphertext& in, const seal::SEALContext& context, const seal::Evaluator& eval, const seal::GaloisKeys& gk, const seal::RelinKeys& rk, seal::Ciphertext& destination, seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool()) const;
 	virtual std::vector<uint32_t> galois_elements() const;
 };
 
@@ -169,7 +187,30 @@ public:
 	virtual ~P257CorrectionPolyEvaluator() = default;
 
 	virtual poly operator()(const poly& x) const;
-	virtual void apply_ciphertext(const seal::Ciphertext& in, const seal::SEALContext& context, const seal::Evaluator& eval, const seal::GaloisKeys& gk, const seal::RelinKeys& rk, seal::Ciphertext& destination) const;
+	virtual void apply_ciphertext(const seal::Ciphertext& in, const seal::SEALContext& context, const seal::Evaluator& eval, const seal::GaloisKeys& gk, const seal::RelinKeys& rk, seal::Ciphertext& destination, seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool()) const;
+	virtual std::vector<uint32_t> galois_elements() const;
+};
+
+//tex:
+//Evaluates the digit extraction polynomial given as $$x^\text{norm_factor_degree} \cdot N(\text{evaluation_element} - x) + \text{correction_poly}(x)$$
+//for an arbitrary correction polynomial, which is evaluated with the Paterson-Stockmeyer algorithm.
+//The powers of $x$ are computed only once, at minimal depth, and are shared between the correction polynomial and
+//the factor $x^\text{norm_factor_degree}$; hence, terms like $x^{2^\text{log2_exponent}}$ should just be included in the correction polynomial.
+class PatersonStockmeyerPolyEvaluator : public PolyEvaluator {
+
+	const SlotRing& slot_ring;
+	poly evaluation_element;
+	size_t norm_factor_degree;
+	SlotwiseNorm norm_op;
+	poly correction_poly;
+	size_t baby_step_count;
+
+public:
+	PatersonStockmeyerPolyEvaluator(const SlotRing& slot_ring, poly evaluation_element, size_t log2_exponent, size_t norm_factor_degree, poly correction_poly);
+	virtual ~PatersonStockmeyerPolyEvaluator() = default;
+
+	virtual poly operator()(const poly& x) const;
+	virtual void apply_ciphertext(const seal::Ciphertext& in, const seal::SEALContext& context, const seal::Evaluator& eval, const seal::GaloisKeys& gk, const seal::RelinKeys& rk, seal::Ciphertext& destination, seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool()) const;
 	virtual std::vector<uint32_t> galois_elements() const;
 };
 
@@ -181,7 +222,13 @@ class BootstrappingKey {
 	seal::GaloisKeys gk;
 	seal::RelinKeys rk;
 
+	// copies of the required keys for each context of the context chain except the target context,
+	// built once by Bootstrapper::create_context_keys() and reused by every bootstrapping operation
+	std::vector<seal::GaloisKeys> context_gk;
+	std::vector<seal::RelinKeys> context_rk;
+
 	bool is_valid_for(const seal::SEALContext& context) const;
+	void load(const seal::SEALContext& context, std::istream& stream, const std::function<bool(uint32_t)>& is_required);
 
 public:
 	BootstrappingKey() = default;
@@ -192,6 +239,37 @@ public:
 	const seal::GaloisKeys& galois_keys() const;
 	const seal::RelinKeys& relin_keys() const;
 
+	/**
+	 * Returns the galois keys for the context with the given index in the context chain. Note that
+	 * except for the target context, these only contain the keys that are used in this context.
+	*/
+	const seal::GaloisKeys& galois_keys(size_t context_index) const;
+
+	/**
+	 * Returns the relinearization keys for the context with the given index in the context chain.
+	*/
+	const seal::RelinKeys& relin_keys(size_t context_index) const;
+
+	/**
+	 * Writes the key to the stream, with the galois keys stored one galois element at a time, so that
+	 * no serialized copy of all galois keys is ever held in memory. The copies for the non-target contexts
+	 * of the context chain are not stored, as they can be recreated by Bootstrapper::create_context_keys().
+	*/
+	void save(std::ostream& stream, seal::compr_mode_type compr_mode = seal::Serialization::compr_mode_default) const;
+
+	/**
+	 * Loads a key stored by save(); The context must be the target context of the bootstrapper's context chain.
+	 * Afterwards, Bootstrapper::create_context_keys() must be called before using the key,
+	 * see also Bootstrapper::load_bootstrapping_key().
+	*/
+	void load(const seal::SEALContext& context, std::istream& stream);
+
+	/**
+	 * Same as load(), but only loads the galois keys for the given galois elements; Keys for
+	 * the other stored elements are skipped without parsing them.
+	*/
+	void load(const seal::SEALContext& context, std::istream& stream, const std::vector<uint32_t>& galois_elements);
+
 	friend Bootstrapper;
 };
 
@@ -205,10 +283,22 @@ std::unique_ptr<PolyEvaluator> p_127_test_parameters_digit_extractor(const SlotR
 */
 std::unique_ptr<PolyEvaluator> p_257_test_parameters_digit_extractor(const SlotRing& slot_ring);
 
+/**
+ * The same polynomials as p_127_test_parameters_digit_extractor() and p_257_test_parameters_digit_extractor(),
+ * but evaluated by a PatersonStockmeyerPolyEvaluator
+*/
+std::unique_ptr<PolyEvaluator> p_127_test_parameters_paterson_stockmeyer_digit_extractor(const SlotRing& slot_ring);
+std::unique_ptr<PolyEvaluator> p_257_test_parameters_paterson_stockmeyer_digit_extractor(const SlotRing& slot_ring);
+
+void test_slotwise_norm();
 void test_galois_poly_evaluator();
+void test_paterson_stockmeyer_poly_evaluator();
 void test_homomorphic_noisy_decrypt();
 void test_slotwise_digit_extract();
 void test_coeffs_to_slots();
+void test_bootstrap_batch();
+void test_bootstrap_active_slots();
+void test_save_load_bootstrapping_key();
 
 class Bootstrapper {
 
@@ -222,11 +312,33 @@ public:
 	std::unique_ptr<SlotwiseTrace> trace_op;
 	std::unique_ptr<CompiledSubringLinearTransform> slots_to_coefficients = nullptr;
 	std::unique_ptr<CompiledSubringLinearTransform> coefficients_to_slots = nullptr;
+	std::shared_ptr<ThreadPool> thread_pool = nullptr;
+	std::string transform_cache_directory;
+	std::shared_ptr<BootstrapStats> stats = nullptr;
+	size_t galois_key_budget = 0;
+	// planned once for the current configuration, since the planner is quadratic in the number of elements
+	std::unique_ptr<GaloisKeyPlan> key_plan;
+	int digit_extract_step_modulus_bits = 0;
+	size_t active_slot_count = 0;
+	bool use_thread_local_pools = false;
 
 	size_t poly_modulus_degree() const noexcept;
+	// the pool that a bootstrapping stage called on the current thread with the given pool should use
+	seal::MemoryPoolHandle stage_pool(seal::MemoryPoolHandle pool) const;
+	// the galois elements used by one run of the given stage, where each element occurs as often as it is used
+	std::vector<uint32_t> galois_element_uses(BootstrapStage stage) const;
+	// replaces key_plan by a plan for the current transforms and the given budget, and then sets the budget
+	void update_galois_key_plan(size_t budget_bytes);
+	std::vector<uint32_t> galois_key_elements(BootstrapStage stage) const;
 	const seal::Evaluator& bootstrapping_evaluator() const;
 	const seal::SEALContext& bootstrapping_context() const;
 
+	void homomorphic_noisy_decrypt_unchecked(const seal::Ciphertext& ciphertext, const BootstrappingKey& bk, seal::Ciphertext& destination, seal::MemoryPoolHandle pool) const;
+	void bootstrap_unchecked(const seal::Ciphertext& ciphertext, const BootstrappingKey& bk, seal::Ciphertext& destination, seal::MemoryPoolHandle pool DEBUG_PARAMS) const;
+
+	// writes the keys for the given elements into gk, distributed over the thread pool
+	void create_galois_keys(const seal::SecretKey& bootstrapping_sk, const std::vector<uint32_t>& galois_elements, seal::GaloisKeys& gk, const std::function<void(uint32_t)>& on_key_created) const;
+
 public:
 
 	/**
@@ -256,6 +368,21 @@ public:
 	*/
 	void coeffs_to_slots(const seal::Ciphertext& ciphertext, const BootstrappingKey& bk, seal::Ciphertext& destination, seal::MemoryPoolHandle pool DEBUG_PARAMS) const;
 
+	/**
+	 * Performs the whole bootstrapping procedure, i.e. slots_to_coeffs(), homomorphic_noisy_decrypt(),
+	 * coeffs_to_slots() and slotwise_digit_extract(). The input must be a ciphertext w.r.t. the bootstrapped
+	 * context with a scalar value in each slot, and the result is a ciphertext in the same context with
+	 * the same values, but a fresh noise budget.
+	*/
+	void bootstrap(const seal::Ciphertext& ciphertext, const BootstrappingKey& bk, seal::Ciphertext& destination, seal::MemoryPoolHandle pool DEBUG_PARAMS) const;
+
+	/**
+	 * Bootstraps all the given ciphertexts, and stores the results in destinations (which is resized accordingly).
+	 * The key is validated only once, and if a thread pool is set, the ciphertexts are distributed over its threads.
+	 * The results are allocated from pool, resp. from the thread-local pools if set_use_thread_local_pools() is enabled.
+	*/
+	void bootstrap_batch(std::span<const seal::Ciphertext> ciphertexts, const BootstrappingKey& bk, std::vector<seal::Ciphertext>& destinations, seal::MemoryPoolHandle pool DEBUG_PARAMS) const;
+
 public:
 
 	Bootstrapper(const seal::SEALContext& bootstrapped_context, std::shared_ptr<const SlotRing> slot_ring, std::unique_ptr<PolyEvaluator> digit_extract_poly, MemoryPoolHandle pool = MemoryManager::GetPool());
@@ -263,8 +390,115 @@ public:
 	Bootstrapper(Bootstrapper&&) = default;
 	~Bootstrapper() = default;
 
+	/**
+	 * Compiles the linear transforms. If a transform cache directory is set, the transforms are
+	 * loaded from there if available, and stored there otherwise. Throws std::invalid_argument if the
+	 * galois key budget is too small for the galois elements of the transforms.
+	*/
 	void initialize();
+
+	/**
+	 * Lifts all plaintext coefficients of the linear transforms to the RNS base of the contexts in which they
+	 * are applied (for ciphertexts at the first level), so that bootstrapping does not have to encode them again
+	 * on every use. This trades memory for time, as it stores N * coeff_modulus_size words per nonzero coefficient.
+	 * Must be called after initialize() and before any bootstrapping operation that runs concurrently.
+	*/
+	void precompute();
+
+	/**
+	 * Sets the directory in which initialize() caches the compiled transforms; The files are identified
+	 * by the parameters of the slot ring. An empty string disables the cache.
+	*/
+	void set_transform_cache_directory(std::string directory);
+
+	/**
+	 * Sets the object into which all following bootstrapping operations record their operation counts,
+	 * timings and memory pool allocations; Passing nullptr disables recording.
+	*/
+	void set_stats(std::shared_ptr<BootstrapStats> stats);
+
+	/**
+	 * Sets the thread pool that is used to parallelize the bootstrapping operations;
+	 * Passing nullptr makes everything run on the calling thread.
+	*/
+	void set_thread_pool(std::shared_ptr<ThreadPool> thread_pool);
+
+	/**
+	 * If enabled, the bootstrapping operations ignore the memory pool passed to them, and instead allocate
+	 * all temporaries and intermediate results from thread_local_memory_pool() of the thread that computes them.
+	 * This avoids the contention on a single pool when many ciphertexts are bootstrapped in parallel, e.g. by bootstrap_batch().
+	*/
+	void set_use_thread_local_pools(bool enabled);
+
+	/**
+	 * Limits the memory (in bytes, uncompressed) of the galois keys of the target context that create_bootstrapping_key()
+	 * generates; The missing automorphisms are then composed from multiple key-switches, as planned by galois_key_plan().
+	 * 0 means that there is no limit, i.e. one key is generated per required galois element. Throws std::invalid_argument
+	 * (and keeps the previous budget) if the budget is too small; Note that initialize() adds the elements of the transforms,
+	 * so it might throw as well if the budget is set before.
+	*/
+	void set_galois_key_budget(size_t budget_bytes);
+
+	/**
+	 * Sets an (upper) estimate of the number of coefficient modulus bits that the noise of one digit extraction step consumes.
+	 * If nonzero, slotwise_digit_extract() drops RNS primes before every step, as long as the remaining modulus can still accommodate
+	 * the remaining steps of the lane, one additional step as safety margin and the plaintext modulus p^e; this makes the later steps
+	 * cheaper, but the result is at a lower level. This only has an effect if the bootstrapped context has a modulus switching chain.
+	 * 0 (the default) never drops primes.
+	*/
+	void set_digit_extract_step_modulus_bits(int bits);
+
+	/**
+	 * Restricts bootstrapping to ciphertexts that only use the first count slots, and have zeros in all other slots;
+	 * the bootstrapped ciphertext then also only contains zeros in the other slots. This makes initialize() only compile
+	 * the parts of the slots-to-coefficients and coefficients-to-slots transforms that act on the active slots, and
+	 * galois_elements() omits the giant-steps that are not required anymore. Digit extraction works on all slots in parallel,
+	 * so its cost does not change. 0 (the default) means that all slots are active.
+	 * Must be called before initialize(); Throws std::invalid_argument if count is larger than the number of slots.
+	*/
+	void set_active_slot_count(size_t count);
+
+	/**
+	 * The plan of the galois keys for all galois elements used during bootstrapping, weighted by how often they are used
+	 * in one bootstrapping, within the budget set by set_galois_key_budget(). It is updated by initialize() and set_galois_key_budget().
+	*/
+	const GaloisKeyPlan& galois_key_plan() const noexcept;
+
+	/**
+	 * Creates the bootstrapping key for the given secret key of the bootstrapped context; The galois keys
+	 * are generated in parallel on the thread pool set by set_thread_pool().
+	*/
 	void create_bootstrapping_key(const seal::SecretKey& sk, BootstrappingKey& bk, bool allow_uninitialized_for_test = false) const;
+
+	/**
+	 * Adds the galois keys that are required by the current configuration (see galois_key_plan()) but missing in bk, e.g.
+	 * after the transforms or the galois key budget have changed, or if bk was only partially loaded. The existing keys are kept.
+	 * If given, on_key_created is called (never concurrently) for each galois element as soon as its key has been created;
+	 * note that bk must not be used before this function returns. Throws std::invalid_argument if bk is not a valid key.
+	*/
+	void update_bootstrapping_key(const seal::SecretKey& sk, BootstrappingKey& bk, const std::function<void(uint32_t)>& on_key_created = nullptr) const;
+
+	/**
+	 * Returns the (sorted) galois elements of the automorphisms applied by the given stage; For BootstrapStage::bootstrap,
+	 * these are all elements used by any stage. Without a galois key budget, these are exactly the keys created by
+	 * create_bootstrapping_key(); With a budget, the created keys are galois_key_plan().key_elements() instead, and the
+	 * remaining automorphisms are composed from them. The linear transform stages only have galois elements after initialize().
+	*/
+	std::vector<uint32_t> galois_elements(BootstrapStage stage) const;
+
+	/**
+	 * Loads a key stored by BootstrappingKey::save() and creates the context keys. Only the galois keys
+	 * required by the given stage (according to galois_key_plan()) are loaded, so e.g. a server performing only digit extraction does not
+	 * have to keep the keys for the linear transforms in memory.
+	*/
+	void load_bootstrapping_key(std::istream& stream, BootstrappingKey& bk, BootstrapStage stage = BootstrapStage::bootstrap) const;
+
+	/**
+	 * Creates the copies of the key-switching keys for the non-target contexts of the context chain.
+	 * This is called by create_bootstrapping_key(), and is only required if the galois or relinearization
+	 * keys of bk have been set in another way.
+	*/
+	void create_context_keys(BootstrappingKey& bk) const;
 	void create_secret_key(const seal::SecretKey& base_sk, seal::SecretKey& destination) const;
 
 	friend void test_homomorphic_noisy_decrypt();
@@ -1,4 +1,6 @@
 #include "contextchain.h"
+#include "seal/util/polyarithsmallmod.h"
+#include "seal/util/uintarithsmallmod.h"
 #include <assert.h>
 
 using namespace seal;
@@ -29,7 +31,7 @@ ContextChain::ContextChain(const SEALContext& base_context, size_t e, MemoryPool
 	for (size_t i = 1; i < e; ++i) {
 		EncryptionParameters new_parms = parms;
 		new_parms.set_plain_modulus(exponentiate_uint(p, i + 1));
-		contexts.emplace_back(new_parms, false, sec_level);
+		contexts.emplace_back(new_parms, true, sec_level);
 		evaluators.emplace_back(std::make_unique<Evaluator, const SEALContext&>(contexts.back()));
 	}
 	assert(evaluators.size() == contexts.size());
@@ -80,6 +82,25 @@ size_t ContextChain::get_context_index(parms_id_type parm_id) const
 	throw std::invalid_argument("No matching context found");
 }
 
+parms_id_type ContextChain::get_parms_id(size_t context_index, size_t coeff_modulus_size) const
+{
+	for (auto context_data = contexts[context_index].first_context_data(); context_data != nullptr; context_data = context_data->next_context_data()) {
+		if (context_data->parms().coeff_modulus().size() == coeff_modulus_size) {
+			return context_data->parms_id();
+		}
+	}
+	throw std::invalid_argument("No level with the given coefficient modulus size in this context");
+}
+
+size_t ContextChain::min_coeff_modulus_size() const
+{
+	size_t result = 0;
+	for (const SEALContext& context : contexts) {
+		result = std::max(result, context.last_context_data()->parms().coeff_modulus().size());
+	}
+	return result;
+}
+
 const SEALContext& ContextChain::base_context() const
 {
 	return *contexts.begin();
@@ -180,6 +201,35 @@ void ContextChain::convert_ciphertext_plain(const Ciphertext& source, PtrIter<Pl
 	if (source.is_ntt_form()) {
 		throw std::invalid_argument("BFV ciphertexts cannot be in NTT form");
 	}
+	if (source.parms_id() != base_context.first_parms_id()) {
+		//tex:
+		//Lift $c$ from a lower level $q_l$ to $c' = (q/q_l) c$ at the first level $q$; Since $q/q_l$ is the product $P$ of the dropped
+		//primes, $c' \equiv P c$ modulo the remaining primes and $c' \equiv 0$ modulo the dropped ones. As $0 \leq c' < q$, the
+		//conversion below then computes $\mathrm{round}(q'/q \cdot c') = \mathrm{round}(q'/q_l \cdot c)$ exactly.
+		const SEALContext::ContextData& first_context_data = *base_context.first_context_data();
+		const std::vector<Modulus>& first_modulus = first_context_data.parms().coeff_modulus();
+		const size_t level_modulus_size = source.coeff_modulus_size();
+		const size_t coeff_count = source.poly_modulus_degree();
+		Ciphertext lifted(pool);
+		lifted.resize(base_context, base_context.first_parms_id(), 2);
+		for (size_t i = 0; i < first_modulus.size(); ++i) {
+			uint64_t dropped_product = 1;
+			for (size_t j = level_modulus_size; j < first_modulus.size(); ++j) {
+				dropped_product = multiply_uint_mod(dropped_product, barrett_reduce_64(first_modulus[j].value(), first_modulus[i]), first_modulus[i]);
+			}
+			for (size_t k = 0; k < 2; ++k) {
+				uint64_t* target = lifted.data(k) + i * coeff_count;
+				if (i < level_modulus_size) {
+					multiply_poly_scalar_coeffmod(source.data(k) + i * coeff_count, coeff_count, dropped_product, first_modulus[i], target);
+				}
+				else {
+					set_zero_uint(coeff_count, target);
+				}
+			}
+		}
+		convert_ciphertext_plain(lifted, destination, pool);
+		return;
+	}
 
 	const size_t poly_modulus_degree = this->poly_modulus_degree();
 
@@ -210,6 +260,28 @@ void ContextChain::convert_kswitchkey(const GaloisKeys& source, GaloisKeys& dest
 	}
 }
 
+void ContextChain::convert_kswitchkey(const GaloisKeys& source, GaloisKeys& destination, size_t target_index, const std::vector<uint32_t>& galois_elements) const
+{
+	size_t source_index = get_context_index(source.parms_id());
+	if (!is_metadata_valid_for(source, get_context(source_index))) {
+		throw std::invalid_argument("Invalid galois key");
+	}
+	const parms_id_type target_parms_id = get_context(target_index).key_context_data()->parms_id();
+	destination = GaloisKeys();
+	destination.parms_id() = target_parms_id;
+	destination.data().resize(source.data().size());
+	for (uint32_t galois_elt : galois_elements) {
+		if (!source.has_key(galois_elt)) {
+			throw std::invalid_argument("Galois key not present");
+		}
+		std::vector<PublicKey>& keys = destination.data()[GaloisKeys::get_index(galois_elt)];
+		keys = source.key(galois_elt);
+		for (PublicKey& pk : keys) {
+			pk.parms_id() = target_parms_id;
+		}
+	}
+}
+
 void ContextChain::convert_kswitchkey(const RelinKeys& source, RelinKeys& destination, size_t target_index) const
 {
 	size_t source_index = get_context_index(source.parms_id());
@@ -241,15 +313,12 @@ void ContextChain::divide_exact_switch_inplace(Ciphertext& value, size_t power)
 
 	const SEALContext& target_context = contexts[context_index - power];
 
-	if (source_context.first_context_data()->parms_id() != value.parms_id()) {
-		throw std::logic_error("It is currently not supported to use modulus switching chains within ContextChain");
-	}
-	if (source_context.first_context_data()->parms().coeff_modulus().size() != target_context.first_context_data()->parms().coeff_modulus().size()) {
+	if (source_context.first_context_data()->parms().coeff_modulus() != target_context.first_context_data()->parms().coeff_modulus()) {
 		throw std::logic_error("It is currently not implemented to support different q in the context chain");
 	}
 
-	// Since we assume that the moduli are the same, we can just use the data as-is
-	value.parms_id() = target_context.first_context_data()->parms_id();
+	// Since the moduli of the levels are the same, we can just use the data as-is
+	value.parms_id() = get_parms_id(context_index - power, value.coeff_modulus_size());
 }
 
 void ContextChain::multiply_switch_inplace(Ciphertext& value, size_t power) const
@@ -266,13 +335,29 @@ void ContextChain::multiply_switch_inplace(Ciphertext& value, size_t power) cons
 
 	const SEALContext& target_context = contexts[context_index + power];
 
-	if (source_context.first_context_data()->parms_id() != value.parms_id()) {
-		throw std::logic_error("It is currently not supported to use modulus switching chains within ContextChain");
-	}
-	if (source_context.first_context_data()->parms().coeff_modulus().size() != target_context.first_context_data()->parms().coeff_modulus().size()) {
+	if (source_context.first_context_data()->parms().coeff_modulus() != target_context.first_context_data()->parms().coeff_modulus()) {
 		throw std::logic_error("It is currently not implemented to support different q in the context chain");
 	}
 
-	// Since we assume that the moduli are the same, we can just use the data as-is
-	value.parms_id() = target_context.first_context_data()->parms_id();
+	// Since the moduli of the levels are the same, we can just use the data as-is
+	value.parms_id() = get_parms_id(context_index + power, value.coeff_modulus_size());
+}
+
+void ContextChain::mod_switch_to_bits_inplace(Ciphertext& value, int min_coeff_modulus_bit_count, MemoryPoolHandle pool) const
+{
+	const size_t context_index = get_context_index(value.parms_id());
+	const SEALContext& context = contexts[context_index];
+	if (!is_metadata_valid_for(value, context)) {
+		throw std::invalid_argument("Invalid ciphertext");
+	}
+	auto target = context.get_context_data(value.parms_id());
+	for (auto next = target->next_context_data(); next != nullptr; next = next->next_context_data()) {
+		if (next->total_coeff_modulus_bit_count() < min_coeff_modulus_bit_count || next->parms().coeff_modulus().size() < min_coeff_modulus_size()) {
+			break;
+		}
+		target = next;
+	}
+	if (target->parms_id() != value.parms_id()) {
+		evaluators[context_index]->mod_switch_to_inplace(value, target->parms_id(), pool);
+	}
 }
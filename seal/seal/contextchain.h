@@ -7,6 +7,10 @@ using namespace seal;
  * Since SEAL only supports a fixed plaintext modulus per SEALContext,
  * this object manages a list of SEALContexts with plaintext moduli
  * p, p^2, ..., p^e (all of them are necessary during digit extraction)
+ *
+ * All contexts share the coefficient modulus of the base context, and each of them has the usual modulus switching
+ * chain (if the base context has one), so ciphertexts can be moved between contexts at every level for which
+ * all contexts have a matching level.
 */
 class ContextChain {
 
@@ -31,6 +35,18 @@ public:
 	size_t size() const;
 	size_t get_context_index(parms_id_type parm_id) const;
 
+	/**
+	 * Returns the parms_id of the level of the given context whose coefficient modulus consists of the
+	 * first coeff_modulus_size primes; Throws std::invalid_argument if there is no such level.
+	*/
+	parms_id_type get_parms_id(size_t context_index, size_t coeff_modulus_size) const;
+
+	/**
+	 * The smallest number of coefficient modulus primes of a level that exists in all contexts, i.e.
+	 * ciphertexts can be moved between contexts at all levels with at least this many primes.
+	*/
+	size_t min_coeff_modulus_size() const;
+
 	/**
 	 * The base context is the first context in the chain, i.e. the one with plaintext
 	 * modulus p
@@ -55,7 +71,8 @@ public:
 	void convert_sk_plain(const SecretKey& source, Plaintext& destination) const;
 
 	/**
-	 * Converts a ciphertext for the first/base context to the plaintext space of the target context
+	 * Converts a ciphertext for the first/base context to the plaintext space of the target context;
+	 * Ciphertexts below the first level of the base context are lifted to the first level first.
 	*/
 	void convert_ciphertext_plain(const Ciphertext& source, util::PtrIter<Plaintext*> destination, MemoryPoolHandle pool) const;
 
@@ -63,6 +80,12 @@ public:
 	 * Converts a key-switch key from one context to another (the source context is derived from source.parms_id())
 	*/
 	void convert_kswitchkey(const GaloisKeys& source, GaloisKeys& destination, size_t target_index) const;
+
+	/**
+	 * Converts only the keys for the given galois elements from one context to another, which saves
+	 * memory and time if only a few of the keys are required in the target context
+	*/
+	void convert_kswitchkey(const GaloisKeys& source, GaloisKeys& destination, size_t target_index, const std::vector<uint32_t>& galois_elements) const;
 	
 	
 	/**
@@ -72,12 +95,21 @@ public:
 
 	/**
 	 * Transforms a ciphertext enrypting a message m to a ciphertext of the one step lower context that encrypts m / p;
-	 * Requires that p | m
+	 * Requires that p | m. The result is at the level with the same coefficient modulus as the input.
 	 */
 	void divide_exact_switch_inplace(Ciphertext& value, size_t power = 1) const;
 	
 	/**
-	 * Transforms a ciphertext enrypting a message m to a ciphertext of the one step lower context that encrypts m * p in the next higher context
+	 * Transforms a ciphertext enrypting a message m to a ciphertext of the one step lower context that encrypts m * p in the next higher context.
+	 * The result is at the level with the same coefficient modulus as the input.
 	 */
 	void multiply_switch_inplace(Ciphertext& value, size_t power = 1) const;
+
+	/**
+	 * Switches the ciphertext (of any of the contexts) down to the lowest level of its context whose coefficient
+	 * modulus has at least the given number of bits, without going below min_coeff_modulus_size() primes.
+	 * Since BFV modulus switching approximately preserves the noise budget (as long as it exceeds the rounding noise),
+	 * this can be used to make later operations cheaper once the noise budget has been consumed.
+	*/
+	void mod_switch_to_bits_inplace(Ciphertext& value, int min_coeff_modulus_bit_count, MemoryPoolHandle pool = MemoryManager::GetPool()) const;
 }; 
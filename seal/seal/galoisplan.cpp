@@ -0,0 +1,254 @@
+#include "galoisplan.h"
+#include "hoisting.h"
+#include "stats.h"
+#include <assert.h>
+#include <iostream>
+#include <set>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+using namespace seal;
+
+GaloisKeyPlan::GaloisKeyPlan(const std::vector<uint32_t>& galois_element_uses, size_t max_key_count, size_t poly_modulus_degree)
+	: index_modulus(2 * poly_modulus_degree), total_key_switches(0)
+{
+	const Modulus mod_index(index_modulus);
+	std::map<uint32_t, size_t> uses;
+	for (uint32_t galois_elt : galois_element_uses) {
+		const uint32_t reduced = static_cast<uint32_t>(galois_elt % index_modulus);
+		if (reduced % 2 == 0) {
+			throw std::invalid_argument("Galois elements must be odd");
+		}
+		// the identity does not require a key-switch
+		if (reduced != 1) {
+			uses[reduced] += 1;
+		}
+	}
+	std::set<uint32_t> key_set;
+	for (const auto& [galois_elt, count] : uses) {
+		key_set.insert(galois_elt);
+		decompositions[galois_elt][galois_elt] = 1;
+		total_key_switches += count;
+	}
+
+	while (key_set.size() > max_key_count) {
+		// removing a key replaces each of its uses by two key-switches
+		size_t best_cost = std::numeric_limits<size_t>::max();
+		uint32_t best_elt = 0;
+		uint32_t best_factors[2] = { 0, 0 };
+		for (uint32_t galois_elt : key_set) {
+			size_t cost = 0;
+			for (const auto& [required_elt, decomposition] : decompositions) {
+				const auto it = decomposition.find(galois_elt);
+				if (it != decomposition.end()) {
+					cost += uses[required_elt] * it->second;
+				}
+			}
+			if (cost >= best_cost) {
+				continue;
+			}
+			for (uint32_t factor : key_set) {
+				uint64_t factor_inv;
+				if (factor == galois_elt || !util::try_invert_uint_mod(factor, mod_index, factor_inv)) {
+					continue;
+				}
+				const uint32_t cofactor = static_cast<uint32_t>(util::multiply_uint_mod(galois_elt, factor_inv, mod_index));
+				if (cofactor != galois_elt && key_set.contains(cofactor)) {
+					best_cost = cost;
+					best_elt = galois_elt;
+					best_factors[0] = factor;
+					best_factors[1] = cofactor;
+					break;
+				}
+			}
+		}
+		if (best_cost == std::numeric_limits<size_t>::max()) {
+			throw std::invalid_argument("Required galois elements cannot be generated by the given number of keys");
+		}
+		key_set.erase(best_elt);
+		for (auto& [required_elt, decomposition] : decompositions) {
+			const auto it = decomposition.find(best_elt);
+			if (it != decomposition.end()) {
+				const size_t count = it->second;
+				decomposition.erase(it);
+				decomposition[best_factors[0]] += count;
+				decomposition[best_factors[1]] += count;
+			}
+		}
+		total_key_switches += best_cost;
+	}
+	keys.assign(key_set.begin(), key_set.end());
+}
+
+std::vector<uint32_t> GaloisKeyPlan::decomposition(uint32_t galois_elt) const
+{
+	const uint32_t reduced = static_cast<uint32_t>(galois_elt % index_modulus);
+	if (reduced == 1) {
+		return {};
+	}
+	const auto it = decompositions.find(reduced);
+	if (it == decompositions.end()) {
+		throw std::invalid_argument("Galois element was not part of the plan");
+	}
+	std::vector<uint32_t> result;
+	for (const auto& [key_elt, count] : it->second) {
+		result.insert(result.end(), count, key_elt);
+	}
+	return result;
+}
+
+size_t GaloisKeyPlan::key_byte_count(const SEALContext& context)
+{
+	const EncryptionParameters& key_parms = context.key_context_data()->parms();
+	const size_t key_modulus_size = key_parms.coeff_modulus().size();
+	// one public key per decomposition modulus, each with two polynomials over the key modulus
+	return (key_modulus_size - 1) * 2 * key_modulus_size * key_parms.poly_modulus_degree() * sizeof(uint64_t);
+}
+
+std::vector<uint32_t> galois_key_decomposition(const GaloisKeys& gk, uint32_t galois_elt, size_t poly_modulus_degree)
+{
+	const uint64_t index_modulus = 2 * poly_modulus_degree;
+	galois_elt = static_cast<uint32_t>(galois_elt % index_modulus);
+	if (galois_elt == 1) {
+		return {};
+	}
+	if (gk.has_key(galois_elt)) {
+		return { galois_elt };
+	}
+	std::vector<uint32_t> present;
+	for (size_t i = 0; i < gk.data().size(); ++i) {
+		if (gk.data()[i].size() > 0) {
+			present.push_back(static_cast<uint32_t>(2 * i + 1));
+		}
+	}
+
+	// breadth-first search in the Cayley graph of the group generated by the present keys
+	std::vector<uint32_t> parent(index_modulus, 0);
+	std::vector<uint32_t> current_level = { 1 };
+	parent[1] = 1;
+	while (parent[galois_elt] == 0 && current_level.size() > 0) {
+		std::vector<uint32_t> next_level;
+		for (uint32_t x : current_level) {
+			for (uint32_t key_elt : present) {
+				const uint32_t y = static_cast<uint32_t>((static_cast<uint64_t>(x) * key_elt) % index_modulus);
+				if (parent[y] == 0) {
+					parent[y] = x;
+					next_level.push_back(y);
+				}
+			}
+		}
+		current_level = std::move(next_level);
+	}
+	if (parent[galois_elt] == 0) {
+		throw std::invalid_argument("Galois key not present and cannot be composed from present keys");
+	}
+	const Modulus mod_index(index_modulus);
+	std::vector<uint32_t> result;
+	for (uint32_t x = galois_elt; x != 1; x = parent[x]) {
+		uint64_t parent_inv;
+		util::try_invert_uint_mod(parent[x], mod_index, parent_inv);
+		result.push_back(static_cast<uint32_t>(util::multiply_uint_mod(x, parent_inv, mod_index)));
+	}
+
+	return result;
+}
+
+void apply_galois_composed(const Evaluator& eval, const Ciphertext& in, uint32_t galois_elt, const GaloisKeys& gk, Ciphertext& destination, MemoryPoolHandle pool)
+{
+	const std::vector<uint32_t> decomposition = galois_key_decomposition(gk, galois_elt, in.poly_modulus_degree());
+	if (decomposition.size() == 0) {
+		destination = in;
+		return;
+	}
+	eval.apply_galois(in, decomposition[0], gk, destination, pool);
+	for (size_t i = 1; i < decomposition.size(); ++i) {
+		// callers only record one key-switch per automorphism
+		eval.apply_galois_inplace(destination, decomposition[i], gk, pool); log_galois();
+	}
+}
+
+void apply_galois_composed_inplace(const Evaluator& eval, Ciphertext& x, uint32_t galois_elt, const GaloisKeys& gk, MemoryPoolHandle pool)
+{
+	const std::vector<uint32_t> decomposition = galois_key_decomposition(gk, galois_elt, x.poly_modulus_degree());
+	for (size_t i = 0; i < decomposition.size(); ++i) {
+		eval.apply_galois_inplace(x, decomposition[i], gk, pool);
+		if (i > 0) {
+			log_galois();
+		}
+	}
+}
+
+void test_galois_key_plan()
+{
+	{
+		const std::vector<uint32_t> uses = { 3, 9, 27, 3, 81, 1 };
+		GaloisKeyPlan plan(uses, 2, 4096);
+		assert(plan.key_elements().size() <= 2);
+		for (uint32_t galois_elt : uses) {
+			uint64_t product = 1;
+			for (uint32_t key_elt : plan.decomposition(galois_elt)) {
+				assert(std::find(plan.key_elements().begin(), plan.key_elements().end(), key_elt) != plan.key_elements().end());
+				product = (product * key_elt) % 8192;
+			}
+			assert(product == galois_elt);
+		}
+		assert(plan.key_switch_count() > 5);
+
+		GaloisKeyPlan unbounded(uses, uses.size(), 4096);
+		assert(unbounded.key_elements() == std::vector<uint32_t>({ 3, 9, 27, 81 }));
+		assert(unbounded.key_switch_count() == 5);
+
+		bool has_thrown = false;
+		try {
+			GaloisKeyPlan infeasible({ 3, 5 }, 1, 4096);
+		}
+		catch (const std::invalid_argument&) {
+			has_thrown = true;
+		}
+		assert(has_thrown);
+	}
+	{
+		EncryptionParameters parms(scheme_type::bfv);
+		parms.set_poly_modulus_degree(4096);
+		parms.set_coeff_modulus(CoeffModulus::Create(4096, { 40, 40, 40 }));
+		parms.set_plain_modulus(257);
+		SEALContext context(parms, false, sec_level_type::none);
+
+		KeyGenerator keygen(context);
+		SecretKey sk = keygen.secret_key();
+		PublicKey pk;
+		keygen.create_public_key(pk);
+		GaloisKeys gk;
+		keygen.create_galois_keys(std::vector<uint32_t>{ 3 }, gk);
+		GaloisKeys full_gk;
+		keygen.create_galois_keys(std::vector<uint32_t>{ 27 }, full_gk);
+
+		Encryptor encryptor(context, pk);
+		Evaluator evaluator(context);
+		Decryptor decryptor(context, sk);
+
+		assert(galois_key_decomposition(gk, 27, 4096) == std::vector<uint32_t>({ 3, 3, 3 }));
+
+		std::vector<uint64_t> data = { 1, 2, 0, 4, 5, 0, 0, 256 };
+		Ciphertext x_enc;
+		encryptor.encrypt(Plaintext{ gsl::span<const uint64_t>(data) }, x_enc);
+
+		Ciphertext expected_enc;
+		evaluator.apply_galois(x_enc, 27, full_gk, expected_enc);
+		Plaintext expected;
+		decryptor.decrypt(expected_enc, expected);
+
+		Ciphertext result_enc;
+		apply_galois_composed(evaluator, x_enc, 27, gk, result_enc);
+		Plaintext result;
+		decryptor.decrypt(result_enc, result);
+		assert(result == expected);
+
+		HoistedCiphertext hoisted(x_enc, context);
+		hoisted.apply_galois(27, gk, result_enc);
+		decryptor.decrypt(result_enc, result);
+		assert(result == expected);
+	}
+	std::cout << "test_galois_key_plan(): success" << std::endl;
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include "seal/seal.h"
+#include <vector>
+#include <map>
+
+//tex:
+//Chooses the Galois elements for which key-switching keys are generated, under a bound on the number of keys.
+//
+//Since the Galois group is abelian, an automorphism $\sigma_g$ without key can be computed as
+//$\sigma_{g_1} \circ ... \circ \sigma_{g_k}$ whenever $g = g_1 ... g_k$ and all $g_i$ have keys, at the cost of
+//$k$ key-switches instead of one. Starting with one key per required element, the planner repeatedly removes the key
+//whose removal causes the fewest additional key-switches (weighted by how often each element is used),
+//where a removed element must be the product of two remaining ones.
+class GaloisKeyPlan {
+
+	uint64_t index_modulus;
+	std::vector<uint32_t> keys;
+	// for every required element, how often each key occurs in its decomposition
+	std::map<uint32_t, std::map<uint32_t, size_t>> decompositions;
+	size_t total_key_switches;
+
+public:
+	/**
+	 * Plans the keys for the given required galois elements, where an element that appears multiple times
+	 * is considered to be used that often. Throws std::invalid_argument if the required elements cannot
+	 * be generated by max_key_count keys in the way described above.
+	*/
+	GaloisKeyPlan(const std::vector<uint32_t>& galois_element_uses, size_t max_key_count, size_t poly_modulus_degree);
+	GaloisKeyPlan(const GaloisKeyPlan&) = default;
+	GaloisKeyPlan(GaloisKeyPlan&&) = default;
+	~GaloisKeyPlan() = default;
+
+	/**
+	 * The sorted galois elements for which keys should be generated.
+	*/
+	const std::vector<uint32_t>& key_elements() const noexcept;
+
+	/**
+	 * Returns the key elements whose product is the given required galois element, with multiplicity.
+	*/
+	std::vector<uint32_t> decomposition(uint32_t galois_elt) const;
+
+	/**
+	 * The number of key-switches required for all uses of the required elements.
+	*/
+	size_t key_switch_count() const noexcept;
+
+	/**
+	 * The size in bytes of one (uncompressed) galois key of the given context.
+	*/
+	static size_t key_byte_count(const seal::SEALContext& context);
+};
+
+/**
+ * Returns galois elements with keys in gk whose product is galois_elt, i.e. whose automorphisms compose to the
+ * automorphism of galois_elt. The decomposition is as short as possible, and only contains galois_elt itself
+ * if its key is present. Throws std::invalid_argument if there is no such decomposition.
+*/
+std::vector<uint32_t> galois_key_decomposition(const seal::GaloisKeys& gk, uint32_t galois_elt, size_t poly_modulus_degree);
+
+/**
+ * Same as seal::Evaluator::apply_galois(), but if gk does not contain the key for galois_elt, the automorphism
+ * is computed as composition of automorphisms with present keys, see galois_key_decomposition().
+ * All temporary memory is allocated from pool.
+*/
+void apply_galois_composed(const seal::Evaluator& eval, const seal::Ciphertext& in, uint32_t galois_elt, const seal::GaloisKeys& gk, seal::Ciphertext& destination, seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool());
+void apply_galois_composed_inplace(const seal::Evaluator& eval, seal::Ciphertext& x, uint32_t galois_elt, const seal::GaloisKeys& gk, seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool());
+
+void test_galois_key_plan();
+
+inline const std::vector<uint32_t>& GaloisKeyPlan::key_elements() const noexcept
+{
+	return keys;
+}
+
+inline size_t GaloisKeyPlan::key_switch_count() const noexcept
+{
+	return total_key_switches;
+}
@@ -0,0 +1,205 @@
+#include "hoisting.h"
+#include "galoisplan.h"
+#include "stats.h"
+#include <assert.h>
+#include <iostream>
+#include "seal/util/polyarithsmallmod.h"
+#include "seal/util/uintarithsmallmod.h"
+
+using namespace seal;
+using namespace seal::util;
+
+HoistedCiphertext::HoistedCiphertext(const Ciphertext& in, const SEALContext& context, MemoryPoolHandle pool)
+	: context(context), pool(pool), evaluator(std::make_unique<const Evaluator>(context)), base(in, pool), decomp_modulus_size(0)
+{
+	if (!is_metadata_valid_for(in, context) || !is_buffer_valid(in)) {
+		throw std::invalid_argument("Invalid ciphertext");
+	}
+	if (in.size() != 2) {
+		throw std::invalid_argument("Can only hoist size 2 ciphertexts");
+	}
+	if (in.is_ntt_form()) {
+		throw std::invalid_argument("BFV ciphertexts cannot be in NTT form");
+	}
+	if (!context.using_keyswitching()) {
+		throw std::logic_error("Key-switching is not supported by the context");
+	}
+
+	const SEALContext::ContextData& context_data = *context.get_context_data(in.parms_id());
+	const SEALContext::ContextData& key_context_data = *context.key_context_data();
+	const std::vector<Modulus>& key_modulus = key_context_data.parms().coeff_modulus();
+	const NTTTables* key_ntt_tables = key_context_data.small_ntt_tables();
+	const size_t coeff_count = context_data.parms().poly_modulus_degree();
+
+	decomp_modulus_size = context_data.parms().coeff_modulus().size();
+	const size_t rns_modulus_size = decomp_modulus_size + 1;
+	digits = allocate_poly_array(decomp_modulus_size, coeff_count, rns_modulus_size, pool);
+
+	ConstRNSIter c1(in.data(1), coeff_count);
+	for (size_t j = 0; j < decomp_modulus_size; ++j) {
+		RNSIter current(digits.get() + j * rns_modulus_size * coeff_count, coeff_count);
+		for (size_t i = 0; i < rns_modulus_size; ++i) {
+			// the last component belongs to the special modulus
+			const size_t key_index = (i == decomp_modulus_size ? key_modulus.size() - 1 : i);
+			if (key_modulus[j] <= key_modulus[key_index]) {
+				set_uint(c1[j], coeff_count, current[i]);
+			}
+			else {
+				modulo_poly_coeffs(c1[j], coeff_count, key_modulus[key_index], current[i]);
+			}
+			ntt_negacyclic_harvey(current[i], key_ntt_tables[key_index]);
+		}
+	}
+}
+
+ConstRNSIter HoistedCiphertext::digit(size_t decomp_index) const
+{
+	const size_t coeff_count = base.poly_modulus_degree();
+	return ConstRNSIter(digits.get() + decomp_index * (decomp_modulus_size + 1) * coeff_count, coeff_count);
+}
+
+void HoistedCiphertext::apply_galois(uint32_t galois_elt, const GaloisKeys& gk, Ciphertext& destination) const
+{
+	if (gk.parms_id() != context.key_parms_id()) {
+		throw std::invalid_argument("Galois keys are not valid for the context of the hoisted ciphertext");
+	}
+	if (!gk.has_key(galois_elt)) {
+		// compose the automorphism, where only the first key-switch can use the hoisted decomposition
+		const std::vector<uint32_t> decomposition = galois_key_decomposition(gk, galois_elt, base.poly_modulus_degree());
+		if (decomposition.size() == 0) {
+			destination = base;
+			return;
+		}
+		apply_galois(decomposition[0], gk, destination);
+		for (size_t i = 1; i < decomposition.size(); ++i) {
+			evaluator->apply_galois_inplace(destination, decomposition[i], gk, pool); log_galois();
+		}
+		return;
+	}
+	const std::vector<PublicKey>& key_vector = gk.key(galois_elt);
+	// as in SEAL, a ciphertext below the first level only uses the keys for its remaining primes
+	if (key_vector.size() < decomp_modulus_size) {
+		throw std::invalid_argument("Galois key does not match the decomposition of the hoisted ciphertext");
+	}
+
+	const SEALContext::ContextData& context_data = *context.get_context_data(base.parms_id());
+	const SEALContext::ContextData& key_context_data = *context.key_context_data();
+	const std::vector<Modulus>& coeff_modulus = context_data.parms().coeff_modulus();
+	const std::vector<Modulus>& key_modulus = key_context_data.parms().coeff_modulus();
+	const size_t key_modulus_size = key_modulus.size();
+	const NTTTables* key_ntt_tables = key_context_data.small_ntt_tables();
+	const GaloisTool& galois_tool = *context_data.galois_tool();
+	ConstMultiplyUIntModOperandIter modswitch_factors = key_context_data.rns_tool()->inv_q_last_mod_q();
+	const size_t coeff_count = context_data.parms().poly_modulus_degree();
+	const size_t rns_modulus_size = decomp_modulus_size + 1;
+
+	// accumulate sum_j sigma(digit_j) * key_j for both key components, in NTT form
+	auto product(allocate_zero_poly_array(2, coeff_count, rns_modulus_size, pool));
+	SEAL_ALLOCATE_GET_COEFF_ITER(permuted, coeff_count, pool);
+	SEAL_ALLOCATE_GET_COEFF_ITER(term, coeff_count, pool);
+	for (size_t j = 0; j < decomp_modulus_size; ++j) {
+		const Ciphertext& key = key_vector[j].data();
+		ConstRNSIter current = digit(j);
+		for (size_t i = 0; i < rns_modulus_size; ++i) {
+			const size_t key_index = (i == decomp_modulus_size ? key_modulus_size - 1 : i);
+			const Modulus& modulus = key_modulus[key_index];
+			galois_tool.apply_galois_ntt(current[i], galois_elt, permuted);
+			for (size_t k = 0; k < 2; ++k) {
+				CoeffIter accumulator(product.get() + (k * rns_modulus_size + i) * coeff_count);
+				dyadic_product_coeffmod(permuted, ConstCoeffIter(key.data(k) + key_index * coeff_count), coeff_count, modulus, term);
+				add_poly_coeffmod(accumulator, term, coeff_count, modulus, accumulator);
+			}
+		}
+	}
+
+	// the result is (sigma(c0), 0) + round(product / q_special)
+	destination.resize(context, base.parms_id(), 2);
+	destination.is_ntt_form() = false;
+	galois_tool.apply_galois(
+		ConstRNSIter(base.data(0), coeff_count),
+		decomp_modulus_size,
+		galois_elt,
+		iter(coeff_modulus),
+		RNSIter(destination.data(0), coeff_count)
+	);
+	set_zero_poly(coeff_count, decomp_modulus_size, destination.data(1));
+
+	const Modulus& special_modulus = key_modulus[key_modulus_size - 1];
+	const uint64_t qk = special_modulus.value();
+	const uint64_t qk_half = qk >> 1;
+	for (size_t k = 0; k < 2; ++k) {
+		RNSIter component(product.get() + k * rns_modulus_size * coeff_count, coeff_count);
+		RNSIter target(destination.data(k), coeff_count);
+		CoeffIter last = component[decomp_modulus_size];
+		inverse_ntt_negacyclic_harvey(last, key_ntt_tables[key_modulus_size - 1]);
+
+		// add q_special / 2 to perform rounding instead of flooring
+		for (size_t l = 0; l < coeff_count; ++l) {
+			last[l] = barrett_reduce_64(last[l] + qk_half, special_modulus);
+		}
+		for (size_t j = 0; j < decomp_modulus_size; ++j) {
+			const Modulus& modulus = key_modulus[j];
+			if (qk > modulus.value()) {
+				modulo_poly_coeffs(last, coeff_count, modulus, term);
+			}
+			else {
+				set_uint(last, coeff_count, term);
+			}
+			const uint64_t fix = barrett_reduce_64(qk_half, modulus);
+			for (size_t l = 0; l < coeff_count; ++l) {
+				term[l] = sub_uint_mod(term[l], fix, modulus);
+			}
+			inverse_ntt_negacyclic_harvey(component[j], key_ntt_tables[j]);
+			sub_poly_coeffmod(component[j], term, coeff_count, modulus, component[j]);
+			multiply_poly_scalar_coeffmod(component[j], coeff_count, modswitch_factors[j], modulus, component[j]);
+			add_poly_coeffmod(target[j], component[j], coeff_count, modulus, target[j]);
+		}
+	}
+}
+
+void test_hoisted_apply_galois()
+{
+	EncryptionParameters parms(scheme_type::bfv);
+	parms.set_poly_modulus_degree(4096);
+	parms.set_coeff_modulus(CoeffModulus::Create(4096, { 40, 40, 40, 40 }));
+	parms.set_plain_modulus(257);
+	SEALContext context(parms, true, sec_level_type::none);
+
+	KeyGenerator keygen(context);
+	SecretKey sk = keygen.secret_key();
+	PublicKey pk;
+	keygen.create_public_key(pk);
+	const std::vector<uint32_t> galois_elements = { 3, 9, 8191 };
+	GaloisKeys gk;
+	keygen.create_galois_keys(galois_elements, gk);
+
+	Encryptor encryptor(context, pk);
+	Evaluator evaluator(context);
+	Decryptor decryptor(context, sk);
+
+	std::vector<uint64_t> data = { 1, 2, 0, 4, 5, 0, 0, 256 };
+	Plaintext x_plain{ gsl::span<const uint64_t>(data) };
+	Ciphertext x_enc;
+	encryptor.encrypt(x_plain, x_enc);
+
+	// below the first level, only a prefix of the key vector is used
+	for (size_t level = 0; level < 2; ++level) {
+		HoistedCiphertext hoisted(x_enc, context);
+		for (uint32_t galois_elt : galois_elements) {
+			Ciphertext expected_enc;
+			evaluator.apply_galois(x_enc, galois_elt, gk, expected_enc);
+			Ciphertext result_enc;
+			hoisted.apply_galois(galois_elt, gk, result_enc);
+			assert(result_enc.parms_id() == x_enc.parms_id());
+
+			Plaintext expected;
+			decryptor.decrypt(expected_enc, expected);
+			Plaintext result;
+			decryptor.decrypt(result_enc, result);
+			assert(result == expected);
+			assert(decryptor.invariant_noise_budget(result_enc) > 0);
+		}
+		evaluator.mod_switch_to_next_inplace(x_enc);
+	}
+	std::cout << "test_hoisted_apply_galois(): success" << std::endl;
+}
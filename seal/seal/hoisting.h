@@ -0,0 +1,53 @@
+#pragma once
+#include "seal/seal.h"
+#include <memory>
+
+//tex:
+//Stores the key-switching decomposition of a BFV ciphertext $(c_0, c_1)$, so that many
+//Galois automorphisms can be applied to it while decomposing $c_1$ only once.
+//
+//Key-switching w.r.t. $\sigma$ requires the RNS digits $[\sigma(c_1)]_{q_j}$, lifted to all key moduli
+//and transformed to NTT form. Since $\sigma$ commutes with taking residues and the NTT-domain automorphism
+//is just a permutation, we can instead compute $[c_1]_{q_j}$ in NTT form once and then permute it for every $\sigma$.
+//Note that $\sigma$ of the lifted digit is a valid digit of $\sigma(c_1)$ of the same size, so the
+//noise growth is the same as for a standard key-switch.
+class HoistedCiphertext {
+
+	const seal::SEALContext& context;
+	seal::MemoryPoolHandle pool;
+	// used for the key-switches of composed automorphisms that cannot use the decomposition
+	std::unique_ptr<const seal::Evaluator> evaluator;
+	seal::Ciphertext base;
+	size_t decomp_modulus_size;
+
+	//tex:
+	//The values $[c_1]_{q_j} \mod q_i$ in NTT form, where $q_j$ runs through the ciphertext moduli
+	//and $q_i$ runs through the ciphertext moduli and the special modulus;
+	//Stored as decomp_modulus_size polynomials with decomp_modulus_size + 1 RNS components each.
+	seal::util::Pointer<uint64_t> digits;
+
+	seal::util::ConstRNSIter digit(size_t decomp_index) const;
+
+public:
+	HoistedCiphertext(const seal::Ciphertext& in, const seal::SEALContext& context, seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool());
+	HoistedCiphertext(const HoistedCiphertext&) = delete;
+	HoistedCiphertext(HoistedCiphertext&&) = default;
+	~HoistedCiphertext() = default;
+
+	/**
+	 * Computes the same as seal::Evaluator::apply_galois() on the hoisted ciphertext, but reuses the
+	 * decomposition computed during construction. If gk does not contain the key for galois_elt, the
+	 * automorphism is composed from present keys as in apply_galois_composed(). All temporaries are
+	 * allocated from the pool given during construction.
+	*/
+	void apply_galois(uint32_t galois_elt, const seal::GaloisKeys& gk, seal::Ciphertext& destination) const;
+
+	const seal::Ciphertext& ciphertext() const noexcept;
+};
+
+void test_hoisted_apply_galois();
+
+inline const seal::Ciphertext& HoistedCiphertext::ciphertext() const noexcept
+{
+	return base;
+}
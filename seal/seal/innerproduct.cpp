@@ -0,0 +1,217 @@
+#include "innerproduct.h"
+#include <assert.h>
+#include <iostream>
+#include "seal/util/polyarithsmallmod.h"
+#include "seal/util/uintarithsmallmod.h"
+#include "seal/util/ntt.h"
+
+using namespace seal;
+using namespace seal::util;
+
+LiftedPlaintext::LiftedPlaintext(const Plaintext& plain, const SEALContext& context, parms_id_type parms_id)
+	: parms_id_(parms_id)
+{
+	const auto context_data_ptr = context.get_context_data(parms_id);
+	if (!context_data_ptr) {
+		throw std::invalid_argument("parms_id is not valid for the context");
+	}
+	if (plain.is_ntt_form()) {
+		throw std::invalid_argument("Plaintext must not be in NTT form");
+	}
+	const SEALContext::ContextData& context_data = *context_data_ptr;
+	if (!context_data.qualifiers().using_fast_plain_lift) {
+		throw std::logic_error("Only plain moduli smaller than all coefficient moduli are supported");
+	}
+	const std::vector<Modulus>& coeff_modulus = context_data.parms().coeff_modulus();
+	const NTTTables* ntt_tables = context_data.small_ntt_tables();
+	const uint64_t plain_modulus = context_data.parms().plain_modulus().value();
+	const uint64_t plain_upper_half_threshold = context_data.plain_upper_half_threshold();
+	const uint64_t* plain_upper_half_increment = context_data.plain_upper_half_increment();
+	coeff_count = context_data.parms().poly_modulus_degree();
+	coeff_modulus_size = coeff_modulus.size();
+	if (plain.coeff_count() > coeff_count) {
+		throw std::invalid_argument("Plaintext has too many coefficients");
+	}
+
+	values.resize(coeff_count * coeff_modulus_size);
+	for (size_t i = 0; i < coeff_modulus_size; ++i) {
+		uint64_t* target = values.data() + i * coeff_count;
+		for (size_t k = 0; k < plain.coeff_count(); ++k) {
+			if (plain[k] >= plain_modulus) {
+				throw std::invalid_argument("Plaintext coefficients must be reduced");
+			}
+			// with fast plain lift, plain_upper_half_increment[i] is q_i - t, as in seal::Evaluator::multiply_plain()
+			target[k] = plain[k] >= plain_upper_half_threshold ? plain[k] + plain_upper_half_increment[i] : plain[k];
+		}
+		ntt_negacyclic_harvey(CoeffIter(target), ntt_tables[i]);
+	}
+}
+
+const parms_id_type& LiftedPlaintext::parms_id() const noexcept
+{
+	return parms_id_;
+}
+
+const uint64_t* LiftedPlaintext::data(size_t rns_index) const
+{
+	assert(rns_index < coeff_modulus_size);
+	return values.data() + rns_index * coeff_count;
+}
+
+void transform_to_ntt_inplace(Ciphertext& ciphertext, const SEALContext& context)
+{
+	if (!is_metadata_valid_for(ciphertext, context)) {
+		throw std::invalid_argument("Invalid ciphertext");
+	}
+	if (ciphertext.is_ntt_form()) {
+		throw std::invalid_argument("Ciphertext is already in NTT form");
+	}
+	const SEALContext::ContextData& context_data = *context.get_context_data(ciphertext.parms_id());
+	const NTTTables* ntt_tables = context_data.small_ntt_tables();
+	const size_t coeff_count = ciphertext.poly_modulus_degree();
+	const size_t coeff_modulus_size = ciphertext.coeff_modulus_size();
+	for (size_t k = 0; k < ciphertext.size(); ++k) {
+		for (size_t i = 0; i < coeff_modulus_size; ++i) {
+			ntt_negacyclic_harvey(CoeffIter(ciphertext.data(k) + i * coeff_count), ntt_tables[i]);
+		}
+	}
+	ciphertext.is_ntt_form() = true;
+}
+
+PlainInnerProduct::PlainInnerProduct(const SEALContext& context, parms_id_type parms_id, MemoryPoolHandle pool)
+	: context(context), parms_id(parms_id), accumulator(pool), is_empty(true)
+{
+	if (!context.get_context_data(parms_id)) {
+		throw std::invalid_argument("parms_id is not valid for the context");
+	}
+}
+
+void PlainInnerProduct::add_product(const Ciphertext& x, const LiftedPlaintext& c)
+{
+	if (x.parms_id() != parms_id || c.parms_id() != parms_id) {
+		throw std::invalid_argument("Operands belong to a different level");
+	}
+	if (!x.is_ntt_form()) {
+		throw std::invalid_argument("Ciphertext must be in NTT form");
+	}
+	if (!is_empty && x.size() != accumulator.size()) {
+		throw std::invalid_argument("All ciphertexts must have the same size");
+	}
+	const SEALContext::ContextData& context_data = *context.get_context_data(parms_id);
+	const std::vector<Modulus>& coeff_modulus = context_data.parms().coeff_modulus();
+	const size_t coeff_count = context_data.parms().poly_modulus_degree();
+
+	if (is_empty) {
+		accumulator.resize(context, parms_id, x.size());
+		accumulator.is_ntt_form() = true;
+		for (size_t k = 0; k < x.size(); ++k) {
+			for (size_t i = 0; i < coeff_modulus.size(); ++i) {
+				dyadic_product_coeffmod(
+					ConstCoeffIter(x.data(k) + i * coeff_count),
+					ConstCoeffIter(c.data(i)),
+					coeff_count,
+					coeff_modulus[i],
+					CoeffIter(accumulator.data(k) + i * coeff_count)
+				);
+			}
+		}
+		is_empty = false;
+		return;
+	}
+	for (size_t k = 0; k < x.size(); ++k) {
+		for (size_t i = 0; i < coeff_modulus.size(); ++i) {
+			const uint64_t* lhs = x.data(k) + i * coeff_count;
+			const uint64_t* rhs = c.data(i);
+			uint64_t* target = accumulator.data(k) + i * coeff_count;
+			for (size_t l = 0; l < coeff_count; ++l) {
+				target[l] = multiply_add_uint_mod(lhs[l], rhs[l], target[l], coeff_modulus[i]);
+			}
+		}
+	}
+}
+
+bool PlainInnerProduct::empty() const noexcept
+{
+	return is_empty;
+}
+
+void PlainInnerProduct::finish(Ciphertext& destination)
+{
+	if (is_empty) {
+		throw std::logic_error("Inner product has no terms");
+	}
+	const SEALContext::ContextData& context_data = *context.get_context_data(parms_id);
+	const NTTTables* ntt_tables = context_data.small_ntt_tables();
+	const size_t coeff_count = context_data.parms().poly_modulus_degree();
+	const size_t coeff_modulus_size = context_data.parms().coeff_modulus().size();
+	for (size_t k = 0; k < accumulator.size(); ++k) {
+		for (size_t i = 0; i < coeff_modulus_size; ++i) {
+			inverse_ntt_negacyclic_harvey(CoeffIter(accumulator.data(k) + i * coeff_count), ntt_tables[i]);
+		}
+	}
+	accumulator.is_ntt_form() = false;
+	destination = std::move(accumulator);
+	accumulator = Ciphertext(destination.pool());
+	is_empty = true;
+}
+
+void test_plain_inner_product()
+{
+	EncryptionParameters parms(scheme_type::bfv);
+	parms.set_poly_modulus_degree(4096);
+	parms.set_coeff_modulus(CoeffModulus::BFVDefault(4096));
+	parms.set_plain_modulus(257);
+	SEALContext context(parms);
+
+	KeyGenerator keygen(context);
+	SecretKey sk = keygen.secret_key();
+	PublicKey pk;
+	keygen.create_public_key(pk);
+	Encryptor encryptor(context, pk);
+	Decryptor decryptor(context, sk);
+	Evaluator eval(context);
+
+	std::vector<Ciphertext> xs(3);
+	std::vector<Plaintext> cs(3);
+	for (size_t j = 0; j < xs.size(); ++j) {
+		Plaintext x_plain;
+		x_plain.resize(4096);
+		cs[j].resize(4096);
+		for (size_t k = 0; k < 4096; ++k) {
+			x_plain[k] = (k * k + 7 * j) % 257;
+			// also use the upper half, which is lifted as negative value
+			cs[j][k] = (k * 31 + j * 200) % 257;
+		}
+		encryptor.encrypt(x_plain, xs[j]);
+	}
+
+	Ciphertext expected;
+	Ciphertext tmp;
+	eval.multiply_plain(xs[0], cs[0], expected);
+	for (size_t j = 1; j < xs.size(); ++j) {
+		eval.multiply_plain(xs[j], cs[j], tmp);
+		eval.add_inplace(expected, tmp);
+	}
+
+	PlainInnerProduct inner_product(context, context.first_parms_id());
+	assert(inner_product.empty());
+	for (size_t j = 0; j < xs.size(); ++j) {
+		Ciphertext x_ntt = xs[j];
+		transform_to_ntt_inplace(x_ntt, context);
+		inner_product.add_product(x_ntt, LiftedPlaintext(cs[j], context, context.first_parms_id()));
+	}
+	Ciphertext actual;
+	inner_product.finish(actual);
+	assert(inner_product.empty());
+
+	// the computation is exactly the same as in SEAL, so even the noise is equal
+	assert(actual.size() == expected.size());
+	assert(std::equal(actual.data(), actual.data() + actual.dyn_array().size(), expected.data()));
+
+	Plaintext expected_plain;
+	Plaintext actual_plain;
+	decryptor.decrypt(expected, expected_plain);
+	decryptor.decrypt(actual, actual_plain);
+	assert(expected_plain == actual_plain);
+	std::cout << "test_plain_inner_product(): success" << std::endl;
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include "seal/seal.h"
+#include <vector>
+
+//tex:
+//A BFV plaintext $m$, lifted to the ciphertext modulus $q$ of one context and stored in NTT form.
+//
+//This is exactly the representation that seal::Evaluator::multiply_plain() computes internally on every call:
+//The coefficients of $m$ are lifted centered, i.e. $m_i \geq t/2$ becomes $m_i - t \mod q$, and the result is
+//NTT-transformed w.r.t. every RNS modulus of $q$. Storing it allows multiplying the same plaintext to many
+//ciphertexts (or the same ciphertext many times) without redoing this work.
+class LiftedPlaintext {
+
+	seal::parms_id_type parms_id_;
+	size_t coeff_count;
+	size_t coeff_modulus_size;
+	std::vector<uint64_t> values;
+
+public:
+	LiftedPlaintext() = default;
+	LiftedPlaintext(const seal::Plaintext& plain, const seal::SEALContext& context, seal::parms_id_type parms_id);
+	LiftedPlaintext(const LiftedPlaintext&) = default;
+	LiftedPlaintext(LiftedPlaintext&&) = default;
+	~LiftedPlaintext() = default;
+
+	LiftedPlaintext& operator=(const LiftedPlaintext&) = default;
+	LiftedPlaintext& operator=(LiftedPlaintext&&) = default;
+
+	const seal::parms_id_type& parms_id() const noexcept;
+
+	/**
+	 * The NTT-form residues modulo the given RNS modulus of the ciphertext modulus.
+	*/
+	const uint64_t* data(size_t rns_index) const;
+};
+
+/**
+ * Transforms all components of a BFV ciphertext into NTT form w.r.t. the ciphertext modulus.
+ * Note that SEAL does not support BFV ciphertexts in NTT form, so the result can only be used
+ * with PlainInnerProduct.
+*/
+void transform_to_ntt_inplace(seal::Ciphertext& ciphertext, const seal::SEALContext& context);
+
+//tex:
+//Computes inner products $\sum_j c_j x_j$ of NTT-form ciphertexts $x_j$ and lifted plaintexts $c_j$.
+//
+//The products are accumulated coefficient-wise into a single NTT-form buffer, so compared to calling
+//seal::Evaluator::multiply_plain() and seal::Evaluator::add_inplace() for each term, there is no temporary
+//ciphertext per term and only one inverse NTT per ciphertext component for the whole sum.
+class PlainInnerProduct {
+
+	const seal::SEALContext& context;
+	seal::parms_id_type parms_id;
+	seal::Ciphertext accumulator;
+	bool is_empty;
+
+public:
+	PlainInnerProduct(const seal::SEALContext& context, seal::parms_id_type parms_id, seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool());
+	PlainInnerProduct(const PlainInnerProduct&) = delete;
+	PlainInnerProduct(PlainInnerProduct&&) = default;
+	~PlainInnerProduct() = default;
+
+	/**
+	 * Adds c * x to the accumulated value; x must have been transformed by transform_to_ntt_inplace(), and all added
+	 * ciphertexts must have the same size.
+	*/
+	void add_product(const seal::Ciphertext& x, const LiftedPlaintext& c);
+
+	bool empty() const noexcept;
+
+	/**
+	 * Writes the accumulated value as standard BFV ciphertext into destination, and resets this object to the empty sum.
+	 * Throws std::logic_error if no product was added.
+	*/
+	void finish(seal::Ciphertext& destination);
+};
+
+void test_plain_inner_product();
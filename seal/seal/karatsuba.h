@@ -1,5 +1,6 @@
 #pragma once
 #include <vector>
+#include <concepts>
 #include <assert.h>
 
 /**
@@ -31,9 +32,19 @@ namespace karatsuba {
 	template<unsigned threshold_log2, typename T, typename Add, typename Sub, typename Mul>
 	void karatsuba(T* dst, size_t dst_len, const T* lhs, size_t lhs_len, const T* rhs, size_t rhs_len, const Add& add, const Sub& sub, const Mul& mul);
 
+	/**
+	 * Same as karatsuba() above, but uses the given scratch memory instead of allocating it, which must hold
+	 * at least karatsuba_scratch_element_count<T>(lhs_len, rhs_len, threshold_log2) elements.
+	*/
+	template<unsigned threshold_log2, typename T, typename Add, typename Sub, typename Mul>
+	void karatsuba(T* dst, size_t dst_len, const T* lhs, size_t lhs_len, const T* rhs, size_t rhs_len, const Add& add, const Sub& sub, const Mul& mul, T* memory);
+
 	template<typename T>
 	size_t karatsuba_mem_element_count(size_t in_size_log2, size_t threshold_log2);
 
+	template<typename T>
+	size_t karatsuba_scratch_element_count(size_t lhs_len, size_t rhs_len, size_t threshold_log2);
+
 	template<typename T, typename F>
 	inline void elementwise_assign(T* dst, const T* src, size_t n, const F& f)
 	{
@@ -42,6 +53,17 @@ namespace karatsuba {
 		}
 	}
 
+	/**
+	 * A multiplication functor may provide an accumulator, i.e. mul.accumulator() returns an object with add_product(a, b)
+	 * and reduce(), that sums up products without reducing each of them. The base case then only reduces once per output element;
+	 * the accumulator must support sums of 2^threshold_log2 products.
+	*/
+	template<typename T, typename Mul>
+	concept LazyMul = requires(const Mul& mul, T a) {
+		mul.accumulator().add_product(a, a);
+		{ mul.accumulator().reduce() } -> std::convertible_to<T>;
+	};
+
 	template<bool add_assign, typename T, typename Add, typename Sub, typename Mul>
 	inline void naive_assign_mul(T* dst, const T* lhs, const T* rhs, size_t in_size_log2, const Add& add, const Sub& sub, const Mul& mul)
 	{
@@ -49,8 +71,17 @@ namespace karatsuba {
 		for (size_t i = 0; i < 2 * n; ++i) {
 			T acc = 0;
 			const size_t start = static_cast<size_t>(std::max<int64_t>(static_cast<int64_t>(i) - static_cast<int64_t>(n) + 1, 0));
-			for (size_t j = start; j < std::min(n, i + 1); ++j) {
-				acc = add(acc, mul(lhs[i - j], rhs[j]));
+			if constexpr (LazyMul<T, Mul>) {
+				auto lazy_acc = mul.accumulator();
+				for (size_t j = start; j < std::min(n, i + 1); ++j) {
+					lazy_acc.add_product(lhs[i - j], rhs[j]);
+				}
+				acc = lazy_acc.reduce();
+			}
+			else {
+				for (size_t j = start; j < std::min(n, i + 1); ++j) {
+					acc = add(acc, mul(lhs[i - j], rhs[j]));
+				}
 			}
 			if constexpr (add_assign) {
 				dst[i] = add(dst[i], acc);
@@ -165,6 +196,16 @@ namespace karatsuba {
 
 	template<unsigned threshold_log2, typename T, typename Add, typename Sub, typename Mul>
 	void karatsuba(T* dst, size_t dst_len, const T* lhs, size_t lhs_len, const T* rhs, size_t rhs_len, const Add& add, const Sub& sub, const Mul& mul)
+	{
+		if (lhs_len == 0 || rhs_len == 0) {
+			return;
+		}
+		std::unique_ptr<T[]> memory(new T[karatsuba_scratch_element_count<T>(lhs_len, rhs_len, threshold_log2)]);
+		karatsuba<threshold_log2>(dst, dst_len, lhs, lhs_len, rhs, rhs_len, add, sub, mul, memory.get());
+	}
+
+	template<unsigned threshold_log2, typename T, typename Add, typename Sub, typename Mul>
+	void karatsuba(T* dst, size_t dst_len, const T* lhs, size_t lhs_len, const T* rhs, size_t rhs_len, const Add& add, const Sub& sub, const Mul& mul, T* memory)
 	{
 		if (lhs_len == 0 || rhs_len == 0) {
 			return;
@@ -175,12 +216,10 @@ namespace karatsuba {
 		assert(lhs_len >= n);
 		assert(rhs_len >= n);
 		assert((lhs_len < 2 * n) || (rhs_len < 2 * n));
-		const size_t mem_element_count = karatsuba_mem_element_count<T>(static_cast<unsigned int>(block_size_log2), threshold_log2);
-		std::unique_ptr<T[] > memory(new T[mem_element_count]);
 
 		for (size_t i = 0; i + n <= lhs_len; i += n) {
 			for (size_t j = 0; j + n <= rhs_len; j += n) {
-				dispatch_karatsuba_assign_mul_impl<threshold_log2, true>(static_cast<unsigned int>(block_size_log2), dst + i + j, lhs + i, rhs + j, memory.get(), add, sub, mul);
+				dispatch_karatsuba_assign_mul_impl<threshold_log2, true>(static_cast<unsigned int>(block_size_log2), dst + i + j, lhs + i, rhs + j, memory, add, sub, mul);
 			}
 		}
 
@@ -192,13 +231,13 @@ namespace karatsuba {
 		while (block_size_log2 >= 0) {
 			if (lhs_len >= lhs_rem + n) {
 				for (size_t j = 0; j + n <= rhs_rem; j += n) {
-					dispatch_karatsuba_assign_mul_impl<threshold_log2, true>(static_cast<unsigned int>(block_size_log2), dst + lhs_rem + j, lhs + lhs_rem, rhs + j, memory.get(), add, sub, mul);
+					dispatch_karatsuba_assign_mul_impl<threshold_log2, true>(static_cast<unsigned int>(block_size_log2), dst + lhs_rem + j, lhs + lhs_rem, rhs + j, memory, add, sub, mul);
 				}
 				lhs_rem += n;
 			}
 			if (rhs_len >= rhs_rem + n) {
 				for (size_t i = 0; i + n <= lhs_len; i += n) {
-					dispatch_karatsuba_assign_mul_impl<threshold_log2, true>(static_cast<unsigned int>(block_size_log2), dst + rhs_rem + i, lhs + i, rhs + rhs_rem, memory.get(), add, sub, mul);
+					dispatch_karatsuba_assign_mul_impl<threshold_log2, true>(static_cast<unsigned int>(block_size_log2), dst + rhs_rem + i, lhs + i, rhs + rhs_rem, memory, add, sub, mul);
 				}
 				rhs_rem += n;
 			}
@@ -217,6 +256,17 @@ namespace karatsuba {
 		return elements;
 	}
 
+	template<typename T>
+	inline size_t karatsuba_scratch_element_count(size_t lhs_len, size_t rhs_len, size_t threshold_log2)
+	{
+		if (lhs_len == 0 || rhs_len == 0) {
+			return 0;
+		}
+		// the largest blocks have the size of the largest power of two not exceeding both lengths
+		const size_t block_size_log2 = 63 - std::max(leading_zeros(lhs_len), leading_zeros(rhs_len));
+		return karatsuba_mem_element_count<T>(block_size_log2, threshold_log2);
+	}
+
 	inline void test_karatsuba() {
 		auto add = [](int a, int b) { return a + b; };
 		auto sub = [](int a, int b) { return a - b; };
@@ -248,5 +298,25 @@ namespace karatsuba {
 			std::vector<int> expected = { 0, 2, 0, 4, 3, 1, -1, 1, 4, 4, 2, 0 };
 			assert(dst == expected);
 		}
+		{
+			// the same with an accumulating multiplication
+			struct AccumulatingMul {
+				struct Accumulator {
+					long long value = 0;
+					void add_product(int a, int b) { value += static_cast<long long>(a) * b; }
+					int reduce() const { return static_cast<int>(value); }
+				};
+				int operator()(int a, int b) const { return a * b; }
+				Accumulator accumulator() const { return Accumulator(); }
+			};
+			static_assert(LazyMul<int, AccumulatingMul>);
+			std::vector<int> lhs = { 0, 1, 0, 2, 2 };
+			std::vector<int> rhs = { 2, 0, 0, -1, 1, 1, 1 };
+			std::vector<int> dst;
+			dst.resize(12);
+			karatsuba<2>(&dst[0], dst.size(), &lhs[0], lhs.size(), &rhs[0], rhs.size(), add, sub, AccumulatingMul());
+			std::vector<int> expected = { 0, 2, 0, 4, 3, 1, -1, 1, 4, 4, 2, 0 };
+			assert(dst == expected);
+		}
 	}
 }
\ No newline at end of file
@@ -0,0 +1,67 @@
+#include "mappedfile.h"
+#include <stdexcept>
+#include <fstream>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifndef _WIN32
+
+MappedFile::MappedFile(const std::string& filename) : content(nullptr), content_size(0)
+{
+	const int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		throw std::invalid_argument("Cannot open file " + filename);
+	}
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) != 0) {
+		close(fd);
+		throw std::invalid_argument("Cannot stat file " + filename);
+	}
+	content_size = static_cast<size_t>(file_stat.st_size);
+	if (content_size > 0) {
+		void* mapping = mmap(nullptr, content_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping == MAP_FAILED) {
+			close(fd);
+			throw std::invalid_argument("Cannot map file " + filename);
+		}
+		content = static_cast<const char*>(mapping);
+	}
+	// the mapping stays valid after closing the file descriptor
+	close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+	if (content != nullptr) {
+		munmap(const_cast<char*>(content), content_size);
+	}
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& filename) : content(nullptr), content_size(0)
+{
+	std::ifstream in(filename, std::ios::binary | std::ios::ate);
+	if (!in) {
+		throw std::invalid_argument("Cannot open file " + filename);
+	}
+	buffer.resize(static_cast<size_t>(in.tellg()));
+	in.seekg(0);
+	in.read(buffer.data(), buffer.size());
+	if (!in) {
+		throw std::invalid_argument("Cannot read file " + filename);
+	}
+	content = buffer.data();
+	content_size = buffer.size();
+}
+
+MappedFile::~MappedFile()
+{
+}
+
+#endif
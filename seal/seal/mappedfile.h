@@ -0,0 +1,38 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstddef>
+
+/**
+ * Read-only view of the whole content of a file. On POSIX systems, the file is
+ * memory-mapped, so only the parts that are actually accessed are loaded from disk;
+ * otherwise, the content is read into a buffer.
+*/
+class MappedFile {
+
+	const char* content;
+	size_t content_size;
+	std::vector<char> buffer;
+
+public:
+	/**
+	 * Opens the given file; throws std::invalid_argument if it cannot be read.
+	*/
+	explicit MappedFile(const std::string& filename);
+	MappedFile(const MappedFile&) = delete;
+	MappedFile(MappedFile&&) = delete;
+	~MappedFile();
+
+	const char* data() const noexcept;
+	size_t size() const noexcept;
+};
+
+inline const char* MappedFile::data() const noexcept
+{
+	return content;
+}
+
+inline size_t MappedFile::size() const noexcept
+{
+	return content_size;
+}
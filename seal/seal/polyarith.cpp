@@ -1,6 +1,11 @@
 #include "polyarith.h"
 #include "karatsuba.h"
+#include "seal/modulus.h"
+#include "seal/util/ntt.h"
 #include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
 
 struct uint64_mod_t {
 	const seal::Modulus& modulus;
@@ -41,6 +46,18 @@ void poly_add(poly& lhs, const poly& rhs, const seal::Modulus& mod, uint64_t sca
 	}
 }
 
+void poly_add_scaled(poly& lhs, std::span<const uint64_t> rhs, uint64_t scale, const seal::Modulus& mod)
+{
+	if (lhs.size() < rhs.size()) {
+		lhs.resize(rhs.size());
+	}
+	seal::util::MultiplyUIntModOperand scale_op;
+	scale_op.set(seal::util::barrett_reduce_64(scale, mod), mod);
+	for (size_t i = 0; i < rhs.size(); ++i) {
+		lhs[i] = seal::util::add_uint_mod(lhs[i], seal::util::multiply_uint_mod(rhs[i], scale_op, mod), mod);
+	}
+}
+
 void poly_scale(poly& p, uint64_t scale, const seal::Modulus& mod)
 {
 	seal::util::MultiplyUIntModOperand scale_op;
@@ -50,45 +67,295 @@ void poly_scale(poly& p, uint64_t scale, const seal::Modulus& mod)
 	}
 }
 
+namespace {
+
+	// the base case size of the karatsuba multiplication
+	constexpr unsigned karatsuba_threshold_log2 = 4;
+
+	// multiplication modulo mod for karatsuba, where the base case sums up the 128-bit products and only reduces each sum;
+	// since mod has at most 61 bits, a sum of 2^karatsuba_threshold_log2 products fits into 128 bits
+	struct LazyModMul {
+		const seal::Modulus& mod;
+
+		class Accumulator {
+			const seal::Modulus& mod;
+			unsigned long long value[2] = { 0, 0 };
+
+		public:
+			inline Accumulator(const seal::Modulus& mod) : mod(mod) {}
+
+			inline void add_product(uint64_t a, uint64_t b)
+			{
+				unsigned long long product[2];
+				seal::util::multiply_uint64(a, b, product);
+				const unsigned char carry = seal::util::add_uint64(value[0], product[0], value);
+				value[1] += product[1] + carry;
+			}
+
+			inline uint64_t reduce() const
+			{
+				return seal::util::barrett_reduce_128(value, mod);
+			}
+		};
+		static_assert(2 * 61 + karatsuba_threshold_log2 <= 128);
+
+		inline uint64_t operator()(uint64_t a, uint64_t b) const
+		{
+			return seal::util::multiply_uint_mod(a, b, mod);
+		}
+
+		inline Accumulator accumulator() const
+		{
+			return Accumulator(mod);
+		}
+	};
+
+	// below this size of the factors, karatsuba is faster than the NTT-based multiplication
+	constexpr size_t ntt_mul_threshold = 256;
+	constexpr int ntt_prime_bit_count = 60;
+
+	// NTT tables for an RNS base of NTT-friendly primes, used to multiply in (Z/qZ)[X]/(X^n + 1) for
+	// arbitrary q; they only depend on n and the number of primes, and are shared by all threads
+	struct NegacyclicNTTBase {
+		std::vector<seal::Modulus> primes;
+		std::vector<seal::util::NTTTables> tables;
+	};
+
+	std::shared_ptr<const NegacyclicNTTBase> get_negacyclic_ntt_base(size_t log2n, size_t prime_count)
+	{
+		static std::mutex cache_mutex;
+		static std::map<std::tuple<size_t, size_t>, std::shared_ptr<const NegacyclicNTTBase>> cache;
+
+		std::unique_lock<std::mutex> lock(cache_mutex);
+		auto it = cache.find(std::make_tuple(log2n, prime_count));
+		if (it != cache.end()) {
+			return it->second;
+		}
+		std::shared_ptr<NegacyclicNTTBase> result = std::make_shared<NegacyclicNTTBase>();
+		result->primes = seal::CoeffModulus::Create((size_t)1 << log2n, std::vector<int>(prime_count, ntt_prime_bit_count));
+		result->tables.reserve(prime_count);
+		for (const seal::Modulus& prime : result->primes) {
+			result->tables.emplace_back(static_cast<int>(log2n), prime);
+		}
+		cache[std::make_tuple(log2n, prime_count)] = result;
+		return result;
+	}
+
+	bool is_negacyclic(const PolyModulus& pmod, const seal::Modulus& mod)
+	{
+		return pmod.x_power_n.size() == 1 && pmod.x_power_n[0] == mod.value() - 1 && pmod.n > 0 && (pmod.n & (pmod.n - 1)) == 0;
+	}
+
+	//tex:
+	//Computes the product in $(\mathbb{Z}/q\mathbb{Z})[X]/(X^n + 1)$ by computing the integer product in
+	//$\mathbb{Z}[X]/(X^n + 1)$ modulo NTT-friendly primes $q_0, ..., q_{k - 1}$ and then using CRT (Garner's algorithm).
+	//The coefficients of the integer product are in $(-B, B)$ with $B = n(q - 1)^2$, so after adding $B$, they
+	//are uniquely determined modulo $Q = q_0 ... q_{k - 1}$ if $Q > 2B$.
+	void poly_mul_mod_negacyclic_ntt(const poly& lhs, const poly& rhs, const seal::Modulus& mod, size_t n, poly& result, PolyWorkspace& workspace)
+	{
+		size_t log2n = 0;
+		while (((size_t)1 << log2n) < n) {
+			++log2n;
+		}
+		const size_t required_bits = log2n + 2 * static_cast<size_t>(mod.bit_count()) + 2;
+		const size_t prime_count = (required_bits + ntt_prime_bit_count - 2) / (ntt_prime_bit_count - 1);
+		const std::shared_ptr<const NegacyclicNTTBase> base = get_negacyclic_ntt_base(log2n, prime_count);
+
+		// the residues modulo q_i are stored at offset i * n
+		PolyWorkspace::Buffer residues_buffer = workspace.acquire(prime_count * n);
+		PolyWorkspace::Buffer tmp_buffer = workspace.acquire(n);
+		poly& tmp = *tmp_buffer;
+		for (size_t i = 0; i < prime_count; ++i) {
+			const seal::Modulus& prime = base->primes[i];
+			uint64_t* residue = residues_buffer->data() + i * n;
+			std::fill(tmp.begin(), tmp.end(), 0);
+			for (size_t j = 0; j < lhs.size(); ++j) {
+				residue[j] = prime.reduce(lhs[j]);
+			}
+			for (size_t j = 0; j < rhs.size(); ++j) {
+				tmp[j] = prime.reduce(rhs[j]);
+			}
+			seal::util::ntt_negacyclic_harvey(residue, base->tables[i]);
+			seal::util::ntt_negacyclic_harvey(tmp.data(), base->tables[i]);
+			for (size_t j = 0; j < n; ++j) {
+				residue[j] = seal::util::multiply_uint_mod(residue[j], tmp[j], prime);
+			}
+			seal::util::inverse_ntt_negacyclic_harvey(residue, base->tables[i]);
+
+			// B mod q_i
+			const uint64_t offset = seal::util::multiply_uint_mod(
+				prime.reduce(n),
+				seal::util::multiply_uint_mod(prime.reduce(mod.value() - 1), prime.reduce(mod.value() - 1), prime),
+				prime
+			);
+			for (size_t j = 0; j < n; ++j) {
+				residue[j] = seal::util::add_uint_mod(residue[j], offset, prime);
+			}
+		}
+
+		// prefix_products[i][j] = q_0 ... q_{j - 1} mod q_i for j <= i, and prefix_products_mod[j] = q_0 ... q_{j - 1} mod q
+		std::vector<std::vector<seal::util::MultiplyUIntModOperand>> prefix_products(prime_count);
+		std::vector<seal::util::MultiplyUIntModOperand> inv_prefix_products(prime_count);
+		std::vector<seal::util::MultiplyUIntModOperand> prefix_products_mod(prime_count);
+		uint64_t current_mod = 1;
+		for (size_t i = 0; i < prime_count; ++i) {
+			const seal::Modulus& prime = base->primes[i];
+			uint64_t current = 1;
+			prefix_products[i].resize(i + 1);
+			for (size_t j = 0; j <= i; ++j) {
+				prefix_products[i][j].set(current, prime);
+				if (j < i) {
+					current = seal::util::multiply_uint_mod(current, prime.reduce(base->primes[j].value()), prime);
+				}
+			}
+			inv_prefix_products[i].set(inv_mod(current, prime), prime);
+			prefix_products_mod[i].set(current_mod, mod);
+			current_mod = seal::util::multiply_uint_mod(current_mod, mod.reduce(prime.value()), mod);
+		}
+		const uint64_t offset_mod = seal::util::multiply_uint_mod(
+			mod.reduce(n), 
+			seal::util::multiply_uint_mod(mod.value() - 1, mod.value() - 1, mod), 
+			mod
+		);
+
+		result.resize(n);
+		std::vector<uint64_t> digits(prime_count);
+		for (size_t j = 0; j < n; ++j) {
+			// compute the mixed-radix digits of the result w.r.t. q_0, ..., q_{k - 1}, then evaluate them modulo q
+			uint64_t value = 0;
+			for (size_t i = 0; i < prime_count; ++i) {
+				const seal::Modulus& prime = base->primes[i];
+				uint64_t digit = (*residues_buffer)[i * n + j];
+				for (size_t l = 0; l < i; ++l) {
+					digit = seal::util::sub_uint_mod(digit, seal::util::multiply_uint_mod(prime.reduce(digits[l]), prefix_products[i][l], prime), prime);
+				}
+				digits[i] = seal::util::multiply_uint_mod(digit, inv_prefix_products[i], prime);
+				value = seal::util::add_uint_mod(value, seal::util::multiply_uint_mod(mod.reduce(digits[i]), prefix_products_mod[i], mod), mod);
+			}
+			result[j] = seal::util::sub_uint_mod(value, offset_mod, mod);
+		}
+	}
+}
+
+PolyWorkspace::PolyWorkspace()
+{
+	free_buffers.reserve(max_free_buffer_count);
+}
+
+PolyWorkspace::Buffer::~Buffer()
+{
+	if (workspace.free_buffers.size() < max_free_buffer_count) {
+		workspace.free_buffers.push_back(std::move(content));
+	}
+}
+
+PolyWorkspace::Buffer PolyWorkspace::acquire(size_t size)
+{
+	poly content;
+	if (free_buffers.size() > 0) {
+		content = std::move(free_buffers.back());
+		free_buffers.pop_back();
+	}
+	content.assign(size, 0);
+	return Buffer(*this, std::move(content));
+}
+
+PolyWorkspace& PolyWorkspace::thread_local_workspace()
+{
+	thread_local PolyWorkspace workspace;
+	return workspace;
+}
+
 poly poly_mul_mod(const poly& lhs, const poly& rhs, const seal::Modulus& mod, const PolyModulus& pmod) {
+	poly result;
+	poly_mul_mod(lhs, rhs, mod, pmod, result, PolyWorkspace::thread_local_workspace());
+	return result;
+}
+
+void poly_mul_mod(const poly& lhs, const poly& rhs, const seal::Modulus& mod, const PolyModulus& pmod, poly& result, PolyWorkspace& workspace) {
 	if (lhs.size() == 0 || rhs.size() == 0) {
-		poly result;
-		result.resize(pmod.n);
-		return result;
+		result.assign(pmod.n, 0);
+		return;
 	}
 #ifdef CONTRACT_TEST
 	poly check;
 	poly_add_mul(check, lhs, rhs, mod);
 #endif
-	poly result;
-	result.resize(lhs.size() + rhs.size());
 	assert(lhs.size() <= pmod.n);
 	assert(rhs.size() <= pmod.n);
-	karatsuba::karatsuba<4>(
-		&result[0], result.size(), 
-		&lhs[0], lhs.size(), 
-		&rhs[0], rhs.size(),
-		[&mod](uint64_t a, uint64_t b) { return seal::util::add_uint_mod(a, b, mod); },
-		[&mod](uint64_t a, uint64_t b) { return seal::util::sub_uint_mod(a, b, mod); },
-		[&mod](uint64_t a, uint64_t b) { return seal::util::multiply_uint_mod(a, b, mod); }
-	);
-	poly_reduce_mod(result, mod, pmod);
+	// compute into a buffer of the workspace, since result may alias lhs or rhs
+	PolyWorkspace::Buffer product = workspace.acquire(0);
+	if (std::min(lhs.size(), rhs.size()) >= ntt_mul_threshold && is_negacyclic(pmod, mod)) {
+		poly_mul_mod_negacyclic_ntt(lhs, rhs, mod, pmod.n, *product, workspace);
+		// same size as in the karatsuba case
+		product->resize(std::min(pmod.n, lhs.size() + rhs.size()));
+#ifdef CONTRACT_TEST
+		poly_reduce_mod(check, mod, pmod);
+		check.resize(product->size());
+		assert(check == *product);
+#endif
+		result.swap(*product);
+		return;
+	}
+	product->resize(lhs.size() + rhs.size());
+	{
+		PolyWorkspace::Buffer memory = workspace.acquire(karatsuba::karatsuba_scratch_element_count<uint64_t>(lhs.size(), rhs.size(), karatsuba_threshold_log2));
+		karatsuba::karatsuba<karatsuba_threshold_log2>(
+			product->data(), product->size(),
+			&lhs[0], lhs.size(),
+			&rhs[0], rhs.size(),
+			[&mod](uint64_t a, uint64_t b) { return seal::util::add_uint_mod(a, b, mod); },
+			[&mod](uint64_t a, uint64_t b) { return seal::util::sub_uint_mod(a, b, mod); },
+			LazyModMul{ mod },
+			memory->data()
+		);
+	}
+	poly_reduce_mod(*product, mod, pmod, workspace);
 #ifdef CONTRACT_TEST
 	poly_reduce_mod(check, mod, pmod);
-	assert(check.size() <= result.size());
-	check.resize(result.size());
-	assert(check == result);
+	assert(check.size() <= product->size());
+	check.resize(product->size());
+	assert(check == *product);
 #endif
-	return result;
+	result.swap(*product);
 }
 
 void poly_reduce_mod(poly& lhs, const seal::Modulus& mod, const PolyModulus& pmod)
+{
+	poly_reduce_mod(lhs, mod, pmod, PolyWorkspace::thread_local_workspace());
+}
+
+void poly_reduce_mod(poly& lhs, const seal::Modulus& mod, const PolyModulus& pmod, PolyWorkspace& workspace)
 {
 	if (lhs.size() < pmod.n) {
 		return;
 	}
+	assert(pmod.x_power_n.size() <= pmod.n);
+	// the moduli we use are usually very sparse (e.g. X^N + 1 or polynomials in X^(d/2)), so only iterate over the nonzero terms;
+	// each term is stored as its index and the two words of its seal::util::MultiplyUIntModOperand
+	PolyWorkspace::Buffer terms = workspace.acquire(0);
+	for (size_t k = 0; k < pmod.x_power_n.size(); ++k) {
+		if (pmod.x_power_n[k] != 0) {
+			seal::util::MultiplyUIntModOperand coeff;
+			coeff.set(pmod.x_power_n[k], mod);
+			terms->push_back(k);
+			terms->push_back(coeff.operand);
+			terms->push_back(coeff.quotient);
+		}
+	}
 	for (int64_t i = lhs.size() - 1; i >= static_cast<int64_t>(pmod.n); --i) {
-		poly_add(lhs, pmod.x_power_n, mod, lhs[i], i - pmod.n);
+		const uint64_t factor = lhs[i];
+		if (factor == 0) {
+			continue;
+		}
+		const size_t shift = i - pmod.n;
+		for (size_t t = 0; t < terms->size(); t += 3) {
+			const size_t k = (*terms)[t];
+			seal::util::MultiplyUIntModOperand coeff;
+			coeff.operand = (*terms)[t + 1];
+			coeff.quotient = (*terms)[t + 2];
+			lhs[shift + k] = seal::util::add_uint_mod(lhs[shift + k], seal::util::multiply_uint_mod(factor, coeff, mod), mod);
+		}
 	}
 	lhs.resize(pmod.n);
 }
@@ -416,4 +683,42 @@ void test_is_irreducible() {
 		assert(!is_irreducible({ 1, 1, 0, 1 }, mod));
 	}
 	std::cout << "test_is_irreducible(): success" << std::endl;
-}
\ No newline at end of file
+}
+
+void test_poly_mul_mod()
+{
+	// compare the NTT-based multiplication in X^n + 1 against the schoolbook method, for a small and a large modulus
+	for (uint64_t modulus : { (uint64_t)257 * 257 * 257, ((uint64_t)1 << 61) - 1 }) {
+		seal::Modulus mod(modulus);
+		PolyModulus pmod = { { modulus - 1 }, 1024 };
+		poly lhs;
+		poly rhs;
+		uint64_t state = 1;
+		for (size_t i = 0; i < 1024; ++i) {
+			state = state * 6364136223846793005 + 1442695040888963407;
+			lhs.push_back(mod.reduce(state));
+			if (i < 700) {
+				rhs.push_back(mod.reduce(state >> 7));
+			}
+		}
+		poly expected;
+		poly_add_mul(expected, lhs, rhs, mod);
+		poly_reduce_mod(expected, mod, pmod);
+		assert(poly_mul_mod(lhs, rhs, mod, pmod) == expected);
+
+		// the workspace variant, also with aliasing output and for the karatsuba case
+		PolyWorkspace workspace;
+		poly result = lhs;
+		poly_mul_mod(result, rhs, mod, pmod, result, workspace);
+		assert(result == expected);
+		const poly small_lhs(lhs.begin(), lhs.begin() + 100);
+		poly small_expected;
+		poly_add_mul(small_expected, small_lhs, rhs, mod);
+		poly_reduce_mod(small_expected, mod, pmod);
+		poly_mul_mod(small_lhs, rhs, mod, pmod, result, workspace);
+		// the karatsuba product is not normalized
+		small_expected.resize(result.size());
+		assert(result == small_expected);
+	}
+	std::cout << "test_poly_mul_mod(): success" << std::endl;
+}
@@ -2,6 +2,7 @@
 #include <vector>
 #include <assert.h>
 #include <ostream>
+#include <span>
 #include "seal/util/uintarithsmallmod.h"
 
 /**
@@ -29,12 +30,64 @@ struct PolyModulus {
 	size_t n;
 };
 
+/**
+ * A set of reusable scratch buffers for temporaries of the poly functions. Buffers are borrowed with
+ * acquire() and given back when the returned handle is destroyed, keeping their capacity, so that repeated
+ * operations of similar size do not allocate after the first one.
+ *
+ * A workspace must not be used by multiple threads at the same time; thread_local_workspace()
+ * returns a separate workspace for each thread.
+*/
+class PolyWorkspace {
+
+	std::vector<poly> free_buffers;
+
+	// bounds the number of idle buffers, so that a single large computation does not pin memory forever
+	static constexpr size_t max_free_buffer_count = 32;
+
+public:
+	class Buffer {
+
+		PolyWorkspace& workspace;
+		poly content;
+
+		inline Buffer(PolyWorkspace& workspace, poly content) : workspace(workspace), content(std::move(content)) {}
+
+	public:
+		Buffer(const Buffer&) = delete;
+		Buffer(Buffer&&) = delete;
+		~Buffer();
+
+		poly& operator*() noexcept;
+		poly* operator->() noexcept;
+
+		friend PolyWorkspace;
+	};
+
+	PolyWorkspace();
+	PolyWorkspace(const PolyWorkspace&) = delete;
+	PolyWorkspace(PolyWorkspace&&) = delete;
+	~PolyWorkspace() = default;
+
+	/**
+	 * Returns a buffer of size zero-initialized elements. The buffer must be destroyed before the workspace.
+	*/
+	Buffer acquire(size_t size);
+
+	static PolyWorkspace& thread_local_workspace();
+};
+
 void poly_normalize(poly& p);
 void poly_add(poly& lhs, const poly& rhs, const seal::Modulus& mod, uint64_t scale = 1, size_t power_x_scale = 0);
+// same as poly_add(), but reads rhs from a view, so that the caller need not copy it into a poly
+void poly_add_scaled(poly& lhs, std::span<const uint64_t> rhs, uint64_t scale, const seal::Modulus& mod);
 poly poly_exponentiate_mod(const poly& basis, size_t exp, const seal::Modulus& mod, const PolyModulus& pmod);
 void poly_scale(poly& p, uint64_t scale, const seal::Modulus& mod);
 poly poly_mul_mod(const poly& lhs, const poly& rhs, const seal::Modulus& mod, const PolyModulus& pmod);
+// same as above, but writes the product into result (which may alias lhs or rhs) and takes all temporaries from the workspace
+void poly_mul_mod(const poly& lhs, const poly& rhs, const seal::Modulus& mod, const PolyModulus& pmod, poly& result, PolyWorkspace& workspace);
 void poly_reduce_mod(poly& lhs, const seal::Modulus& mod, const PolyModulus& pmod);
+void poly_reduce_mod(poly& lhs, const seal::Modulus& mod, const PolyModulus& pmod, PolyWorkspace& workspace);
 void poly_sub_mul(poly& dst, const poly& lhs, const poly& rhs, const seal::Modulus& mod);
 void poly_add_mul(poly& dst, const poly& lhs, const poly& rhs, const seal::Modulus& mod);
 std::tuple<int64_t, int64_t> eea(uint64_t a, uint64_t b);
@@ -53,4 +106,15 @@ inline void poly_sub(poly& lhs, const poly& rhs, const seal::Modulus& mod, uint6
 	poly_add(lhs, rhs, mod, seal::util::negate_uint_mod(scale, mod), power_x_scale);
 }
 
-void test_is_irreducible();
\ No newline at end of file
+void test_is_irreducible();
+void test_poly_mul_mod();
+
+inline poly& PolyWorkspace::Buffer::operator*() noexcept
+{
+	return content;
+}
+
+inline poly* PolyWorkspace::Buffer::operator->() noexcept
+{
+	return &content;
+}
\ No newline at end of file
@@ -0,0 +1,134 @@
+#include "powercache.h"
+#include "stats.h"
+#include <assert.h>
+#include <iostream>
+#include "seal/util/uintarithsmallmod.h"
+
+using namespace seal;
+
+PowerCache::PowerCache(const Ciphertext& x, const Evaluator& eval, const RelinKeys& rk, MemoryPoolHandle pool) : eval(eval), rk(rk), pool(std::move(pool))
+{
+	if (x.size() != 2) {
+		throw std::invalid_argument("Can only cache powers of size 2 ciphertexts");
+	}
+	powers.emplace(1, Ciphertext(x, this->pool));
+}
+
+size_t PowerCache::split_exponent(size_t exponent) noexcept
+{
+	size_t split = 1;
+	while (2 * split < exponent) {
+		split *= 2;
+	}
+	return split;
+}
+
+const Ciphertext& PowerCache::power(size_t exponent)
+{
+	auto it = powers.find(exponent);
+	if (it != powers.end()) {
+		return it->second;
+	}
+	Ciphertext result(pool);
+	power_unrelinearized(exponent, result);
+	eval.relinearize_inplace(result, rk, pool); log_relin();
+	// references to elements of an unordered_map stay valid on insertion
+	return powers.emplace(exponent, std::move(result)).first->second;
+}
+
+void PowerCache::power_unrelinearized(size_t exponent, Ciphertext& destination)
+{
+	if (exponent == 0) {
+		throw std::invalid_argument("x^0 is not a ciphertext");
+	}
+	auto it = powers.find(exponent);
+	if (it != powers.end()) {
+		destination = it->second;
+		return;
+	}
+	const size_t split = split_exponent(exponent);
+	if (split == exponent - split) {
+		eval.square(power(split), destination, pool); log_multiply();
+	}
+	else {
+		const Ciphertext& lhs = power(split);
+		const Ciphertext& rhs = power(exponent - split);
+		eval.multiply(lhs, rhs, destination, pool); log_multiply();
+	}
+}
+
+bool PowerCache::contains(size_t exponent) const
+{
+	return powers.find(exponent) != powers.end();
+}
+
+size_t PowerCache::size() const noexcept
+{
+	return powers.size();
+}
+
+size_t PowerCache::depth(size_t exponent) noexcept
+{
+	size_t result = 0;
+	while (((size_t)1 << result) < exponent) {
+		++result;
+	}
+	return result;
+}
+
+void test_power_cache()
+{
+	EncryptionParameters parms(scheme_type::bfv);
+	parms.set_poly_modulus_degree(8192);
+	parms.set_coeff_modulus(CoeffModulus::BFVDefault(8192));
+	parms.set_plain_modulus(257);
+	SEALContext context(parms);
+
+	KeyGenerator keygen(context);
+	SecretKey sk = keygen.secret_key();
+	PublicKey pk;
+	keygen.create_public_key(pk);
+	RelinKeys rk;
+	keygen.create_relin_keys(rk);
+	Encryptor encryptor(context, pk);
+	Decryptor decryptor(context, sk);
+	Evaluator eval(context);
+
+	Plaintext x_plain;
+	x_plain.resize(1);
+	x_plain[0] = 3;
+	Ciphertext x_enc;
+	encryptor.encrypt(x_plain, x_enc);
+
+	const auto decrypt_constant = [&decryptor](const Ciphertext& ct) {
+		Plaintext result;
+		decryptor.decrypt(ct, result);
+		return result[0];
+	};
+	const Modulus plain_modulus(257);
+
+	BootstrapStats stats;
+	BootstrapStatsScope scope(&stats);
+	PowerCache powers(x_enc, eval, rk);
+	// x^12 = x^8 * x^4 requires x^2, x^4, x^8
+	assert(decrypt_constant(powers.power(12)) == util::exponentiate_uint_mod(3, 12, plain_modulus));
+	assert(stats.multiply_operations() == 4);
+	assert(powers.contains(8) && powers.contains(4) && powers.contains(2) && !powers.contains(3));
+	assert(decrypt_constant(powers.power(5)) == util::exponentiate_uint_mod(3, 5, plain_modulus));
+	assert(stats.multiply_operations() == 5);
+	powers.power(8);
+	assert(stats.multiply_operations() == 5);
+
+	Ciphertext unrelinearized;
+	powers.power_unrelinearized(3, unrelinearized);
+	assert(unrelinearized.size() == 3);
+	assert(!powers.contains(3));
+	assert(decrypt_constant(unrelinearized) == 27);
+	powers.power_unrelinearized(12, unrelinearized);
+	assert(unrelinearized.size() == 2);
+
+	assert(PowerCache::depth(1) == 0);
+	assert(PowerCache::depth(12) == 4);
+	assert(PowerCache::depth(16) == 4);
+	std::cout << "test_power_cache(): success" << std::endl;
+}
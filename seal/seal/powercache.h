@@ -0,0 +1,52 @@
+#pragma once
+#include "seal/seal.h"
+#include <unordered_map>
+
+/**
+ * Memoizes the homomorphic powers of one ciphertext, so that every power is computed only once,
+ * even if it is used by different parts of a polynomial evaluation.
+ *
+ * A power x^e is computed as x^(2^l) * x^(e - 2^l), where 2^l is the largest power of two below e;
+ * this gives the minimal multiplicative depth ceil(log2(e)). All cached powers are relinearized.
+ *
+ * The evaluator and the relinearization keys must belong to the context of the ciphertext, and
+ * must outlive this object. All powers and temporaries are allocated from the given memory pool.
+*/
+class PowerCache {
+
+	const seal::Evaluator& eval;
+	const seal::RelinKeys& rk;
+	seal::MemoryPoolHandle pool;
+	std::unordered_map<size_t, seal::Ciphertext> powers;
+
+	static size_t split_exponent(size_t exponent) noexcept;
+
+public:
+	PowerCache(const seal::Ciphertext& x, const seal::Evaluator& eval, const seal::RelinKeys& rk, seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool());
+	PowerCache(const PowerCache&) = delete;
+	PowerCache(PowerCache&&) = default;
+	~PowerCache() = default;
+
+	/**
+	 * Returns x^exponent, and computes it and all required lower powers if they are not already cached.
+	 * The returned reference stays valid as long as this object exists.
+	*/
+	const seal::Ciphertext& power(size_t exponent);
+
+	/**
+	 * Same as power(), except that if x^exponent is not cached, the last product is not relinearized
+	 * (and thus not cached either). This is useful if the result is only added to other products,
+	 * which can then be relinearized together.
+	*/
+	void power_unrelinearized(size_t exponent, seal::Ciphertext& destination);
+
+	bool contains(size_t exponent) const;
+	size_t size() const noexcept;
+
+	/**
+	 * The multiplicative depth of x^exponent when computed by this class.
+	*/
+	static size_t depth(size_t exponent) noexcept;
+};
+
+void test_power_cache();
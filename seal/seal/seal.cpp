@@ -8,6 +8,7 @@
 #include "seal/seal.h"
 #include "karatsuba.h"
 #include "bootstrapping.h"
+#include "powercache.h"
 
 using namespace seal;
 using namespace std;
@@ -16,7 +17,7 @@ int main()
 {
 	// set up context
 	EncryptionParameters parms(scheme_type::bfv);
-	std::shared_ptr<SlotRing> slot_ring = p_257_test_parameters();
+	std::shared_ptr<const SlotRing> slot_ring = p_257_test_parameters();
 	SlotRing basic_slot_ring = slot_ring->change_exponent(1);
 	parms.set_poly_modulus_degree(slot_ring->N());
 	parms.set_coeff_modulus(CoeffModulus::BFVDefault(slot_ring->N()));
@@ -61,6 +62,8 @@ int main()
 	std::cout << "setup context" << std::endl;
 
 	Bootstrapper bootstrapper(context, slot_ring, p_257_test_parameters_digit_extractor(*slot_ring));
+	bootstrapper.set_thread_pool(std::make_shared<ThreadPool>());
+	bootstrapper.set_transform_cache_directory("transform_cache");
 	bootstrapper.initialize();
 
 	std::cout << "initialized bootstrapper" << std::endl;
@@ -70,37 +73,30 @@ int main()
 
 	std::cout << "created bootstrapping key" << std::endl;
 
-	auto start = std::chrono::steady_clock::now();
+	std::shared_ptr<BootstrapStats> stats = std::make_shared<BootstrapStats>();
+	stats->set_stage_hook([&decryptor](BootstrapStage stage, const Ciphertext& result) {
+		std::cout << bootstrap_stage_name(stage) << " finished, noise budget is " << decryptor.invariant_noise_budget(result) << " bits" << std::endl;
+	});
+	bootstrapper.set_stats(stats);
 
 	Ciphertext in_coeffs;
 	bootstrapper.slots_to_coeffs(x_enc, bk, in_coeffs, MemoryManager::GetPool() DEBUG_PASS(sk));
-
-	auto end = std::chrono::steady_clock::now();
-	std::cout << "moved to coefficients in " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " ms and " << kswitch_counter << " key-switch operations" << std::endl;
-	kswitch_counter = 0;
-	start = end;
+	stats->set_stage_hook(nullptr);
 
 	Ciphertext noisy_dec;
 	bootstrapper.homomorphic_noisy_decrypt(in_coeffs, bk, noisy_dec, MemoryManager::GetPool() DEBUG_PASS(sk));
 
-	end = std::chrono::steady_clock::now();
-	std::cout << "homomorphically decrypted in " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " ms and " << kswitch_counter << " key-switch operations" << std::endl;
-	start = end;
-	kswitch_counter = 0;
-
 	Ciphertext in_slots;
 	bootstrapper.coeffs_to_slots(noisy_dec, bk, in_slots, MemoryManager::GetPool() DEBUG_PASS(sk));
 
-	end = std::chrono::steady_clock::now();
-	std::cout << "moved to slots in " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " ms and " << kswitch_counter << " key-switch operations" << std::endl;
-	start = end;
-	kswitch_counter = 0;
-
 	Ciphertext digit_extracted;
 	bootstrapper.slotwise_digit_extract(in_slots, bk, digit_extracted, MemoryManager::GetPool() DEBUG_PASS(sk));
 
-	end = std::chrono::steady_clock::now();
-	std::cout << "bootstrapped in " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " ms and " << kswitch_counter << " key-switch operations" << std::endl;
+	for (BootstrapStage stage : { BootstrapStage::slots_to_coeffs, BootstrapStage::noisy_decrypt, BootstrapStage::coeffs_to_slots, BootstrapStage::digit_extract }) {
+		std::cout << bootstrap_stage_name(stage) << " took " << std::chrono::duration_cast<std::chrono::milliseconds>(stats->stage_time(stage)).count() << " ms" << std::endl;
+	}
+	std::cout << stats->key_switch_operations() << " key-switch operations in total" << std::endl;
+	std::cout << stats->to_json() << std::endl;
 
 	Plaintext result;
 	decryptor.decrypt(digit_extracted, result);
@@ -118,15 +114,30 @@ int main()
 	test_compile_slot_basis();
 	test_rotate_noncyclic();
 	test_is_irreducible();
+	test_poly_mul_mod();
 	test_g_automorphisms();
+	test_save_load_slot_ring();
 	test_block_rotate();
 	test_apply_ciphertext();
+	test_hoisted_apply_galois();
+	test_galois_key_plan();
+	test_plain_inner_product();
+	test_thread_pool();
+	test_bootstrap_stats();
+	test_task_graph();
 	//test_apply_ciphertext_subring();
 	//test_compile_pair_transformation();
 	test_slotwise_digit_extract();
 	test_first_coeffs_to_scalar_slots();
+	test_save_load_mapped();
 	test_coeffs_to_slots();
+	test_bootstrap_batch();
+	test_bootstrap_active_slots();
+	test_save_load_bootstrapping_key();
+	test_power_cache();
+	test_slotwise_norm();
 	test_galois_poly_evaluator();
+	test_paterson_stockmeyer_poly_evaluator();
 	test_homomorphic_noisy_decrypt();
 	return 0;
 }
\ No newline at end of file
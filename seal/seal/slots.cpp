@@ -1,16 +1,6 @@
 #include "slots.h"
-
-size_t kswitch_counter = 0;
-
-void log_relin()
-{
-	++kswitch_counter;
-}
-
-void log_galois()
-{
-	++kswitch_counter;
-}
+#include <sstream>
+#include <cstring>
 
 poly SlotRing::SubringView::generator()
 {
@@ -79,7 +69,7 @@ void SlotRing::init_p_log()
 	assert(false);
 }
 
-void SlotRing::init_slot_modulus(poly base_unit_vector)
+void SlotRing::init_unit_vectors(const poly& base_unit_vector)
 {
 	assert(base_unit_vector.size() == N());
 	if (slot_group_cyclic) {
@@ -102,6 +92,10 @@ void SlotRing::init_slot_modulus(poly base_unit_vector)
 			g1_automorphism(current, 1);
 		}
 	}
+}
+
+void SlotRing::init_slot_modulus(poly base_unit_vector)
+{
 	poly f;
 	f.resize(N() + 1);
 	f[0] = 1;
@@ -122,6 +116,77 @@ void SlotRing::init_slot_modulus(poly base_unit_vector)
 	slot_modulus.x_power_n = std::move(factor);
 }
 
+std::shared_ptr<const std::vector<uint32_t>> SlotRing::automorphism_table(uint64_t galois_elt) const
+{
+	{
+		std::unique_lock<std::mutex> lock(automorphism_tables->mutex);
+		auto it = automorphism_tables->tables.find(galois_elt);
+		if (it != automorphism_tables->tables.end()) {
+			return it->second;
+		}
+	}
+	assert(N() < automorphism_negate_flag);
+	std::vector<uint32_t> table;
+	table.resize(N());
+	// target runs through i * galois_elt mod 2N
+	uint64_t target = 0;
+	for (uint64_t i = 0; i < N(); ++i) {
+		if (target < N()) {
+			table[target] = static_cast<uint32_t>(i);
+		}
+		else {
+			table[target - N()] = static_cast<uint32_t>(i) | automorphism_negate_flag;
+		}
+		target = seal::util::add_uint_mod(target, galois_elt, mod_2N);
+	}
+	std::shared_ptr<const std::vector<uint32_t>> result = std::make_shared<const std::vector<uint32_t>>(std::move(table));
+
+	std::unique_lock<std::mutex> lock(automorphism_tables->mutex);
+	if (automorphism_tables->tables.size() < max_cached_automorphism_tables) {
+		// if another thread was faster, this does nothing
+		automorphism_tables->tables.emplace(galois_elt, result);
+	}
+	return result;
+}
+
+void SlotRing::apply_galois(poly& x, uint64_t galois_elt, const seal::Modulus* mod) const
+{
+	assert(x.size() == N());
+	if (galois_elt == 1) {
+		return;
+	}
+	PolyWorkspace::Buffer result = PolyWorkspace::thread_local_workspace().acquire(0);
+	apply_galois(x, *result, galois_elt, mod);
+	x.swap(*result);
+}
+
+void SlotRing::apply_galois(const poly& in, poly& result, uint64_t galois_elt, const seal::Modulus* mod) const
+{
+	if (mod == nullptr) {
+		mod = &mod_pe;
+	}
+	assert(in.size() == N());
+	assert(&in != &result);
+	assert(galois_elt % 2 == 1 && galois_elt < mod_2N.value());
+	if (galois_elt == 1) {
+		result = in;
+		return;
+	}
+	const std::shared_ptr<const std::vector<uint32_t>> table = automorphism_table(galois_elt);
+	const uint32_t* table_data = table->data();
+	const uint64_t* in_data = in.data();
+	const uint64_t modulus = mod->value();
+	result.resize(N());
+	uint64_t* out = result.data();
+	for (size_t j = 0; j < N(); ++j) {
+		const uint32_t entry = table_data[j];
+		const uint64_t value = in_data[entry & ~automorphism_negate_flag];
+		// branchless negation (note that -0 = 0), which allows the compiler to vectorize the loop
+		const uint64_t negate_mask = static_cast<uint64_t>(0) - (static_cast<uint64_t>(entry >> 31) & static_cast<uint64_t>(value != 0));
+		out[j] = value ^ ((value ^ (modulus - value)) & negate_mask);
+	}
+}
+
 void SlotRing::g1_automorphism(poly& x, size_t iters, const seal::Modulus* mod) const
 {
 	if (iters == 0) {
@@ -137,90 +202,12 @@ void SlotRing::g1_automorphism(poly& x, size_t iters, const seal::Modulus* mod)
 	poly initial = x;
 #endif
 
-	unsigned long log_power_2_iters = highest_dividing_power2(iters);
-	uint64_t power_2_iters = (uint64_t)1 << log_power_2_iters;
-	uint64_t odd_iters = iters / power_2_iters;
-
-	seal::util::MultiplyUIntModOperand g_mul;
-	g_mul.set(seal::util::exponentiate_uint_mod(g1, odd_iters, mod_2N), mod_2N);
-	seal::util::MultiplyUIntModOperand step_mul;
-	step_mul.set(seal::util::exponentiate_uint_mod(g1, iters, mod_2N), mod_2N);
-
-	const auto swap_entries = [&](uint64_t fst, uint64_t snd) {
-		bool fst_red = fst >= N();
-		bool snd_red = snd >= N();
-		if (fst_red) {
-			fst -= N();
-		}
-		if (snd_red) {
-			snd -= N();
-		}
-		std::swap(x[fst], x[snd]);
-		if (fst_red != snd_red) {
-			if (fst != snd) {
-				x[fst] = seal::util::negate_uint_mod(x[fst], *mod);
-				x[snd] = seal::util::negate_uint_mod(x[snd], *mod);
-			}
-			else {
-				x[fst] = seal::util::negate_uint_mod(x[fst], *mod);
-			}
-		}
-	};
-
-	for (size_t i = 0; i <= log2N - 2; ++i) {
-		uint64_t base = (size_t)1 << i;
-		// the log of number of entries until the sequence (base * (g1^iters)^i) % N starts repeating
-		int64_t log_step_order;
-		bool has_second_generator;
-		// this strange logic here is because (Z/2Z)* and (Z/4Z)* are cyclic, but afterwards not anymore
-		if (log2N <= i + 3) {
-			log_step_order = log2N - 2 - i - log_power_2_iters;
-			has_second_generator = false;
-		}
-		else {
-			log_step_order = log2N - 3 - i - log_power_2_iters;
-			has_second_generator = true;
-		}
-
-		if (log_step_order <= 0) {
-			// in this case, have that X -> +/- X
-			for (size_t k = 0; k < power_2_iters; ++k) {
-				if ((seal::util::multiply_uint_mod(base, step_mul, mod_2N) >= N()) != (base >= N())) {
-					x[base % N()] = seal::util::negate_uint_mod(x[base % N()], *mod);
-				}
-				if (has_second_generator) {
-					base = seal::util::multiply_uint_mod(base, g2, mod_2N);
-					if ((seal::util::multiply_uint_mod(base, step_mul, mod_2N) >= N()) != (base >= N())) {
-						x[base % N()] = seal::util::negate_uint_mod(x[base % N()], *mod);
-					}
-				}
-				base = seal::util::multiply_uint_mod(base, g_mul, mod_2N);
-			}
-		} else {
-			for (size_t k = 0; k < power_2_iters; ++k) {
-				// otherwise, we cycle through the sequence (base * (g1^iters)^i) % N
-				// and swap/negate coefficients
-				uint64_t current = base;
-				for (size_t j = 0; j < ((size_t)1 << log_step_order); ++j) {
-					current = seal::util::multiply_uint_mod(current, step_mul, mod_2N);
-					swap_entries(base, current);
-				}
-				if (has_second_generator) {
-					base = seal::util::multiply_uint_mod(base, g2, mod_2N);
-					current = base;
-					for (size_t j = 0; j < ((size_t)1 << log_step_order); ++j) {
-						current = seal::util::multiply_uint_mod(current, step_mul, mod_2N);
-						swap_entries(base, current);
-					}
-				}
-				base = seal::util::multiply_uint_mod(base, g_mul, mod_2N);
-			}
-		}
-	}
+	const uint64_t galois_elt = seal::util::exponentiate_uint_mod(g1, iters, mod_2N);
+	apply_galois(x, galois_elt, mod);
 
 #ifdef CONTRACT_TEST
 	for (uint64_t i = 0; i < N(); ++i) {
-		uint64_t index = seal::util::multiply_uint_mod(i, step_mul, mod_2N);
+		uint64_t index = seal::util::multiply_uint_mod(i, galois_elt, mod_2N);
 		if (index < N()) {
 			assert(initial[i] == x[index]);
 		}
@@ -240,24 +227,7 @@ void SlotRing::g2_automorphism(poly& x, const seal::Modulus* mod) const
 	poly initial = x;
 #endif
 
-	assert(x.size() == N());
-	// we heavily use that g2 has order 2 in (Z/2NZ)*
-	uint64_t partner = 0;
-	for (uint64_t base = 0; base < N(); ++base) {
-		assert(base == 0 || base != partner);
-		assert(partner == seal::util::multiply_uint_mod(base, g2, mod_2N));
-		assert(base == seal::util::multiply_uint_mod(partner, g2, mod_2N));
-		if (partner >= N() && partner - N() == base) {
-			x[base] = seal::util::negate_uint_mod(x[base], *mod);
-		} else if (partner >= N() && base < (partner - N())) {
-			std::swap(x[base], x[partner - N()]);
-			x[base] = seal::util::negate_uint_mod(x[base], *mod);
-			x[partner - N()] = seal::util::negate_uint_mod(x[partner - N()], *mod);
-		} else if (partner < N() && base < partner) {
-			std::swap(x[base], x[partner]);
-		}
-		partner = seal::util::add_uint_mod(partner, g2, mod_2N);
-	}
+	apply_galois(x, g2, mod);
 
 #ifdef CONTRACT_TEST
 	for (uint64_t i = 0; i < N(); ++i) {
@@ -274,10 +244,11 @@ void SlotRing::g2_automorphism(poly& x, const seal::Modulus* mod) const
 
 void SlotRing::apply_frobenius(poly& x, size_t iters, const seal::Modulus* mod) const
 {
-	g1_automorphism(x, (iters * std::get<0>(p_log)) % g1_ord(), mod);
+	uint64_t galois_elt = seal::util::exponentiate_uint_mod(g1, (iters * std::get<0>(p_log)) % g1_ord(), mod_2N);
 	if ((iters * std::get<1>(p_log)) % 2 != 0) {
-		g2_automorphism(x);
+		galois_elt = seal::util::multiply_uint_mod(galois_elt, g2, mod_2N);
 	}
+	apply_galois(x, galois_elt, mod);
 }
 
 SlotRing::SlotRing(
@@ -285,9 +256,10 @@ SlotRing::SlotRing(
 	uint64_t p,
 	uint64_t e,
 	uint64_t g2,
-	poly base_unit_vector
+	poly base_unit_vector,
+	PolyModulus slot_modulus
 ) :
-	log2N(log2N), p(p), e(e), mod_pe(seal::util::exponentiate_uint(p, e)), mod_2N((uint64_t)1 << log2N), g1(3), g2(g2), mod_2N_cyclotomic()
+	log2N(log2N), p(p), e(e), mod_pe(seal::util::exponentiate_uint(p, e)), mod_2N((uint64_t)1 << log2N), g1(3), g2(g2), mod_2N_cyclotomic(), slot_modulus(std::move(slot_modulus)), automorphism_tables(std::make_shared<AutomorphismTables>())
 {
 	mod_2N_cyclotomic.n = N();
 	mod_2N_cyclotomic.x_power_n = { seal::util::negate_uint_mod(1, mod_pe) };
@@ -302,15 +274,30 @@ SlotRing::SlotRing(
 
 	// currently, we assume that base_unit_vector is a polynomial in X^(d/2)
 	assert(is_poly_sparse(base_unit_vector, d / 2));
-	init_slot_modulus(std::move(base_unit_vector));
+	init_unit_vectors(base_unit_vector);
+	if (this->slot_modulus.n == 0) {
+		init_slot_modulus(std::move(base_unit_vector));
+	}
+	else if (this->slot_modulus.n != d) {
+		throw std::invalid_argument("Slot modulus does not match the slot rank");
+	}
 }
 
+SlotRing::SlotRing(
+	uint64_t log2N,
+	uint64_t p,
+	uint64_t e,
+	uint64_t g2,
+	poly base_unit_vector
+) : SlotRing(log2N, p, e, g2, std::move(base_unit_vector), PolyModulus{ {}, 0 })
+{}
+
 SlotRing::SlotRing(
 	uint64_t log2N,
 	uint64_t p,
 	uint64_t e,
 	poly base_unit_vector
-) : SlotRing(log2N, p, e, ((uint64_t)1 << (log2N - 1)) - 1, base_unit_vector)
+) : SlotRing(log2N, p, e, ((uint64_t)1 << (log2N - 1)) - 1, std::move(base_unit_vector))
 {}
 
 poly SlotRing::extract_slot_value(poly x, size_t slot) const
@@ -357,6 +344,30 @@ poly SlotRing::from_slot_value(const poly& x, size_t slot) const
 	return result;
 }
 
+poly SlotRing::from_slot_value_in_all_slots(const poly& x) const
+{
+	const poly base = poly_mul_mod(x, unit_vectors[0], mod_pe, mod_2N_cyclotomic);
+	poly result;
+	result.resize(N());
+	PolyWorkspace::Buffer current = PolyWorkspace::thread_local_workspace().acquire(0);
+	// same automorphisms as in from_slot_value()
+	for (size_t slot = 0; slot < n; ++slot) {
+		uint64_t galois_elt;
+		if (slot_group_cyclic) {
+			galois_elt = seal::util::exponentiate_uint_mod(g1, slot % g1_ord(), mod_2N);
+		}
+		else {
+			galois_elt = seal::util::exponentiate_uint_mod(g1, slot % (n / 2), mod_2N);
+			if (slot >= n / 2) {
+				galois_elt = seal::util::multiply_uint_mod(galois_elt, g2, mod_2N);
+			}
+		}
+		apply_galois(base, *current, galois_elt);
+		poly_add(result, *current, mod_pe);
+	}
+	return result;
+}
+
 const poly& SlotRing::slot_one(size_t slot) const noexcept
 {
 	return unit_vectors[slot % n];
@@ -411,8 +422,18 @@ SlotRing SlotRing::power_x_subring(size_t index_log2) const
 		}
 	}
 	uint64_t new_index_modulus = (uint64_t)1 << (log2N - index_log2);
-	SlotRing result(log2N - index_log2, p, e, g2 % new_index_modulus, std::move(new_base_unit_vector));
 
+	// if the slot modulus is a polynomial F(X^index) and the slot rank decreases by index, the slot modulus of the subring is F
+	PolyModulus new_slot_modulus{ {}, 0 };
+	if (d % index == 0 && is_poly_sparse(slot_modulus.x_power_n, index) && order_mod_2N(p, seal::Modulus(new_index_modulus)) == d / index) {
+		new_slot_modulus.n = d / index;
+		for (size_t i = 0; i < slot_modulus.x_power_n.size(); i += index) {
+			new_slot_modulus.x_power_n.push_back(slot_modulus.x_power_n[i]);
+		}
+	}
+	SlotRing result(log2N - index_log2, p, e, g2 % new_index_modulus, std::move(new_base_unit_vector), std::move(new_slot_modulus));
+
+#ifdef CONTRACT_TEST
 	poly check1;
 	poly tmp = unit_vectors[0];
 	g2_automorphism(tmp);
@@ -420,6 +441,7 @@ SlotRing SlotRing::power_x_subring(size_t index_log2) const
 	poly check2 = result.unit_vectors[0];
 	result.g2_automorphism(check2);
 	assert(check1 == check2);
+#endif
 
 	return result;
 }
@@ -460,13 +482,203 @@ SlotRing SlotRing::change_exponent(uint64_t new_exp) const
 	for (uint64_t x : unit_vectors[0]) {
 		new_base_unit_vector.push_back(mod_new.reduce(x));
 	}
-	SlotRing result(log2N, p, new_exp, std::move(new_base_unit_vector));
+	// the slot modulus is a monic factor of X^N + 1 modulo p^e, so its reduction is the corresponding factor modulo p^new_exp
+	PolyModulus new_slot_modulus{ {}, d };
+	for (uint64_t x : slot_modulus.x_power_n) {
+		new_slot_modulus.x_power_n.push_back(mod_new.reduce(x));
+	}
+	poly_normalize(new_slot_modulus.x_power_n);
+	SlotRing result(log2N, p, new_exp, ((uint64_t)1 << (log2N - 1)) - 1, std::move(new_base_unit_vector), std::move(new_slot_modulus));
 	assert(result.d == d);
 	assert(result.n == n);
 	assert(result.p_log == p_log);
 	return result;
 }
 
+namespace {
+
+	constexpr uint64_t slot_ring_magic = 0x474e4952544f4c53; // "SLOTRING" in little endian
+	constexpr uint64_t slot_ring_version = 1;
+	constexpr size_t slot_ring_header_len = 8;
+
+	enum SlotRingHeader {
+		slot_ring_header_magic = 0, slot_ring_header_version, slot_ring_header_log2n, slot_ring_header_prime, slot_ring_header_exponent, slot_ring_header_g2, slot_ring_header_slot_rank, slot_ring_header_slot_modulus_len
+	};
+
+	struct SlotRingRegistry {
+		std::mutex mutex;
+		// keyed by the parameter hash; equal rings are found by comparing the parameters
+		std::unordered_multimap<uint64_t, std::shared_ptr<const SlotRing>> rings;
+	};
+
+	SlotRingRegistry& slot_ring_registry()
+	{
+		static SlotRingRegistry registry;
+		return registry;
+	}
+
+	uint64_t hash_slot_ring_parameters(uint64_t log2N, uint64_t p, uint64_t e, uint64_t g2, const poly& base_unit_vector)
+	{
+		// FNV-1a
+		uint64_t result = 0xcbf29ce484222325;
+		const auto add = [&result](uint64_t value) {
+			for (size_t i = 0; i < sizeof(uint64_t); ++i) {
+				result ^= (value >> (8 * i)) & 0xFF;
+				result *= 0x100000001b3;
+			}
+		};
+		add(log2N);
+		add(p);
+		add(e);
+		add(g2);
+		for (uint64_t c : base_unit_vector) {
+			add(c);
+		}
+		return result;
+	}
+}
+
+uint64_t SlotRing::parameter_hash() const
+{
+	return hash_slot_ring_parameters(log2N, p, e, g2, unit_vectors[0]);
+}
+
+void SlotRing::save(std::ostream& stream) const
+{
+	uint64_t header[slot_ring_header_len] = { 0 };
+	header[slot_ring_header_magic] = slot_ring_magic;
+	header[slot_ring_header_version] = slot_ring_version;
+	header[slot_ring_header_log2n] = log2N;
+	header[slot_ring_header_prime] = p;
+	header[slot_ring_header_exponent] = e;
+	header[slot_ring_header_g2] = g2;
+	header[slot_ring_header_slot_rank] = slot_modulus.n;
+	header[slot_ring_header_slot_modulus_len] = slot_modulus.x_power_n.size();
+	stream.write(reinterpret_cast<const char*>(header), sizeof(header));
+	stream.write(reinterpret_cast<const char*>(unit_vectors[0].data()), unit_vectors[0].size() * sizeof(uint64_t));
+	stream.write(reinterpret_cast<const char*>(slot_modulus.x_power_n.data()), slot_modulus.x_power_n.size() * sizeof(uint64_t));
+	if (stream.fail()) {
+		throw std::runtime_error("Failed to write slot ring");
+	}
+}
+
+std::shared_ptr<const SlotRing> SlotRing::load(std::istream& stream)
+{
+	uint64_t header[slot_ring_header_len];
+	stream.read(reinterpret_cast<char*>(header), sizeof(header));
+	if (stream.fail() || header[slot_ring_header_magic] != slot_ring_magic || header[slot_ring_header_version] != slot_ring_version) {
+		throw std::invalid_argument("Not a slot ring or wrong version");
+	}
+	const uint64_t log2N = header[slot_ring_header_log2n];
+	const uint64_t p = header[slot_ring_header_prime];
+	const uint64_t e = header[slot_ring_header_exponent];
+	const uint64_t g2 = header[slot_ring_header_g2];
+	if (log2N < 2 || log2N > 32 || p < 2 || e == 0 || g2 % 2 == 0 || g2 >= ((uint64_t)1 << log2N) || 
+		header[slot_ring_header_slot_rank] == 0 || header[slot_ring_header_slot_rank] >= ((uint64_t)1 << log2N) ||
+		header[slot_ring_header_slot_modulus_len] > header[slot_ring_header_slot_rank])
+	{
+		throw std::invalid_argument("Invalid slot ring header");
+	}
+	poly base_unit_vector((uint64_t)1 << (log2N - 1));
+	stream.read(reinterpret_cast<char*>(base_unit_vector.data()), base_unit_vector.size() * sizeof(uint64_t));
+	PolyModulus slot_modulus{ poly(header[slot_ring_header_slot_modulus_len]), header[slot_ring_header_slot_rank] };
+	stream.read(reinterpret_cast<char*>(slot_modulus.x_power_n.data()), slot_modulus.x_power_n.size() * sizeof(uint64_t));
+	if (stream.fail()) {
+		throw std::invalid_argument("Slot ring is truncated");
+	}
+	//tex:
+	//The slot modulus is not part of the registry key, so check that it is the factor $f = \gcd(e_0 - 1, X^N + 1)$ of the
+	//first slot. Since the factors of $X^N + 1$ modulo $p^e$ are coprime, this holds for the monic $f$ of degree $d$ iff
+	//$f$ divides both $X^N + 1$ and $e_0 - 1$; in particular, it then equals the slot modulus of a registered ring.
+	const seal::Modulus mod_pe(seal::util::exponentiate_uint(p, e));
+	for (uint64_t c : slot_modulus.x_power_n) {
+		if (c >= mod_pe.value()) {
+			throw std::invalid_argument("Invalid slot modulus");
+		}
+	}
+	poly cyclotomic(base_unit_vector.size() + 1);
+	cyclotomic[0] = 1;
+	cyclotomic[base_unit_vector.size()] = 1;
+	poly_reduce_mod(cyclotomic, mod_pe, slot_modulus);
+	poly unit_vector_residue = base_unit_vector;
+	unit_vector_residue[0] = seal::util::sub_uint_mod(mod_pe.reduce(unit_vector_residue[0]), 1, mod_pe);
+	poly_reduce_mod(unit_vector_residue, mod_pe, slot_modulus);
+	if (!is_zero(cyclotomic) || !is_zero(unit_vector_residue)) {
+		throw std::invalid_argument("Slot modulus is not the factor of the first slot");
+	}
+	return find_or_create_shared(log2N, p, e, g2, base_unit_vector, [&]() {
+		return SlotRing(log2N, p, e, g2, base_unit_vector, std::move(slot_modulus));
+	});
+}
+
+std::shared_ptr<const SlotRing> SlotRing::find_or_create_shared(uint64_t log2N, uint64_t p, uint64_t e, uint64_t g2, const poly& base_unit_vector, const std::function<SlotRing()>& create)
+{
+	SlotRingRegistry& registry = slot_ring_registry();
+	const uint64_t hash = hash_slot_ring_parameters(log2N, p, e, g2, base_unit_vector);
+	const auto find = [&]() -> std::shared_ptr<const SlotRing> {
+		const auto [begin, end] = registry.rings.equal_range(hash);
+		for (auto it = begin; it != end; ++it) {
+			const std::shared_ptr<const SlotRing>& ring = it->second;
+			if (ring->log2N == log2N && ring->p == p && ring->e == e && ring->g2 == g2 && ring->unit_vectors[0] == base_unit_vector) {
+				return ring;
+			}
+		}
+		return nullptr;
+	};
+	{
+		std::unique_lock<std::mutex> lock(registry.mutex);
+		std::shared_ptr<const SlotRing> existing = find();
+		if (existing != nullptr) {
+			return existing;
+		}
+	}
+	// construct without holding the lock, as this may take some time
+	std::shared_ptr<const SlotRing> result = std::make_shared<const SlotRing>(create());
+
+	std::unique_lock<std::mutex> lock(registry.mutex);
+	// if another thread was faster, use its instance
+	std::shared_ptr<const SlotRing> existing = find();
+	if (existing != nullptr) {
+		return existing;
+	}
+	registry.rings.emplace(hash, result);
+	return result;
+}
+
+std::shared_ptr<const SlotRing> SlotRing::create_shared(uint64_t log2N, uint64_t p, uint64_t e, poly base_unit_vector)
+{
+	const uint64_t g2 = ((uint64_t)1 << (log2N - 1)) - 1;
+	return find_or_create_shared(log2N, p, e, g2, base_unit_vector, [&]() {
+		return SlotRing(log2N, p, e, g2, base_unit_vector);
+	});
+}
+
+std::shared_ptr<const SlotRing> SlotRing::shared_power_x_subring(size_t index_log2) const
+{
+	const size_t index = (size_t)1 << index_log2;
+	poly new_base_unit_vector;
+	new_base_unit_vector.resize(unit_vectors[0].size() / index);
+	for (size_t i = 0; i < new_base_unit_vector.size(); ++i) {
+		new_base_unit_vector[i] = unit_vectors[0][i * index];
+	}
+	const uint64_t new_index_modulus = (uint64_t)1 << (log2N - index_log2);
+	return find_or_create_shared(log2N - index_log2, p, e, g2 % new_index_modulus, new_base_unit_vector, [&]() {
+		return power_x_subring(index_log2);
+	});
+}
+
+std::shared_ptr<const SlotRing> SlotRing::shared_change_exponent(uint64_t new_exp) const
+{
+	seal::Modulus mod_new(seal::util::exponentiate_uint(p, new_exp));
+	poly new_base_unit_vector;
+	for (uint64_t x : unit_vectors[0]) {
+		new_base_unit_vector.push_back(mod_new.reduce(x));
+	}
+	return find_or_create_shared(log2N, p, new_exp, ((uint64_t)1 << (log2N - 1)) - 1, new_base_unit_vector, [&]() {
+		return change_exponent(new_exp);
+	});
+}
+
 SlotRing::Rotation SlotRing::block_rotate(size_t slot, size_t block_size) const
 {
 	assert(slot_group_len() % block_size == 0);
@@ -496,7 +708,7 @@ SlotRing::Rotation SlotRing::block_rotate(size_t slot, size_t block_size) const
 	return result;
 }
 
-std::shared_ptr<SlotRing> small_test_parameters() {
+std::shared_ptr<const SlotRing> small_test_parameters() {
 	poly unit_vector;
 	unit_vector.resize(512);
 	auto values = { 1, 124, 4, 120, 11, 109, 29, 80, 76, 4, 72, 59, 13, 46, 94, 79, 15, 64, 78, 113, 92, 21, 71, 77, 121, 83, 38, 45, 120, 52, 68, 111, 84, 27, 57, 97, 87, 10, 77, 60, 17, 43, 101, 69, 32, 37, 122, 42, 80, 89, 118, 98, 20, 78, 69, 9, 60, 76, 111, 92, 19, 73, 73, 0, 73, 54, 19, 35, 111, 51, 60, 118, 69, 49, 20, 29, 118, 38, 80, 85, 122, 90, 32, 58, 101, 84, 17, 67, 77, 117, 87, 30, 57, 100, 84, 16, 68, 75, 120, 82, 38, 44, 121, 50, 71, 106, 92, 14, 78, 63, 15, 48, 94, 81, 13, 68, 72, 123, 76, 47, 29, 18, 11, 7, 4, 3, 1, 2 };
@@ -505,10 +717,10 @@ std::shared_ptr<SlotRing> small_test_parameters() {
 		--it;
 		unit_vector[4 * i] = *it;
 	}
-	return std::make_shared<SlotRing>(10, 127, 1, std::move(unit_vector));
+	return SlotRing::create_shared(10, 127, 1, std::move(unit_vector));
 }
 
-std::shared_ptr<SlotRing> small_p_257_test_parameters() {
+std::shared_ptr<const SlotRing> small_p_257_test_parameters() {
 	poly unit_vector;
 	unit_vector.resize(512);
 	auto values = { 142, 59, 77, 70, 87, 9, 125, 137, 218, 58, 6, 169, 177, 231, 210, 4, 27, 118, 154, 140, 174, 18, 250, 17, 179, 116, 12, 81, 97, 205, 163, 8, 54, 236, 51, 23, 91, 36, 243, 34, 101, 232, 24, 162, 194, 153, 69, 16, 108, 215, 102, 46, 182, 72, 229, 68, 202, 207, 48, 67, 131, 49, 138, 32, 216, 173, 204, 92, 107, 144, 201, 136, 147, 157, 96, 134, 5, 98, 19, 64, 175, 89, 151, 184, 214, 31, 145, 15, 37, 57, 192, 11, 10, 196, 38, 128, 93, 178, 45, 111, 171, 62, 33, 30, 74, 114, 127, 22, 20, 135, 76, 256, 186, 99, 90, 222, 85, 124, 66, 60, 148, 228, 254, 44, 40, 13, 152, 255 };
@@ -517,10 +729,10 @@ std::shared_ptr<SlotRing> small_p_257_test_parameters() {
 		--it;
 		unit_vector[4 * i] = *it;
 	}
-	return std::make_shared<SlotRing>(10, 257, 1, std::move(unit_vector));
+	return SlotRing::create_shared(10, 257, 1, std::move(unit_vector));
 }
 
-std::shared_ptr<SlotRing> p_127_test_parameters() {
+std::shared_ptr<const SlotRing> p_127_test_parameters() {
 	auto coefficients = { 1993024, 240875, 1207593, 404466, 20647, 348018, 811998, 401243, 1072206, 620779, 953549, 755478, 795511, 145718, 598024, 1753912, 1101795, 1868445, 1456233, 2048122, 1712610, 1283514, 1465554, 1560331, 67929, 1866101, 1288626, 1400697, 1138076, 534561, 784782, 480838, 1522444, 840918, 927040, 291915, 532443, 394526, 680455, 1554433, 1544666, 593498, 1618356, 1931381, 1791404, 1865968, 788282, 822881, 1782322, 190115, 1837873, 1709323, 1712134, 1718364, 451719, 239328, 644360, 1208324, 278256, 1940492, 1672965, 2046996, 1599175, 1599175, 1387, 1672965, 107891, 278256, 840059, 644360, 1809055, 451719, 330019, 1712134, 339060, 1837873, 1858268, 1782322, 1225502, 788282, 182415, 1791404, 117002, 1618356, 1454885, 1544666, 493950, 680455, 1653857, 532443, 1756468, 927040, 1207465, 1522444, 1567545, 784782, 1513822, 1138076, 647686, 1288626, 182282, 67929, 488052, 1465554, 764869, 1712610, 261, 1456233, 179938, 1101795, 294471, 598024, 1902665, 795511, 1292905, 953549, 1427604, 1072206, 1647140, 811998, 1700365, 20647, 1643917, 1207593, 1807508, 1993024, 32006 };
 	auto indices = { 32512, 32256, 32000, 31744, 31488, 31232, 30976, 30720, 30464, 30208, 29952, 29696, 29440, 29184, 28928, 28672, 28416, 28160, 27904, 27648, 27392, 27136, 26880, 26624, 26368, 26112, 25856, 25600, 25344, 25088, 24832, 24576, 24320, 24064, 23808, 23552, 23296, 23040, 22784, 22528, 22272, 22016, 21760, 21504, 21248, 20992, 20736, 20480, 20224, 19968, 19712, 19456, 19200, 18944, 18688, 18432, 18176, 17920, 17664, 17408, 17152, 16896, 16640, 16128, 15872, 15616, 15360, 15104, 14848, 14592, 14336, 14080, 13824, 13568, 13312, 13056, 12800, 12544, 12288, 12032, 11776, 11520, 11264, 11008, 10752, 10496, 10240, 9984, 9728, 9472, 9216, 8960, 8704, 8448, 8192, 7936, 7680, 7424, 7168, 6912, 6656, 6400, 6144, 5888, 5632, 5376, 5120, 4864, 4608, 4352, 4096, 3840, 3584, 3328, 3072, 2816, 2560, 2304, 2048, 1792, 1536, 1280, 1024, 768, 512, 256, 0 };
 	poly unit_vector;
@@ -530,10 +742,10 @@ std::shared_ptr<SlotRing> p_127_test_parameters() {
 	for (; index_it != indices.end(); ++index_it, ++coeff_it) {
 		unit_vector[*index_it] = *coeff_it;
 	}
-	return std::make_shared<SlotRing>(16, 127, 3, std::move(unit_vector));
+	return SlotRing::create_shared(16, 127, 3, std::move(unit_vector));
 }
 
-std::shared_ptr<SlotRing> p_257_test_parameters()
+std::shared_ptr<const SlotRing> p_257_test_parameters()
 {
 	std::initializer_list<uint64_t> coefficients = { 7964572, 6261607, 16240935, 102099, 8906165, 9188787, 6652056, 6514830, 13560566, 4058859, 6803824, 2637246, 14964259, 8700452, 13885406, 12517446, 3289884, 7193548, 14438928, 14310157, 5483269, 14464749, 7681466, 12493558, 15081196, 16410594, 12121931, 2032437, 14600010, 10166868, 4700179, 13476574, 983850, 9275880, 13267162, 16806538, 13190359, 11592792, 7816384, 14932248, 13347910, 5088061, 14931724, 5704791, 15187352, 16367455, 12927940, 16583969, 13166475, 2450967, 2314130, 14807101, 16693874, 3439246, 7937160, 8764025, 7597636, 1868854, 15532357, 13962877, 1688878, 11856744, 13426589, 3975308, 8638757, 11867405, 4139446, 1645406, 2719681, 14214557, 15278080, 7294824, 6060464, 13542772, 10988902, 14604673, 12583496, 6989727, 13949465, 555184, 3553200, 14152308, 1356854, 588714, 6387435, 961982, 8029853, 7134849, 1050653, 14661907, 15973513, 16635621, 6987326, 13622481, 9026649, 3426195, 6011323, 13036503, 10929998, 396662, 3442686, 15482513, 13212403, 8408813, 11334031, 8307382, 3360145, 2311480, 6280586, 7839149, 11153619, 11748240, 11615815, 3330562, 14514936, 8478652, 16688123, 8347227, 3293264, 6218689, 2032504, 16192770, 1262895, 15951777, 3579793, 7381310, 2299274, 16841979 };
 	auto indices = { 32512, 32256, 32000, 31744, 31488, 31232, 30976, 30720, 30464, 30208, 29952, 29696, 29440, 29184, 28928, 28672, 28416, 28160, 27904, 27648, 27392, 27136, 26880, 26624, 26368, 26112, 25856, 25600, 25344, 25088, 24832, 24576, 24320, 24064, 23808, 23552, 23296, 23040, 22784, 22528, 22272, 22016, 21760, 21504, 21248, 20992, 20736, 20480, 20224, 19968, 19712, 19456, 19200, 18944, 18688, 18432, 18176, 17920, 17664, 17408, 17152, 16896, 16640, 16384, 16128, 15872, 15616, 15360, 15104, 14848, 14592, 14336, 14080, 13824, 13568, 13312, 13056, 12800, 12544, 12288, 12032, 11776, 11520, 11264, 11008, 10752, 10496, 10240, 9984, 9728, 9472, 9216, 8960, 8704, 8448, 8192, 7936, 7680, 7424, 7168, 6912, 6656, 6400, 6144, 5888, 5632, 5376, 5120, 4864, 4608, 4352, 4096, 3840, 3584, 3328, 3072, 2816, 2560, 2304, 2048, 1792, 1536, 1280, 1024, 768, 512, 256, 0 };
@@ -544,7 +756,7 @@ std::shared_ptr<SlotRing> p_257_test_parameters()
 	for (; index_it != indices.end(); ++index_it, ++coeff_it) {
 		unit_vector[*index_it] = *coeff_it;
 	}
-	return std::make_shared<SlotRing>(SlotRing(16, 257, 3, std::move(unit_vector)).change_exponent(2));
+	return SlotRing::create_shared(16, 257, 3, std::move(unit_vector))->shared_change_exponent(2);
 }
 
 void test_g_automorphisms() {
@@ -596,9 +808,81 @@ void test_g_automorphisms() {
 	r.g1_automorphism(p, 3 * 4);
 	assert(expected == p);
 
+	// applying g1 and g2 separately must give the same as a single combined automorphism
+	p.clear();
+	p.resize(512);
+	for (size_t i = 0; i < p.size(); ++i) {
+		p[i] = (i * i + 3) % 127;
+	}
+	expected = p;
+	r.g1_automorphism(expected, 5);
+	r.g2_automorphism(expected);
+	r.raw_auto(5, 1)(p).swap(p);
+	assert(expected == p);
+
 	std::cout << "test_g_automorphisms(): success" << std::endl;
 }
 
+void test_save_load_slot_ring()
+{
+	std::shared_ptr<const SlotRing> slot_ring = small_test_parameters();
+	assert(small_test_parameters() == slot_ring);
+	assert(slot_ring->shared_power_x_subring(1) == slot_ring->shared_power_x_subring(1));
+
+	// the slot modulus derived by power_x_subring() and change_exponent() must match the computed one
+	SlotRing subring = slot_ring->power_x_subring(1);
+	SlotRing computed_subring(subring.log2N, subring.p, subring.e, subring.g2, subring.unit_vectors[0]);
+	assert(subring.slot_modulus.n == computed_subring.slot_modulus.n && subring.slot_modulus.x_power_n == computed_subring.slot_modulus.x_power_n);
+
+	std::shared_ptr<const SlotRing> large_slot_ring = p_127_test_parameters();
+	SlotRing lower_exponent = large_slot_ring->change_exponent(2);
+	SlotRing computed_lower_exponent(lower_exponent.log2N, lower_exponent.p, lower_exponent.e, lower_exponent.unit_vectors[0]);
+	assert(lower_exponent.slot_modulus.x_power_n == computed_lower_exponent.slot_modulus.x_power_n);
+
+	std::stringstream stream;
+	subring.save(stream);
+	std::shared_ptr<const SlotRing> loaded = SlotRing::load(stream);
+	assert(loaded->parameter_hash() == subring.parameter_hash());
+	assert(loaded->slot_modulus.x_power_n == subring.slot_modulus.x_power_n);
+	for (size_t i = 0; i < subring.slot_group_len(); ++i) {
+		assert(loaded->slot_one(i) == subring.slot_one(i));
+	}
+
+	// the ring is registered now, but a different slot modulus must still be rejected
+	std::string tampered = stream.str();
+	uint64_t last_coefficient;
+	memcpy(&last_coefficient, tampered.data() + tampered.size() - sizeof(uint64_t), sizeof(uint64_t));
+	last_coefficient = (last_coefficient + 1) % seal::util::exponentiate_uint(subring.p, subring.e);
+	memcpy(tampered.data() + tampered.size() - sizeof(uint64_t), &last_coefficient, sizeof(uint64_t));
+	bool has_thrown_on_modulus = false;
+	try {
+		std::stringstream tampered_stream(tampered);
+		SlotRing::load(tampered_stream);
+	}
+	catch (const std::invalid_argument&) {
+		has_thrown_on_modulus = true;
+	}
+	assert(has_thrown_on_modulus);
+
+	poly value = { 1, 2, 3 };
+	poly expected;
+	for (size_t i = 0; i < slot_ring->slot_group_len(); ++i) {
+		poly_add(expected, slot_ring->from_slot_value(value, i), slot_ring->R().scalar_mod);
+	}
+	assert(slot_ring->from_slot_value_in_all_slots(value) == expected);
+
+	bool has_thrown = false;
+	try {
+		std::stringstream invalid("not a slot ring");
+		SlotRing::load(invalid);
+	}
+	catch (const std::invalid_argument&) {
+		has_thrown = true;
+	}
+	assert(has_thrown);
+	std::cout << "test_save_load_slot_ring(): success" << std::endl;
+}
+
 void test_block_rotate()
 {
 	using namespace seal;
@@ -648,6 +932,29 @@ void test_block_rotate()
 	assert(rot(a) == expected);
 	assert(result_poly == expected);
 
+	rot.precompute(context, context.first_parms_id());
+	rot.apply_ciphertext(x_enc, evaluator, gk, result_enc);
+	decryptor.decrypt(result_enc, result);
+	result_poly = poly(result.data(), result.data() + slot_ring.N());
+	assert(result_poly == expected);
+
+	for (bool precomputed : { true, false }) {
+		SlotRing::Rotation hoisted_rot = slot_ring.block_rotate(3, 32);
+		if (precomputed) {
+			hoisted_rot.precompute(context, context.first_parms_id());
+		}
+		HoistedCiphertext hoisted(x_enc, context);
+		hoisted_rot.apply_ciphertext(hoisted, evaluator, gk, result_enc);
+		decryptor.decrypt(result_enc, result);
+		result_poly = poly(result.data(), result.data() + slot_ring.N());
+		assert(result_poly == expected);
+	}
+
+	SlotRing::Rotation next = slot_ring.block_rotate(30, 32);
+	SlotRing::Rotation merged = rot.followed_by(next);
+	assert(merged(a) == next(rot(a)));
+	assert(merged.galois_elements() == slot_ring.block_rotate(1, 32).galois_elements());
+
 	std::cout << "test_block_rotate(): success" << std::endl;
 }
 
@@ -735,26 +1042,54 @@ size_t SlotRing::Rotation::effective_block_size() const
 }
 
 poly SlotRing::Rotation::operator()(const poly& x) const
+{
+	poly result;
+	(*this)(x, result, PolyWorkspace::thread_local_workspace());
+	return result;
+}
+
+void SlotRing::Rotation::operator()(const poly& x, poly& result, PolyWorkspace& workspace) const
 {
 	if (s == 0) {
-		return x;
+		result = x;
+		return;
 	}
-	poly a = poly_mul_mod(x, fmask, slot_ring.mod_pe, slot_ring.mod_2N_cyclotomic);
-	poly b = poly_mul_mod(x, bmask, slot_ring.mod_pe, slot_ring.mod_2N_cyclotomic);
-	assert(b.size() == slot_ring.N());
-	slot_ring.g1_automorphism(a, s % effective_block_size());
-	slot_ring.g1_automorphism(b, slot_ring.g1_ord() + s % effective_block_size() - effective_block_size());
+	PolyWorkspace::Buffer a = workspace.acquire(0);
+	PolyWorkspace::Buffer b = workspace.acquire(0);
+	poly_mul_mod(x, fmask, slot_ring.mod_pe, slot_ring.mod_2N_cyclotomic, *a, workspace);
+	poly_mul_mod(x, bmask, slot_ring.mod_pe, slot_ring.mod_2N_cyclotomic, *b, workspace);
+	assert(b->size() == slot_ring.N());
+	slot_ring.g1_automorphism(*a, s % effective_block_size());
+	slot_ring.g1_automorphism(*b, slot_ring.g1_ord() + s % effective_block_size() - effective_block_size());
 	if (block_size == slot_ring.n && !slot_ring.slot_group_cyclic) {
-		slot_ring.g2_automorphism(b);
+		slot_ring.g2_automorphism(*b);
 	}
-	poly_add(a, b, slot_ring.mod_pe);
+	poly_add(*a, *b, slot_ring.mod_pe);
 	if (s >= effective_block_size()) {
-		slot_ring.g2_automorphism(a);
+		slot_ring.g2_automorphism(*a);
 	}
-	return a;
+	result.swap(*a);
 }
 
-void SlotRing::Rotation::apply_ciphertext(const seal::Ciphertext& in, const seal::Evaluator& eval, const seal::GaloisKeys& gk, seal::Ciphertext& result) const
+void SlotRing::Rotation::precompute(const seal::SEALContext& context, seal::parms_id_type parms_id)
+{
+	lifted_fmask = std::make_shared<LiftedPlaintext>(seal::Plaintext(gsl::span(fmask)), context, parms_id);
+	lifted_bmask = std::make_shared<LiftedPlaintext>(seal::Plaintext(gsl::span(bmask)), context, parms_id);
+	const auto [forward_elt, backward_elt] = galois_elements();
+	lifted_automorphed_fmask = std::make_shared<LiftedPlaintext>(seal::Plaintext(gsl::span(automorphed_mask(fmask, forward_elt))), context, parms_id);
+	lifted_automorphed_bmask = std::make_shared<LiftedPlaintext>(seal::Plaintext(gsl::span(automorphed_mask(bmask, backward_elt))), context, parms_id);
+	lifted_context = &context;
+}
+
+poly SlotRing::Rotation::automorphed_mask(const poly& mask, uint32_t galois_elt) const
+{
+	poly result = mask;
+	result.resize(slot_ring.N());
+	slot_ring.apply_galois(result, galois_elt);
+	return result;
+}
+
+void SlotRing::Rotation::apply_ciphertext(const seal::Ciphertext& in, const seal::Evaluator& eval, const seal::GaloisKeys& gk, seal::Ciphertext& result, seal::MemoryPoolHandle pool) const
 {
 	if (&in == &result) {
 		throw std::invalid_argument("This function does not accept the same reference for in and result.");
@@ -765,21 +1100,69 @@ void SlotRing::Rotation::apply_ciphertext(const seal::Ciphertext& in, const seal
 	}
 	if (s == effective_block_size()) {
 		result = in;
-		eval.apply_galois_inplace(result, static_cast<uint32_t>(std::get<0>(galois_elements())), gk);
+		apply_galois_composed_inplace(eval, result, static_cast<uint32_t>(std::get<0>(galois_elements())), gk, pool);
 		return;
 	}
-	if (fmask_plain == nullptr) {
-		fmask_plain = std::make_unique<seal::Plaintext>(gsl::span(fmask));
-		bmask_plain = std::make_unique<seal::Plaintext>(gsl::span(bmask));
+	seal::Ciphertext backward(pool);
+	if (lifted_fmask != nullptr && lifted_fmask->parms_id() == in.parms_id()) {
+		seal::Ciphertext in_ntt(in, pool);
+		transform_to_ntt_inplace(in_ntt, *lifted_context);
+		PlainInnerProduct product(*lifted_context, in.parms_id(), pool);
+		product.add_product(in_ntt, *lifted_fmask); log_multiply_plain();
+		product.finish(result);
+		product.add_product(in_ntt, *lifted_bmask); log_multiply_plain();
+		product.finish(backward);
+	}
+	else {
+		eval.multiply_plain(in, seal::Plaintext(gsl::span(fmask), pool), result, pool); log_multiply_plain();
+		eval.multiply_plain(in, seal::Plaintext(gsl::span(bmask), pool), backward, pool); log_multiply_plain();
 	}
-	seal::Ciphertext backward;
-	eval.multiply_plain(in, *fmask_plain, result);
-	eval.multiply_plain(in, *bmask_plain, backward);
-	eval.apply_galois_inplace(result, static_cast<uint32_t>(std::get<0>(galois_elements())), gk); log_galois();
-	eval.apply_galois_inplace(backward, static_cast<uint32_t>(std::get<1>(galois_elements())), gk); log_galois();
+	apply_galois_composed_inplace(eval, result, static_cast<uint32_t>(std::get<0>(galois_elements())), gk, pool); log_galois();
+	apply_galois_composed_inplace(eval, backward, static_cast<uint32_t>(std::get<1>(galois_elements())), gk, pool); log_galois();
 	eval.add_inplace(result, backward);
 }
 
+void SlotRing::Rotation::apply_ciphertext(const HoistedCiphertext& in, const seal::Evaluator& eval, const seal::GaloisKeys& gk, seal::Ciphertext& result, seal::MemoryPoolHandle pool) const
+{
+	if (&in.ciphertext() == &result) {
+		throw std::invalid_argument("This function does not accept the same reference for in and result.");
+	}
+	if (s == 0) {
+		result = in.ciphertext();
+		return;
+	}
+	const auto [forward_elt, backward_elt] = galois_elements();
+	if (s == effective_block_size()) {
+		in.apply_galois(forward_elt, gk, result); log_galois();
+		return;
+	}
+	// both automorphisms share the decomposition of in, the masking happens afterwards
+	seal::Ciphertext backward(pool);
+	in.apply_galois(forward_elt, gk, result); log_galois();
+	in.apply_galois(backward_elt, gk, backward); log_galois();
+	if (lifted_automorphed_fmask != nullptr && lifted_automorphed_fmask->parms_id() == in.ciphertext().parms_id()) {
+		transform_to_ntt_inplace(result, *lifted_context);
+		transform_to_ntt_inplace(backward, *lifted_context);
+		PlainInnerProduct product(*lifted_context, in.ciphertext().parms_id(), pool);
+		product.add_product(result, *lifted_automorphed_fmask); log_multiply_plain();
+		product.add_product(backward, *lifted_automorphed_bmask); log_multiply_plain();
+		product.finish(result);
+	}
+	else {
+		eval.multiply_plain_inplace(result, seal::Plaintext(gsl::span(automorphed_mask(fmask, forward_elt)), pool), pool); log_multiply_plain();
+		eval.multiply_plain_inplace(backward, seal::Plaintext(gsl::span(automorphed_mask(bmask, backward_elt)), pool), pool); log_multiply_plain();
+		eval.add_inplace(result, backward);
+	}
+}
+
+SlotRing::Rotation SlotRing::Rotation::followed_by(const Rotation& next) const
+{
+	if (&slot_ring != &next.slot_ring || block_size != next.block_size) {
+		throw std::invalid_argument("Can only merge rotations of the same slot ring with the same block size");
+	}
+	return slot_ring.block_rotate((s + next.s) % block_size, block_size);
+}
+
 const std::tuple<uint64_t, uint64_t> SlotRing::Rotation::get_forward_g1_g2_decomp() const
 {
 	if (block_size == slot_ring.n && !slot_ring.slot_group_cyclic) {
@@ -844,13 +1227,13 @@ poly SlotRing::Frobenius::operator()(poly x) const
 	return x;
 }
 
-void SlotRing::Frobenius::apply_ciphertext(const seal::Ciphertext& in, const seal::Evaluator& eval, const seal::GaloisKeys& gk, seal::Ciphertext& result) const
+void SlotRing::Frobenius::apply_ciphertext(const seal::Ciphertext& in, const seal::Evaluator& eval, const seal::GaloisKeys& gk, seal::Ciphertext& result, seal::MemoryPoolHandle pool) const
 {
 	if (iters == 0) {
 		result = in;
 		return;
 	}
-	eval.apply_galois(in, static_cast<uint32_t>(galois_element()), gk, result); log_galois();
+	apply_galois_composed(eval, in, static_cast<uint32_t>(galois_element()), gk, result, pool); log_galois();
 }
 
 const std::tuple<uint64_t, uint64_t> SlotRing::Frobenius::get_g1_g2_decomp() const
@@ -880,20 +1263,38 @@ poly SlotRing::RawAuto::operator()(poly x) const
 {
 	assert(x.size() <= slot_ring.N());
 	x.resize(slot_ring.N());
-	slot_ring.g1_automorphism(x, std::get<0>(g1_g2_decomp));
-	if (std::get<1>(g1_g2_decomp) % 2 != 0) {
-		slot_ring.g2_automorphism(x);
-	}
+	slot_ring.apply_galois(x, galois_element());
 	return x;
 }
 
-void SlotRing::RawAuto::apply_ciphertext(const seal::Ciphertext& in, const seal::Evaluator& eval, const seal::GaloisKeys& gk, seal::Ciphertext& result) const
+void SlotRing::RawAuto::operator()(const poly& x, poly& result, PolyWorkspace& workspace) const
+{
+	assert(x.size() <= slot_ring.N());
+	if (x.size() == slot_ring.N() && &x != &result) {
+		slot_ring.apply_galois(x, result, galois_element());
+		return;
+	}
+	PolyWorkspace::Buffer padded = workspace.acquire(slot_ring.N());
+	std::copy(x.begin(), x.end(), padded->begin());
+	slot_ring.apply_galois(*padded, result, galois_element());
+}
+
+void SlotRing::RawAuto::apply_ciphertext(const seal::Ciphertext& in, const seal::Evaluator& eval, const seal::GaloisKeys& gk, seal::Ciphertext& result, seal::MemoryPoolHandle pool) const
 {
 	if (g1_g2_decomp == std::make_tuple(0, 0)) {
 		result = in;
 		return;
 	}
-	eval.apply_galois(in, galois_element(), gk, result); log_galois();
+	apply_galois_composed(eval, in, galois_element(), gk, result, pool); log_galois();
+}
+
+void SlotRing::RawAuto::apply_ciphertext(const HoistedCiphertext& in, const seal::GaloisKeys& gk, seal::Ciphertext& result) const
+{
+	if (g1_g2_decomp == std::make_tuple(0, 0)) {
+		result = in.ciphertext();
+		return;
+	}
+	in.apply_galois(galois_element(), gk, result); log_galois();
 }
 
 uint32_t SlotRing::RawAuto::galois_element() const
@@ -908,4 +1309,4 @@ uint32_t SlotRing::RawAuto::galois_element() const
 bool SlotRing::RawAuto::is_identity() const
 {
 	return galois_element() == 1;
-}
\ No newline at end of file
+}
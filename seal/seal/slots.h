@@ -2,19 +2,25 @@
 #include <vector>
 #include <assert.h>
 #include <ostream>
+#include <istream>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
 #include "seal/util/uintarithsmallmod.h"
 #include "seal/seal.h"
 #include "polyarith.h"
+#include "hoisting.h"
+#include "galoisplan.h"
+#include "innerproduct.h"
+#include "stats.h"
 
 /**
  * Contains operations to work with the slot structure of
  * the plaintext space.
 */
 
-extern size_t kswitch_counter;
-
- void log_relin();
- void log_galois();
 
 inline uint64_t log2_ceil(uint64_t x) {
 	if (x == 0) {
@@ -114,10 +120,45 @@ class SlotRing {
 	//conjugate
 	std::vector<poly> unit_vectors;
 
+	//tex:
+	//Caches the index maps of the automorphisms $X \mapsto X^g$, so that these can be computed by a single gather pass.
+	//The maps only depend on $N$, so they are shared between copies of this ring.
+	struct AutomorphismTables {
+		std::mutex mutex;
+		std::unordered_map<uint64_t, std::shared_ptr<const std::vector<uint32_t>>> tables;
+	};
+	std::shared_ptr<AutomorphismTables> automorphism_tables;
+
+	// the highest bit of an automorphism table entry indicates that the coefficient has to be negated
+	static constexpr uint32_t automorphism_negate_flag = (uint32_t)1 << 31;
+	// bounds the memory used by cached automorphism tables, each table takes 4N bytes
+	static constexpr size_t max_cached_automorphism_tables = 128;
+
+	//tex:
+	//Returns the table for $X \mapsto X^g$; Entry $j$ contains the index $i$ with $ig \equiv \pm j \mod 2N$, and the negate flag
+	//is set if $ig \equiv j + N \mod 2N$.
+	std::shared_ptr<const std::vector<uint32_t>> automorphism_table(uint64_t galois_elt) const;
+
 	void init_slot_group();
 	void init_p_log();
+	void init_unit_vectors(const poly& base_unit_vector);
 	void init_slot_modulus(poly base_unit_vector);
 
+	//tex:
+	//Same as the public constructor, but uses the given slot modulus (the factor of $X^N + 1$ belonging to base_unit_vector)
+	//instead of computing it by a gcd of degree $N$. If the slot modulus is empty (i.e. has $n = 0$), it is computed.
+	SlotRing(
+		uint64_t log2N,
+		uint64_t p,
+		uint64_t e,
+		uint64_t g2,
+		poly base_unit_vector,
+		PolyModulus slot_modulus
+	);
+
+	// the process-wide registry behind create_shared()
+	static std::shared_ptr<const SlotRing> find_or_create_shared(uint64_t log2N, uint64_t p, uint64_t e, uint64_t g2, const poly& base_unit_vector, const std::function<SlotRing()>& create);
+
 	void apply_frobenius(poly& x, size_t iters, const seal::Modulus* mod = nullptr) const;
 
 	//tex:
@@ -132,6 +173,16 @@ class SlotRing {
 
 public:
 
+	//tex:
+	//Computes the automorphism $X -> X^g$ inplace, where $g$ is the given galois element.
+	//If the given modulus is nullptr, we use $p^e$ as the modulus.
+	//The temporary is taken from PolyWorkspace::thread_local_workspace().
+	void apply_galois(poly& x, uint64_t galois_elt, const seal::Modulus* mod = nullptr) const;
+
+	//tex:
+	//Computes the automorphism $X -> X^g$ of in into result, which must not alias in.
+	void apply_galois(const poly& in, poly& result, uint64_t galois_elt, const seal::Modulus* mod = nullptr) const;
+
 	/**
 	 * Represents a subring of the main ring. Mainly used for a single slot.
 	*/
@@ -160,13 +211,20 @@ public:
 		size_t s;
 		const SlotRing& slot_ring;
 		size_t block_size;
-		mutable std::unique_ptr<seal::Plaintext> fmask_plain;
-		mutable std::unique_ptr<seal::Plaintext> bmask_plain;
+		// the masks lifted by precompute(), shared between copies of this rotation
+		const seal::SEALContext* lifted_context;
+		std::shared_ptr<const LiftedPlaintext> lifted_fmask;
+		std::shared_ptr<const LiftedPlaintext> lifted_bmask;
+		// the masks with the forward resp. backward automorphism applied, lifted by precompute()
+		std::shared_ptr<const LiftedPlaintext> lifted_automorphed_fmask;
+		std::shared_ptr<const LiftedPlaintext> lifted_automorphed_bmask;
 
 		inline Rotation(poly fmask, poly bmask, size_t s, const SlotRing& slot_ring, size_t block_size)
-			: fmask(std::move(fmask)), bmask(std::move(bmask)), s(s), slot_ring(slot_ring), block_size(block_size), fmask_plain(nullptr), bmask_plain(nullptr) {}
+			: fmask(std::move(fmask)), bmask(std::move(bmask)), s(s), slot_ring(slot_ring), block_size(block_size), lifted_context(nullptr),
+			lifted_fmask(nullptr), lifted_bmask(nullptr), lifted_automorphed_fmask(nullptr), lifted_automorphed_bmask(nullptr) {}
 
 		size_t effective_block_size() const;
+		poly automorphed_mask(const poly& mask, uint32_t galois_elt) const;
 
 	public:
 		Rotation(const Rotation&) = default;
@@ -174,7 +232,33 @@ public:
 		~Rotation() = default;
 
 		poly operator()(const poly& x) const;
-		void apply_ciphertext(const seal::Ciphertext& in, const seal::Evaluator& eval, const seal::GaloisKeys& gk, seal::Ciphertext& result) const;
+		// same as above, but writes into result (which may alias x) and takes all temporaries from the workspace
+		void operator()(const poly& x, poly& result, PolyWorkspace& workspace) const;
+
+		/**
+		 * Lifts the masks to the ciphertext modulus of the given level, so that apply_ciphertext() does not have to
+		 * encode and lift them on every call for ciphertexts at this level. The context must outlive this object.
+		 * Must not be called concurrently with apply_ciphertext(); afterwards, apply_ciphertext() is thread-safe as before.
+		 * The apply_ciphertext() functions allocate all temporaries (and result, if it is empty) from pool.
+		*/
+		void precompute(const seal::SEALContext& context, seal::parms_id_type parms_id);
+		void apply_ciphertext(const seal::Ciphertext& in, const seal::Evaluator& eval, const seal::GaloisKeys& gk, seal::Ciphertext& result, seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool()) const;
+
+		//tex:
+		//Computes the same as the other apply_ciphertext(), but applies both automorphisms $\sigma_f, \sigma_b$ to the
+		//hoisted ciphertext first, and multiplies with the automorphed masks afterwards, i.e. computes
+		//$$\sigma_f(\mathrm{fmask}) \sigma_f(x) + \sigma_b(\mathrm{bmask}) \sigma_b(x)$$
+		//Thus only one key-switch decomposition is necessary. Note that the masks now also scale the key-switching noise,
+		//which is usually negligible compared to the noise of $x$.
+		void apply_ciphertext(const HoistedCiphertext& in, const seal::Evaluator& eval, const seal::GaloisKeys& gk, seal::Ciphertext& result, seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool()) const;
+
+		/**
+		 * Returns the rotation that is equivalent to first applying this rotation and then the given one.
+		 * Both rotations must act on blocks of the same size, and the result again requires (at most) two
+		 * automorphisms, so a run of such rotations should be merged before applying it to a ciphertext.
+		*/
+		Rotation followed_by(const Rotation& next) const;
+
 		std::tuple<uint32_t, uint32_t> galois_elements() const;
 		bool is_identity() const;
 
@@ -202,7 +286,7 @@ public:
 		~Frobenius() = default;
 
 		poly operator()(poly x) const;
-		void apply_ciphertext(const seal::Ciphertext& in, const seal::Evaluator& eval, const seal::GaloisKeys& gk, seal::Ciphertext& result) const;
+		void apply_ciphertext(const seal::Ciphertext& in, const seal::Evaluator& eval, const seal::GaloisKeys& gk, seal::Ciphertext& result, seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool()) const;
 		uint32_t galois_element() const;
 		bool is_identity() const;
 
@@ -231,7 +315,15 @@ public:
 		~RawAuto() = default;
 
 		poly operator()(poly x) const;
-		void apply_ciphertext(const seal::Ciphertext& in, const seal::Evaluator& eval, const seal::GaloisKeys& gk, seal::Ciphertext& result) const;
+		// same as above, but writes into result (which may alias x) and takes all temporaries from the workspace
+		void operator()(const poly& x, poly& result, PolyWorkspace& workspace) const;
+		void apply_ciphertext(const seal::Ciphertext& in, const seal::Evaluator& eval, const seal::GaloisKeys& gk, seal::Ciphertext& result, seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool()) const;
+
+		/**
+		 * Applies the automorphism to the hoisted ciphertext; Use this if many automorphisms
+		 * are applied to the same ciphertext.
+		*/
+		void apply_ciphertext(const HoistedCiphertext& in, const seal::GaloisKeys& gk, seal::Ciphertext& result) const;
 		uint32_t galois_element() const;
 		bool is_identity() const;
 
@@ -288,6 +380,12 @@ public:
 
 	poly extract_slot_value(poly x, size_t slot) const;
 	poly from_slot_value(const poly& x, size_t slot) const;
+
+	/**
+	 * Returns the element that has the value x in every slot, i.e. the sum of from_slot_value(x, i) over all slots i;
+	 * This only requires a single multiplication.
+	*/
+	poly from_slot_value_in_all_slots(const poly& x) const;
 	const poly& slot_one(size_t slot) const noexcept;
 	uint64_t prime() const noexcept;
 	size_t exponent() const noexcept;
@@ -316,14 +414,48 @@ public:
 	void from_power_x_subring(const SlotRing& subring, const poly& el, poly& result) const;
 	SlotRing change_exponent(uint64_t new_exp) const;
 
+	/**
+	 * A hash of the parameters that define this ring (N, p, e, the slot group generator g2 and the slot unit vector),
+	 * e.g. to identify precomputed data that belongs to this ring.
+	*/
+	uint64_t parameter_hash() const;
+
+	/**
+	 * Writes the parameters and the slot modulus to the stream, so that load() can recreate the ring
+	 * without recomputing the slot modulus.
+	*/
+	void save(std::ostream& stream) const;
+
+	/**
+	 * Loads a ring stored by save(); If an equal ring is already registered (see create_shared()), that one is returned,
+	 * otherwise the loaded ring is registered. Throws std::invalid_argument if the data is not a stored ring of this version.
+	*/
+	static std::shared_ptr<const SlotRing> load(std::istream& stream);
+
+	/**
+	 * Returns the process-wide instance of the ring with the given parameters, and constructs it if there is none yet;
+	 * Registered instances are kept until the process exits, so this should only be used for the few rings that are used repeatedly.
+	*/
+	static std::shared_ptr<const SlotRing> create_shared(uint64_t log2N, uint64_t p, uint64_t e, poly base_unit_vector);
+
+	/**
+	 * Same as power_x_subring() resp. change_exponent(), but returns the process-wide instance (see create_shared());
+	 * Also, the slot modulus of the result is derived from the one of this ring whenever possible.
+	*/
+	std::shared_ptr<const SlotRing> shared_power_x_subring(size_t index_log2) const;
+	std::shared_ptr<const SlotRing> shared_change_exponent(uint64_t new_exp) const;
+
 	friend void test_g_automorphisms();
+	friend void test_save_load_slot_ring();
+	friend void test_save_load_mapped();
 };
 
-std::shared_ptr<SlotRing> small_test_parameters();
-std::shared_ptr<SlotRing> small_p_257_test_parameters();
-std::shared_ptr<SlotRing> p_127_test_parameters();
-std::shared_ptr<SlotRing> p_257_test_parameters();
+std::shared_ptr<const SlotRing> small_test_parameters();
+std::shared_ptr<const SlotRing> small_p_257_test_parameters();
+std::shared_ptr<const SlotRing> p_127_test_parameters();
+std::shared_ptr<const SlotRing> p_257_test_parameters();
 void test_g_automorphisms();
+void test_save_load_slot_ring();
 void test_block_rotate();
 void test_rotate_noncyclic();
 
@@ -0,0 +1,230 @@
+#include "stats.h"
+#include <sstream>
+#include <exception>
+#include <assert.h>
+#include <iostream>
+
+namespace {
+	thread_local BootstrapStats* current_stats = nullptr;
+}
+
+const char* bootstrap_stage_name(BootstrapStage stage)
+{
+	switch (stage) {
+	case BootstrapStage::slots_to_coeffs: return "slots_to_coeffs";
+	case BootstrapStage::noisy_decrypt: return "noisy_decrypt";
+	case BootstrapStage::coeffs_to_slots: return "coeffs_to_slots";
+	case BootstrapStage::digit_extract: return "digit_extract";
+	case BootstrapStage::bootstrap: return "bootstrap";
+	}
+	throw std::invalid_argument("Unknown bootstrap stage");
+}
+
+BootstrapStats::BootstrapStats()
+{
+	reset();
+}
+
+BootstrapStats* BootstrapStats::current() noexcept
+{
+	return current_stats;
+}
+
+void BootstrapStats::reset()
+{
+	galois_count = 0;
+	relin_count = 0;
+	multiply_plain_count = 0;
+	multiply_count = 0;
+	for (size_t i = 0; i < bootstrap_stage_count; ++i) {
+		stage_call_count[i] = 0;
+		stage_nanoseconds[i] = 0;
+		stage_allocation_bytes[i] = 0;
+	}
+}
+
+void BootstrapStats::set_stage_hook(std::function<void(BootstrapStage, const seal::Ciphertext&)> hook)
+{
+	stage_hook = std::move(hook);
+}
+
+void BootstrapStats::record_stage(BootstrapStage stage, std::chrono::nanoseconds time, uint64_t allocated_bytes) noexcept
+{
+	const size_t index = static_cast<size_t>(stage);
+	stage_call_count[index].fetch_add(1, std::memory_order_relaxed);
+	stage_nanoseconds[index].fetch_add(static_cast<uint64_t>(time.count()), std::memory_order_relaxed);
+	stage_allocation_bytes[index].fetch_add(allocated_bytes, std::memory_order_relaxed);
+}
+
+void BootstrapStats::call_stage_hook(BootstrapStage stage, const seal::Ciphertext& result) const
+{
+	if (stage_hook) {
+		stage_hook(stage, result);
+	}
+}
+
+uint64_t BootstrapStats::galois_operations() const noexcept
+{
+	return galois_count;
+}
+
+uint64_t BootstrapStats::relin_operations() const noexcept
+{
+	return relin_count;
+}
+
+uint64_t BootstrapStats::multiply_plain_operations() const noexcept
+{
+	return multiply_plain_count;
+}
+
+uint64_t BootstrapStats::multiply_operations() const noexcept
+{
+	return multiply_count;
+}
+
+uint64_t BootstrapStats::key_switch_operations() const noexcept
+{
+	return galois_count + relin_count;
+}
+
+uint64_t BootstrapStats::stage_calls(BootstrapStage stage) const noexcept
+{
+	return stage_call_count[static_cast<size_t>(stage)];
+}
+
+std::chrono::nanoseconds BootstrapStats::stage_time(BootstrapStage stage) const noexcept
+{
+	return std::chrono::nanoseconds(stage_nanoseconds[static_cast<size_t>(stage)]);
+}
+
+uint64_t BootstrapStats::stage_allocated_bytes(BootstrapStage stage) const noexcept
+{
+	return stage_allocation_bytes[static_cast<size_t>(stage)];
+}
+
+std::string BootstrapStats::to_json() const
+{
+	std::ostringstream out;
+	out << "{\"galois\": " << galois_operations()
+		<< ", \"relinearize\": " << relin_operations()
+		<< ", \"multiply_plain\": " << multiply_plain_operations()
+		<< ", \"multiply\": " << multiply_operations()
+		<< ", \"stages\": {";
+	for (size_t i = 0; i < bootstrap_stage_count; ++i) {
+		const BootstrapStage stage = static_cast<BootstrapStage>(i);
+		if (i != 0) {
+			out << ", ";
+		}
+		out << "\"" << bootstrap_stage_name(stage) << "\": {\"calls\": " << stage_calls(stage)
+			<< ", \"nanoseconds\": " << stage_time(stage).count()
+			<< ", \"allocated_bytes\": " << stage_allocated_bytes(stage) << "}";
+	}
+	out << "}}";
+	return out.str();
+}
+
+BootstrapStatsScope::BootstrapStatsScope(BootstrapStats* stats) noexcept : previous(current_stats)
+{
+	current_stats = stats;
+}
+
+BootstrapStatsScope::~BootstrapStatsScope()
+{
+	current_stats = previous;
+}
+
+BootstrapStageTimer::BootstrapStageTimer(BootstrapStats* stats, BootstrapStage stage, const seal::MemoryPoolHandle& pool, const seal::Ciphertext& result)
+	: scope(stats), stats(stats), stage(stage), pool(pool), result(result), initial_allocated_bytes(0), initial_uncaught_exceptions(std::uncaught_exceptions())
+{
+	if (stats != nullptr) {
+		initial_allocated_bytes = pool.alloc_byte_count();
+	}
+	start = std::chrono::steady_clock::now();
+}
+
+BootstrapStageTimer::~BootstrapStageTimer()
+{
+	if (stats == nullptr) {
+		return;
+	}
+	const auto end = std::chrono::steady_clock::now();
+	const size_t allocated_bytes = pool.alloc_byte_count();
+	stats->record_stage(stage, std::chrono::duration_cast<std::chrono::nanoseconds>(end - start), allocated_bytes > initial_allocated_bytes ? allocated_bytes - initial_allocated_bytes : 0);
+	if (std::uncaught_exceptions() == initial_uncaught_exceptions) {
+		try {
+			stats->call_stage_hook(stage, result);
+		}
+		catch (...) {
+			// a failing hook must not break the bootstrapping
+		}
+	}
+}
+
+void log_relin()
+{
+	if (BootstrapStats* stats = BootstrapStats::current()) {
+		stats->record_relin();
+	}
+}
+
+void log_galois()
+{
+	if (BootstrapStats* stats = BootstrapStats::current()) {
+		stats->record_galois();
+	}
+}
+
+void log_multiply_plain()
+{
+	if (BootstrapStats* stats = BootstrapStats::current()) {
+		stats->record_multiply_plain();
+	}
+}
+
+void log_multiply()
+{
+	if (BootstrapStats* stats = BootstrapStats::current()) {
+		stats->record_multiply();
+	}
+}
+
+void test_bootstrap_stats()
+{
+	BootstrapStats stats;
+	log_galois();
+	assert(stats.galois_operations() == 0);
+	{
+		BootstrapStatsScope scope(&stats);
+		log_galois();
+		log_galois();
+		log_relin();
+		log_multiply();
+		log_multiply_plain();
+	}
+	log_relin();
+	assert(stats.galois_operations() == 2);
+	assert(stats.relin_operations() == 1);
+	assert(stats.key_switch_operations() == 3);
+	assert(stats.multiply_operations() == 1);
+	assert(stats.multiply_plain_operations() == 1);
+
+	bool hook_called = false;
+	stats.set_stage_hook([&hook_called](BootstrapStage stage, const seal::Ciphertext&) {
+		hook_called = stage == BootstrapStage::coeffs_to_slots;
+	});
+	seal::Ciphertext result;
+	{
+		BootstrapStageTimer timer(&stats, BootstrapStage::coeffs_to_slots, seal::MemoryManager::GetPool(), result);
+		assert(BootstrapStats::current() == &stats);
+	}
+	assert(BootstrapStats::current() == nullptr);
+	assert(hook_called);
+	assert(stats.stage_calls(BootstrapStage::coeffs_to_slots) == 1);
+	assert(stats.stage_calls(BootstrapStage::bootstrap) == 0);
+	assert(stats.to_json().find("\"coeffs_to_slots\": {\"calls\": 1") != std::string::npos);
+
+	stats.reset();
+	assert(stats.galois_operations() == 0);
+	std::cout << "test_bootstrap_stats(): success" << std::endl;
+}
@@ -0,0 +1,147 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include "seal/seal.h"
+
+/**
+ * The stages of bootstrapping for which BootstrapStats records timings;
+ * bootstrap is the whole procedure, i.e. includes all the others.
+*/
+enum class BootstrapStage : size_t {
+	slots_to_coeffs = 0, noisy_decrypt, coeffs_to_slots, digit_extract, bootstrap
+};
+
+constexpr size_t bootstrap_stage_count = 5;
+
+const char* bootstrap_stage_name(BootstrapStage stage);
+
+/**
+ * Collects operation counts, wall times and memory pool allocations of bootstrapping operations.
+ * 
+ * All counters are atomic, so one object can be shared by concurrent bootstraps. The operations
+ * are recorded into the object that is "current" for the calling thread (see BootstrapStatsScope);
+ * ThreadPool propagates it to the tasks it executes. If there is no current object, nothing is recorded.
+*/
+class BootstrapStats {
+
+	std::atomic<uint64_t> galois_count;
+	std::atomic<uint64_t> relin_count;
+	std::atomic<uint64_t> multiply_plain_count;
+	std::atomic<uint64_t> multiply_count;
+	std::array<std::atomic<uint64_t>, bootstrap_stage_count> stage_call_count;
+	std::array<std::atomic<uint64_t>, bootstrap_stage_count> stage_nanoseconds;
+	std::array<std::atomic<uint64_t>, bootstrap_stage_count> stage_allocation_bytes;
+	std::function<void(BootstrapStage, const seal::Ciphertext&)> stage_hook;
+
+public:
+	BootstrapStats();
+	BootstrapStats(const BootstrapStats&) = delete;
+	BootstrapStats(BootstrapStats&&) = delete;
+	~BootstrapStats() = default;
+
+	/**
+	 * Returns the object into which the calling thread currently records, or nullptr.
+	*/
+	static BootstrapStats* current() noexcept;
+
+	void reset();
+
+	/**
+	 * Sets a function that is called with the result of each finished stage, e.g. to log the noise budget.
+	 * The hook might be called concurrently from multiple threads, and must not be changed while operations are running.
+	*/
+	void set_stage_hook(std::function<void(BootstrapStage, const seal::Ciphertext&)> hook);
+
+	void record_galois() noexcept;
+	void record_relin() noexcept;
+	void record_multiply_plain() noexcept;
+	void record_multiply() noexcept;
+	void record_stage(BootstrapStage stage, std::chrono::nanoseconds time, uint64_t allocated_bytes) noexcept;
+	void call_stage_hook(BootstrapStage stage, const seal::Ciphertext& result) const;
+
+	uint64_t galois_operations() const noexcept;
+	uint64_t relin_operations() const noexcept;
+	uint64_t multiply_plain_operations() const noexcept;
+	uint64_t multiply_operations() const noexcept;
+	uint64_t key_switch_operations() const noexcept;
+	uint64_t stage_calls(BootstrapStage stage) const noexcept;
+	std::chrono::nanoseconds stage_time(BootstrapStage stage) const noexcept;
+
+	/**
+	 * The increase of the allocated bytes of the memory pool used during the stage. Since
+	 * SEAL memory pools reuse freed memory, this measures the growth of the pool.
+	*/
+	uint64_t stage_allocated_bytes(BootstrapStage stage) const noexcept;
+
+	/**
+	 * Returns all values as a JSON object.
+	*/
+	std::string to_json() const;
+};
+
+/**
+ * Makes the given stats object the current one of the calling thread, until this is destroyed.
+*/
+class BootstrapStatsScope {
+
+	BootstrapStats* previous;
+
+public:
+	explicit BootstrapStatsScope(BootstrapStats* stats) noexcept;
+	BootstrapStatsScope(const BootstrapStatsScope&) = delete;
+	BootstrapStatsScope(BootstrapStatsScope&&) = delete;
+	~BootstrapStatsScope();
+};
+
+/**
+ * Records the wall time and pool allocations of one stage from its construction to its
+ * destruction into the given stats (if not nullptr), which is also made current during this time.
+ * If the stage finished without exception, the stage hook is called with the result.
+*/
+class BootstrapStageTimer {
+
+	BootstrapStatsScope scope;
+	BootstrapStats* stats;
+	BootstrapStage stage;
+	const seal::MemoryPoolHandle& pool;
+	const seal::Ciphertext& result;
+	size_t initial_allocated_bytes;
+	int initial_uncaught_exceptions;
+	std::chrono::steady_clock::time_point start;
+
+public:
+	BootstrapStageTimer(BootstrapStats* stats, BootstrapStage stage, const seal::MemoryPoolHandle& pool, const seal::Ciphertext& result);
+	BootstrapStageTimer(const BootstrapStageTimer&) = delete;
+	BootstrapStageTimer(BootstrapStageTimer&&) = delete;
+	~BootstrapStageTimer();
+};
+
+void log_relin();
+void log_galois();
+void log_multiply_plain();
+void log_multiply();
+
+inline void BootstrapStats::record_galois() noexcept
+{
+	galois_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline void BootstrapStats::record_relin() noexcept
+{
+	relin_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline void BootstrapStats::record_multiply_plain() noexcept
+{
+	multiply_plain_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline void BootstrapStats::record_multiply() noexcept
+{
+	multiply_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+void test_bootstrap_stats();
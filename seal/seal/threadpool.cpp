@@ -0,0 +1,316 @@
+#include "threadpool.h"
+#include "stats.h"
+#include <assert.h>
+#include <iostream>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+
+ThreadPool::ThreadPool(size_t thread_count) : stopping(false)
+{
+	if (thread_count == 0) {
+		thread_count = 1;
+	}
+	workers.reserve(thread_count);
+	for (size_t i = 0; i < thread_count; ++i) {
+		workers.emplace_back([this]() { worker_loop(); });
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::unique_lock<std::mutex> lock(tasks_mutex);
+		stopping = true;
+	}
+	tasks_available.notify_all();
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+}
+
+void ThreadPool::worker_loop()
+{
+	while (true) {
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(tasks_mutex);
+			tasks_available.wait(lock, [this]() { return stopping || !tasks.empty(); });
+			if (tasks.empty()) {
+				// only happens if stopping
+				return;
+			}
+			task = std::move(tasks.front());
+			tasks.pop_front();
+		}
+		task();
+	}
+}
+
+size_t ThreadPool::thread_count() const noexcept
+{
+	return workers.size();
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+	{
+		std::unique_lock<std::mutex> lock(tasks_mutex);
+		tasks.push_back(std::move(task));
+	}
+	tasks_available.notify_one();
+}
+
+void ThreadPool::parallel_for(size_t begin, size_t end, const std::function<void(size_t)>& f)
+{
+	if (end <= begin) {
+		return;
+	}
+	// the state is shared with the helper tasks, which might only start after this call returned
+	struct State {
+		std::atomic<size_t> next;
+		size_t end;
+		size_t remaining;
+		std::mutex mutex;
+		std::condition_variable finished;
+		std::exception_ptr error = nullptr;
+		const std::function<void(size_t)>* f;
+		BootstrapStats* stats;
+	};
+	std::shared_ptr<State> state = std::make_shared<State>();
+	state->next = begin;
+	state->end = end;
+	state->remaining = end - begin;
+	state->f = &f;
+	state->stats = BootstrapStats::current();
+
+	// each index is claimed by exactly one thread; helpers that start too late just find nothing to do
+	const auto work = [](State& state) {
+		BootstrapStatsScope stats_scope(state.stats);
+		while (true) {
+			const size_t i = state.next.fetch_add(1);
+			if (i >= state.end) {
+				return;
+			}
+			std::exception_ptr error = nullptr;
+			try {
+				(*state.f)(i);
+			}
+			catch (...) {
+				error = std::current_exception();
+			}
+			std::unique_lock<std::mutex> lock(state.mutex);
+			if (error != nullptr && state.error == nullptr) {
+				state.error = error;
+			}
+			state.remaining -= 1;
+			if (state.remaining == 0) {
+				state.finished.notify_all();
+			}
+		}
+	};
+
+	const size_t helper_count = std::min(thread_count(), end - begin - 1);
+	for (size_t i = 0; i < helper_count; ++i) {
+		submit([state, work]() { work(*state); });
+	}
+	work(*state);
+
+	std::unique_lock<std::mutex> lock(state->mutex);
+	state->finished.wait(lock, [&state]() { return state->remaining == 0; });
+	if (state->error != nullptr) {
+		std::rethrow_exception(state->error);
+	}
+}
+
+size_t TaskGraph::add_task(std::function<void()> work, const std::vector<size_t>& dependencies)
+{
+	const size_t index = tasks.size();
+	for (size_t dependency : dependencies) {
+		if (dependency >= index) {
+			throw std::invalid_argument("Dependencies must refer to previously added tasks");
+		}
+		tasks[dependency].dependents.push_back(index);
+	}
+	tasks.push_back(Task{ std::move(work), {}, dependencies.size() });
+	return index;
+}
+
+size_t TaskGraph::size() const noexcept
+{
+	return tasks.size();
+}
+
+namespace {
+
+	// as in ThreadPool::parallel_for(), the state is shared with helper tasks that might only start after TaskGraph::run() returned
+	struct TaskGraphState {
+		const std::vector<std::function<void()>*> work;
+		const std::vector<const std::vector<size_t>*> dependents;
+		std::vector<size_t> pending;
+		std::deque<size_t> ready;
+		size_t finished = 0;
+		std::mutex mutex;
+		std::condition_variable changed;
+		std::exception_ptr error = nullptr;
+		BootstrapStats* stats = BootstrapStats::current();
+	};
+
+	// Executes ready tasks until there are none left; if wait_for_all is set, this will instead
+	// wait for running tasks to make new tasks ready, until all tasks are finished.
+	// Whenever a task makes more than one other task ready, additional helpers are submitted to the pool,
+	// so that the new tasks can run in parallel.
+	void run_ready_tasks(const std::shared_ptr<TaskGraphState>& state, ThreadPool* thread_pool, bool wait_for_all)
+	{
+		BootstrapStatsScope stats_scope(state->stats);
+		std::unique_lock<std::mutex> lock(state->mutex);
+		while (true) {
+			if (state->ready.empty()) {
+				if (!wait_for_all || state->finished == state->work.size()) {
+					return;
+				}
+				state->changed.wait(lock);
+				continue;
+			}
+			const size_t current = state->ready.front();
+			state->ready.pop_front();
+			const bool skip = state->error != nullptr;
+			lock.unlock();
+
+			std::exception_ptr error = nullptr;
+			if (!skip) {
+				try {
+					(*state->work[current])();
+				}
+				catch (...) {
+					error = std::current_exception();
+				}
+			}
+
+			lock.lock();
+			if (error != nullptr && state->error == nullptr) {
+				state->error = error;
+			}
+			size_t newly_ready = 0;
+			for (size_t dependent : *state->dependents[current]) {
+				state->pending[dependent] -= 1;
+				if (state->pending[dependent] == 0) {
+					state->ready.push_back(dependent);
+					newly_ready += 1;
+				}
+			}
+			state->finished += 1;
+			state->changed.notify_all();
+			// the current thread continues with one of the new tasks
+			for (size_t i = 1; i < newly_ready && thread_pool != nullptr; ++i) {
+				thread_pool->submit([state, thread_pool]() { run_ready_tasks(state, thread_pool, false); });
+			}
+		}
+	}
+}
+
+void TaskGraph::run(ThreadPool* thread_pool)
+{
+	if (tasks.size() == 0) {
+		return;
+	}
+	std::vector<std::function<void()>*> work;
+	std::vector<const std::vector<size_t>*> dependents;
+	for (Task& task : tasks) {
+		work.push_back(&task.work);
+		dependents.push_back(&task.dependents);
+	}
+	std::shared_ptr<TaskGraphState> state = std::make_shared<TaskGraphState>(std::move(work), std::move(dependents));
+	state->pending.reserve(tasks.size());
+	for (size_t i = 0; i < tasks.size(); ++i) {
+		state->pending.push_back(tasks[i].dependency_count);
+		if (tasks[i].dependency_count == 0) {
+			state->ready.push_back(i);
+		}
+	}
+	for (size_t i = 1; i < state->ready.size() && thread_pool != nullptr; ++i) {
+		thread_pool->submit([state, thread_pool]() { run_ready_tasks(state, thread_pool, false); });
+	}
+	run_ready_tasks(state, thread_pool, true);
+
+	if (state->error != nullptr) {
+		std::rethrow_exception(state->error);
+	}
+}
+
+seal::MemoryPoolHandle thread_local_memory_pool()
+{
+	// pools created with mm_force_new are thread-safe, so values allocated from them can still be shared between threads
+	thread_local seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool(seal::mm_prof_opt::mm_force_new);
+	return pool;
+}
+
+void test_thread_pool()
+{
+	ThreadPool thread_pool(4);
+	std::vector<size_t> values(1000);
+	parallel_for(&thread_pool, 0, values.size(), [&values, &thread_pool](size_t i) {
+		// nested calls must not deadlock
+		std::atomic<size_t> inner = 0;
+		parallel_for(&thread_pool, 0, 10, [&inner](size_t j) { inner += j; });
+		values[i] = i + inner;
+	});
+	for (size_t i = 0; i < values.size(); ++i) {
+		assert(values[i] == i + 45);
+	}
+
+	parallel_tree_reduce(&thread_pool, values, [](size_t& lhs, size_t rhs) { lhs += rhs; });
+	assert(values[0] == 999 * 1000 / 2 + 45 * 1000);
+
+	bool has_thrown = false;
+	try {
+		parallel_for(&thread_pool, 0, 100, [](size_t i) {
+			if (i == 17) {
+				throw std::invalid_argument("test");
+			}
+		});
+	}
+	catch (const std::invalid_argument&) {
+		has_thrown = true;
+	}
+	assert(has_thrown);
+	std::cout << "test_thread_pool(): success" << std::endl;
+}
+
+void test_task_graph()
+{
+	ThreadPool thread_pool(4);
+	// a diamond-shaped graph, where every task records the point in time at which it ran
+	std::atomic<size_t> clock = 0;
+	std::vector<size_t> times(5);
+	TaskGraph graph;
+	const size_t source = graph.add_task([&]() { times[0] = clock++; });
+	const size_t left = graph.add_task([&]() { times[1] = clock++; }, { source });
+	const size_t right = graph.add_task([&]() { times[2] = clock++; }, { source });
+	const size_t sink = graph.add_task([&]() { times[3] = clock++; }, { left, right });
+	graph.add_task([&]() { times[4] = clock++; }, { sink, source });
+	graph.run(&thread_pool);
+	assert(clock == 5);
+	assert(times[0] < times[1] && times[0] < times[2]);
+	assert(times[1] < times[3] && times[2] < times[3]);
+	assert(times[3] < times[4]);
+
+	clock = 0;
+	graph.run(nullptr);
+	assert(clock == 5);
+
+	TaskGraph failing_graph;
+	const size_t failing = failing_graph.add_task([]() { throw std::invalid_argument("test"); });
+	bool has_run = false;
+	failing_graph.add_task([&has_run]() { has_run = true; }, { failing });
+	bool has_thrown = false;
+	try {
+		failing_graph.run(&thread_pool);
+	}
+	catch (const std::invalid_argument&) {
+		has_thrown = true;
+	}
+	assert(has_thrown);
+	assert(!has_run);
+	std::cout << "test_task_graph(): success" << std::endl;
+}
@@ -0,0 +1,133 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <exception>
+#include "seal/seal.h"
+
+/**
+ * A simple fixed-size pool of worker threads.
+ *
+ * All functions are thread-safe, and parallel_for() may also be called from within
+ * a task that is executed by the pool; in this case, the calling thread takes part in
+ * the work, so nested use cannot deadlock.
+*/
+class ThreadPool {
+
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> tasks;
+	std::mutex tasks_mutex;
+	std::condition_variable tasks_available;
+	bool stopping;
+
+	void worker_loop();
+
+public:
+	explicit ThreadPool(size_t thread_count = std::thread::hardware_concurrency());
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool(ThreadPool&&) = delete;
+	~ThreadPool();
+
+	size_t thread_count() const noexcept;
+
+	/**
+	 * Enqueues the given task, which will be executed by one of the worker threads.
+	 * The task should not throw; use parallel_for() if exceptions must be propagated.
+	*/
+	void submit(std::function<void()> task);
+
+	/**
+	 * Calls f(i) for every i in [begin, end), distributed over the workers and the calling thread.
+	 * Returns once all calls are finished; if one of the calls throws, the first exception is rethrown.
+	 * The current BootstrapStats of the calling thread is also current while executing f.
+	*/
+	void parallel_for(size_t begin, size_t end, const std::function<void(size_t)>& f);
+};
+
+/**
+ * Same as ThreadPool::parallel_for(), but executes everything on the calling thread
+ * if thread_pool is nullptr.
+*/
+template<typename F>
+inline void parallel_for(ThreadPool* thread_pool, size_t begin, size_t end, F&& f)
+{
+	if (thread_pool == nullptr || end <= begin + 1) {
+		for (size_t i = begin; i < end; ++i) {
+			f(i);
+		}
+	}
+	else {
+		thread_pool->parallel_for(begin, end, std::function<void(size_t)>(std::forward<F>(f)));
+	}
+}
+
+/**
+ * Sums up all values in a binary tree, where the additions of each level are performed in parallel.
+ * The result is stored in values[0]. add(a, b) must compute a += b.
+*/
+template<typename T, typename Add>
+inline void parallel_tree_reduce(ThreadPool* thread_pool, std::vector<T>& values, Add add)
+{
+	for (size_t stride = 1; stride < values.size(); stride *= 2) {
+		const size_t pairs = (values.size() + 2 * stride - 1) / (2 * stride);
+		parallel_for(thread_pool, 0, pairs, [&](size_t i) {
+			const size_t target = 2 * stride * i;
+			if (target + stride < values.size()) {
+				add(values[target], values[target + stride]);
+			}
+		});
+	}
+}
+
+/**
+ * A set of tasks with dependencies between them, that can be executed on a ThreadPool.
+ * Each task is started as soon as all of its dependencies have finished.
+ *
+ * As in ThreadPool::parallel_for(), the thread calling run() takes part in the work,
+ * so it is safe to use a TaskGraph from within a task that is executed by the pool.
+*/
+class TaskGraph {
+
+	struct Task {
+		std::function<void()> work;
+		std::vector<size_t> dependents;
+		size_t dependency_count;
+	};
+
+	std::vector<Task> tasks;
+
+public:
+	TaskGraph() = default;
+	TaskGraph(const TaskGraph&) = delete;
+	TaskGraph(TaskGraph&&) = default;
+	~TaskGraph() = default;
+
+	/**
+	 * Adds a task and returns its index. All dependencies must be indices of previously
+	 * added tasks, thus the graph is acyclic by construction.
+	*/
+	size_t add_task(std::function<void()> work, const std::vector<size_t>& dependencies = {});
+
+	size_t size() const noexcept;
+
+	/**
+	 * Executes all tasks and returns once they are finished. If thread_pool is nullptr,
+	 * everything is executed on the calling thread, in an order compatible with the dependencies.
+	 * If one of the tasks throws, the tasks that have not yet been started are skipped, and the
+	 * first exception is rethrown.
+	*/
+	void run(ThreadPool* thread_pool);
+};
+
+/**
+ * Returns a memory pool that is owned by the calling thread, and created on the first call from that thread.
+ * The pool itself is thread-safe, so values allocated from it may be used and freed by other threads.
+*/
+seal::MemoryPoolHandle thread_local_memory_pool();
+
+void test_thread_pool();
+void test_task_graph();
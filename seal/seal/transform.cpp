@@ -1,11 +1,16 @@
 #include "transform.h"
 #include <fstream>
+#include <filesystem>
 #include <string>
 #include <numeric>
+#include <bit>
+#include <cstring>
+#include <chrono>
+#include <limits>
 
 
 CompiledLinearTransform::CompiledLinearTransform(std::shared_ptr<const SlotRing> slot_ring, std::vector<poly> coefficients)
-	: slot_ring(slot_ring), coefficients(std::move(coefficients))
+	: slot_ring(slot_ring), coefficients(std::move(coefficients)), babystep_count(default_babystep_automorphism_count(this->coefficients.size()))
 {
 	assert(slot_ring->g2_ord() == 2);
 	assert(this->coefficients.size() == g1_subgroup_order() || this->coefficients.size() == 2 * g1_subgroup_order());
@@ -58,17 +63,20 @@ uint64_t CompiledLinearTransform::g2_subgroup_order() const
 
 void CompiledLinearTransform::add_scaled_transform(const poly& scaling, const SlotRing::Rotation& rotation, const SlotRing::Frobenius& frobenius)
 {
+	PolyWorkspace& workspace = PolyWorkspace::thread_local_workspace();
+	PolyWorkspace::Buffer mask = workspace.acquire(0);
+	PolyWorkspace::Buffer add = workspace.acquire(0);
 	{
 		const uint64_t g1_power = (std::get<0>(rotation.get_forward_g1_g2_decomp()) + std::get<0>(frobenius.get_g1_g2_decomp())) % slot_ring->g1_ord();
 		const uint64_t g2_power = (std::get<1>(rotation.get_forward_g1_g2_decomp()) + std::get<1>(frobenius.get_g1_g2_decomp())) % slot_ring->g2_ord();
 		assert((g1_power * g1_subgroup_order()) % slot_ring->g1_ord() == 0);
 		const size_t index = g1_power * g1_subgroup_order() / slot_ring->g1_ord() + g2_power * g1_subgroup_order();
-		poly mask = slot_ring->raw_auto(g1_power, g2_power)(rotation.get_forward_mask());
-		poly add = poly_mul_mod(scaling, mask, slot_ring->R().scalar_mod, slot_ring->R().poly_mod);
+		slot_ring->raw_auto(g1_power, g2_power)(rotation.get_forward_mask(), *mask, workspace);
+		poly_mul_mod(scaling, *mask, slot_ring->R().scalar_mod, slot_ring->R().poly_mod, *add, workspace);
 
 		poly_add(
 			coefficients[index],
-			add,
+			*add,
 			slot_ring->R().scalar_mod
 		);
 	}
@@ -77,27 +85,47 @@ void CompiledLinearTransform::add_scaled_transform(const poly& scaling, const Sl
 		const uint64_t g2_power = (std::get<1>(rotation.get_backward_g1_g2_decomp()) + std::get<1>(frobenius.get_g1_g2_decomp())) % slot_ring->g2_ord();
 		assert((g1_power * g1_subgroup_order()) % slot_ring->g1_ord() == 0);
 		const size_t index = g1_power * g1_subgroup_order() / slot_ring->g1_ord() + g2_power * g1_subgroup_order();
-		poly mask = slot_ring->raw_auto(g1_power, g2_power)(rotation.get_backward_mask());
-		poly add = poly_mul_mod(scaling, mask, slot_ring->R().scalar_mod, slot_ring->R().poly_mod);
+		slot_ring->raw_auto(g1_power, g2_power)(rotation.get_backward_mask(), *mask, workspace);
+		poly_mul_mod(scaling, *mask, slot_ring->R().scalar_mod, slot_ring->R().poly_mod, *add, workspace);
 		
 		poly_add(
 			coefficients[index],
-			add,
+			*add,
 			slot_ring->R().scalar_mod
 		);
 	}
 }
 
-size_t CompiledLinearTransform::babystep_automorphism_count() const
+size_t CompiledLinearTransform::default_babystep_automorphism_count(size_t automorphism_count)
 {
-	const size_t automorphism_count_log2 = log2_exact(coefficients.size());
+	const size_t automorphism_count_log2 = log2_exact(automorphism_count);
 	return (size_t)1 << (automorphism_count_log2 - automorphism_count_log2 / 2);
 }
 
+size_t CompiledLinearTransform::babystep_automorphism_count() const
+{
+	return babystep_count;
+}
+
 size_t CompiledLinearTransform::giantstep_automorphism_count() const
 {
-	const size_t automorphism_count_log2 = log2_exact(coefficients.size());
-	return (size_t)1 << (automorphism_count_log2 / 2);
+	return coefficients.size() / babystep_count;
+}
+
+void CompiledLinearTransform::set_babystep_automorphism_count(size_t count)
+{
+	if (!std::has_single_bit(count) || count > coefficients.size()) {
+		throw std::invalid_argument("Baby-step count must be a power of two dividing the number of automorphisms");
+	}
+	// coefficient k is currently stored as sigma_old^-1(c_k) for its old giant-step sigma_old, and we need sigma_new^-1(c_k)
+	for (size_t k = 0; k < coefficients.size(); ++k) {
+		const size_t old_giantstep_index = (k / babystep_count) * babystep_count;
+		const size_t new_giantstep_index = (k / count) * count;
+		if (old_giantstep_index != new_giantstep_index && !is_zero(coefficients[k])) {
+			coefficients[k] = difference_automorphism(new_giantstep_index, old_giantstep_index)(coefficients[k]);
+		}
+	}
+	babystep_count = count;
 }
 
 void CompiledLinearTransform::fix_coefficient_shift()
@@ -163,9 +191,16 @@ std::vector<poly> CompiledLinearTransform::compile_frobenius(
 	), mod_t), mod_t);
 
 	seal::Modulus mod_2N(2 * N);
-	poly tmp;
+	std::vector<int64_t> p_powers;
+	p_powers.reserve(d);
+	for (size_t m = 0; m < d; ++m) {
+		p_powers.push_back(static_cast<int64_t>(seal::util::exponentiate_uint_mod(mod_2N.reduce(p), m, mod_2N)));
+	}
+
 	std::vector<poly> results;
+	results.reserve(d);
 	for (size_t m = 0; m < d; ++m) {
+		const int64_t pm = p_powers[m];
 		poly result;
 		for (const auto& entry : sparse_transform_matrix) {
 			size_t k = std::get<0>(entry.first);
@@ -173,30 +208,23 @@ std::vector<poly> CompiledLinearTransform::compile_frobenius(
 			assert(k <= d);
 			assert(l <= d);
 			int64_t delta = (2 * l) / d + 1;
-			int64_t pm = seal::util::exponentiate_uint_mod(mod_2N.reduce(p), m, mod_2N);
-			tmp.clear();
-			poly_add(
-				tmp,
-				powertable[static_cast<int64_t>(k) + delta * pm * d / 2 - l * pm],
-				mod_t,
-				us[4 - delta]
-			);
-			poly_sub(
-				tmp,
-				powertable[static_cast<int64_t>(k) + (delta + 1) * pm * d / 2 - l * pm],
-				mod_t,
-				us[3 - delta]
-			);
 			uint64_t factor = seal::util::barrett_reduce_64(entry.second, mod_t);
 			if (delta % 2 != 0) {
 				factor = seal::util::negate_uint_mod(factor, mod_t);
 			}
-			poly_add(
-				result,
-				tmp,
-				mod_t,
-				factor
-			);
+			// result += factor * (us[4 - delta] * lhs - us[3 - delta] * rhs), with the signs of the stored powers folded into the scalars
+			const NegacyclicPowerTable::Entry lhs = powertable.entry(static_cast<int64_t>(k) + delta * pm * d / 2 - l * pm);
+			const NegacyclicPowerTable::Entry rhs = powertable.entry(static_cast<int64_t>(k) + (delta + 1) * pm * d / 2 - l * pm);
+			uint64_t lhs_scale = seal::util::multiply_uint_mod(factor, us[4 - delta], mod_t);
+			uint64_t rhs_scale = seal::util::multiply_uint_mod(factor, us[3 - delta], mod_t);
+			if (lhs.negated) {
+				lhs_scale = seal::util::negate_uint_mod(lhs_scale, mod_t);
+			}
+			if (!rhs.negated) {
+				rhs_scale = seal::util::negate_uint_mod(rhs_scale, mod_t);
+			}
+			poly_add_scaled(result, lhs.value, lhs_scale, mod_t);
+			poly_add_scaled(result, rhs.value, rhs_scale, mod_t);
 		}
 		poly_scale(result, global_factor, mod_t);
 		results.push_back(std::move(result));
@@ -205,31 +233,53 @@ std::vector<poly> CompiledLinearTransform::compile_frobenius(
 	return results;
 }
 
-CompiledLinearTransform CompiledLinearTransform::scalar_slots_to_first_coefficients(std::shared_ptr<const SlotRing> slot_ring)
+namespace {
+
+	// resolves 0 to all slots
+	size_t checked_active_slot_count(const SlotRing& slot_ring, size_t active_slot_count)
+	{
+		if (active_slot_count > slot_ring.slot_group_len()) {
+			throw std::invalid_argument("Active slot count exceeds the number of slots");
+		}
+		return active_slot_count == 0 ? slot_ring.slot_group_len() : active_slot_count;
+	}
+}
+
+CompiledLinearTransform CompiledLinearTransform::scalar_slots_to_first_coefficients(std::shared_ptr<const SlotRing> slot_ring, ThreadPool* thread_pool, size_t active_slot_count)
 {
+	active_slot_count = checked_active_slot_count(*slot_ring, active_slot_count);
 	const NegacyclicPowerTable slot_powertable(slot_ring->slot(), slot_ring->slot().generator(), slot_ring->N());
-	auto basis_transform_matrix = [&slot_ring, &slot_powertable](std::unordered_map<std::tuple<size_t, size_t>, uint64_t>& block, size_t block_row, size_t block_col) {
+	auto basis_transform_matrix = [&slot_ring, &slot_powertable, active_slot_count](std::unordered_map<std::tuple<size_t, size_t>, uint64_t>& block, size_t block_row, size_t block_col) {
 		const size_t power_of_x = block_col;
 		const size_t out_slot = block_row;
+		// the scalar in slot block_col becomes the coefficient of x^block_col
+		if (block_col >= active_slot_count) {
+			return;
+		}
 		const size_t power_of_zeta = seal::util::multiply_uint_mod(
 			power_of_x,
 			inv_mod(std::get<0>(slot_ring->rotate(out_slot).galois_elements()), slot_ring->index_mod()),
 			slot_ring->index_mod()
 		);
 		// this entry in the slot out_slot corresponds to the coset of x^power_of_x
-		const poly entry = slot_powertable[power_of_zeta];
+		const NegacyclicPowerTable::Entry entry = slot_powertable.entry(power_of_zeta);
 		for (size_t i = 0; i < slot_ring->slot_rank(); ++i) {
-			if (entry[i] != 0) {
-				block[std::make_tuple(i, 0)] = entry[i];
+			if (entry.value[i] != 0) {
+				block[std::make_tuple(i, 0)] = entry.negated ? seal::util::negate_uint_mod(entry.value[i], slot_ring->slot().scalar_mod) : entry.value[i];
 			}
 		}
 	};
-	return CompiledLinearTransform::compile_slot_basis(slot_ring, basis_transform_matrix);
+	return CompiledLinearTransform::compile_slot_basis(slot_ring, basis_transform_matrix, true, 0, thread_pool);
 }
 
-CompiledLinearTransform CompiledLinearTransform::first_coefficients_to_scalar_slots(std::shared_ptr<const SlotRing> slot_ring)
+CompiledLinearTransform CompiledLinearTransform::first_coefficients_to_scalar_slots(std::shared_ptr<const SlotRing> slot_ring, ThreadPool* thread_pool, size_t active_slot_count)
 {
-	auto basis_transform_matrix = [&slot_ring](std::unordered_map<std::tuple<size_t, size_t>, uint64_t>& block, size_t block_row, size_t block_col) {
+	active_slot_count = checked_active_slot_count(*slot_ring, active_slot_count);
+	auto basis_transform_matrix = [&slot_ring, active_slot_count](std::unordered_map<std::tuple<size_t, size_t>, uint64_t>& block, size_t block_row, size_t block_col) {
+		// the coefficient of x^block_row becomes the scalar in slot block_row
+		if (block_row >= active_slot_count) {
+			return;
+		}
 		for (size_t k = 0; k < slot_ring->slot_rank(); ++k) {
 			const size_t power = seal::util::sub_uint_mod(
 				block_row,
@@ -252,7 +302,7 @@ CompiledLinearTransform CompiledLinearTransform::first_coefficients_to_scalar_sl
 			}
 		}
 	};
-	return CompiledLinearTransform::compile_slot_basis(slot_ring, basis_transform_matrix);
+	return CompiledLinearTransform::compile_slot_basis(slot_ring, basis_transform_matrix, true, 0, thread_pool);
 }
 
 CompiledLinearTransform CompiledLinearTransform::load_binary(std::shared_ptr<const SlotRing> slot_ring, std::istream& in)
@@ -300,6 +350,84 @@ void CompiledLinearTransform::save_binary(std::ostream& stream) const
 	}
 }
 
+namespace {
+
+	constexpr uint64_t mapped_transform_magic = 0x534e415254534247; // "GBSTRANS" in little endian
+	constexpr uint64_t mapped_transform_version = 6;
+	constexpr size_t mapped_transform_header_len = 16;
+
+	// header layout of the mapped transform format, in uint64_t words
+	enum MappedTransformHeader {
+		header_magic = 0, header_version, header_prime, header_exponent, header_log2n, header_ring_hash, header_g1_subgroup_order, header_g2_subgroup_order, header_coeff_count, header_poly_len, header_babystep_count
+	};
+}
+
+CompiledLinearTransform CompiledLinearTransform::load_mapped(std::shared_ptr<const SlotRing> slot_ring, const MappedFile& file)
+{
+	if (file.size() < mapped_transform_header_len * sizeof(uint64_t)) {
+		throw std::invalid_argument("File too short for transform header");
+	}
+	uint64_t header[mapped_transform_header_len];
+	memcpy(header, file.data(), sizeof(header));
+	if (header[header_magic] != mapped_transform_magic || header[header_version] != mapped_transform_version) {
+		throw std::invalid_argument("Not a transform file or wrong version");
+	}
+	if (header[header_prime] != slot_ring->prime() || header[header_exponent] != slot_ring->exponent() || header[header_log2n] != log2_exact(slot_ring->N()) || header[header_ring_hash] != slot_ring->parameter_hash()) {
+		throw std::invalid_argument("Transform was stored for a different ring");
+	}
+	if (header[header_g1_subgroup_order] != slot_ring->g1_ord() || (header[header_g2_subgroup_order] != 1 && header[header_g2_subgroup_order] != 2) || 
+		header[header_coeff_count] != header[header_g1_subgroup_order] * header[header_g2_subgroup_order] || header[header_poly_len] != slot_ring->N()) 
+	{
+		throw std::invalid_argument("Invalid transform header");
+	}
+	const size_t poly_len = header[header_poly_len];
+	const size_t coeff_count = header[header_coeff_count];
+	if (file.size() != (mapped_transform_header_len + coeff_count * poly_len) * sizeof(uint64_t)) {
+		throw std::invalid_argument("Transform file has wrong size");
+	}
+	const size_t babystep_count = header[header_babystep_count];
+	if (!std::has_single_bit(babystep_count) || babystep_count > coeff_count) {
+		throw std::invalid_argument("Invalid baby-step count in transform header");
+	}
+	const char* data = file.data() + mapped_transform_header_len * sizeof(uint64_t);
+	std::vector<poly> coefficients(coeff_count);
+	for (size_t i = 0; i < coeff_count; ++i) {
+		coefficients[i].resize(poly_len);
+		memcpy(coefficients[i].data(), data + i * poly_len * sizeof(uint64_t), poly_len * sizeof(uint64_t));
+		for (uint64_t c : coefficients[i]) {
+			if (c >= slot_ring->R().scalar_mod.value()) {
+				throw std::invalid_argument("Transform coefficient out of range");
+			}
+		}
+	}
+	// the coefficients are stored already shifted for this split
+	CompiledLinearTransform result(slot_ring, std::move(coefficients));
+	result.babystep_count = babystep_count;
+	return result;
+}
+
+void CompiledLinearTransform::save_mapped(std::ostream& stream) const
+{
+	uint64_t header[mapped_transform_header_len] = { 0 };
+	header[header_magic] = mapped_transform_magic;
+	header[header_version] = mapped_transform_version;
+	header[header_prime] = slot_ring->prime();
+	header[header_exponent] = slot_ring->exponent();
+	header[header_log2n] = log2_exact(slot_ring->N());
+	header[header_ring_hash] = slot_ring->parameter_hash();
+	header[header_g1_subgroup_order] = g1_subgroup_order();
+	header[header_g2_subgroup_order] = g2_subgroup_order();
+	header[header_coeff_count] = coefficients.size();
+	header[header_poly_len] = slot_ring->N();
+	header[header_babystep_count] = babystep_count;
+	assert(header[header_g1_subgroup_order] * header[header_g2_subgroup_order] == coefficients.size());
+	stream.write(reinterpret_cast<const char*>(header), sizeof(header));
+	for (size_t i = 0; i < coefficients.size(); ++i) {
+		assert(coefficients[i].size() == slot_ring->N());
+		stream.write(reinterpret_cast<const char*>(coefficients[i].data()), slot_ring->N() * sizeof(uint64_t));
+	}
+}
+
 CompiledSubringLinearTransform CompiledLinearTransform::in_ring()&&
 {
 	return CompiledSubringLinearTransform(std::move(*this), slot_ring);
@@ -319,20 +447,28 @@ NegacyclicPowerTable::NegacyclicPowerTable(const SlotRing::SubringView& ring, po
 	this->generator = std::move(generator);
 }
 
-poly NegacyclicPowerTable::operator[](int64_t i) const
+NegacyclicPowerTable::Entry NegacyclicPowerTable::entry(int64_t i) const
 {
 	int64_t index = i % static_cast<int64_t>(2 * N);
 	if (index < 0) {
 		index += 2 * N;
 	}
 	if (index < static_cast<int64_t>(N)) {
-		return content[index];
+		return Entry{ content[index], false };
 	}
 	else {
-		poly result = content[index - N];
+		return Entry{ content[index - N], true };
+	}
+}
+
+poly NegacyclicPowerTable::operator[](int64_t i) const
+{
+	const Entry power = entry(i);
+	poly result(power.value.begin(), power.value.end());
+	if (power.negated) {
 		poly_scale(result, seal::util::negate_uint_mod(1, ring.scalar_mod), ring.scalar_mod);
-		return result;
 	}
+	return result;
 }
 
 void test_first_coeffs_to_scalar_slots()
@@ -351,11 +487,95 @@ void test_first_coeffs_to_scalar_slots()
 	for (size_t i = 3; i < slot_ring->slot_group_len(); ++i) {
 		assert(slot_ring->extract_slot_value(b, i)[0] == 0);
 	}
+
+	// only the first 4 slots are active, so the coefficient of x^8 is ignored
+	CompiledSubringLinearTransform thin_transform(CompiledLinearTransform::first_coefficients_to_scalar_slots(samller_slot_ring, nullptr, 4), slot_ring);
+	a[8] = 5;
+	assert(thin_transform(a) == b);
+
+	// a slotwise transform only uses the frobenius automorphisms, so all giant-steps except the first one are dropped
+	const size_t masked_slot_count = 2;
+	auto mask_matrix = [&samller_slot_ring, masked_slot_count](std::unordered_map<std::tuple<size_t, size_t>, uint64_t>& slotwise_matrix, size_t i, size_t j) {
+		if (i == j && i < masked_slot_count) {
+			for (size_t l = 0; l < samller_slot_ring->slot_rank(); ++l) {
+				slotwise_matrix[std::make_tuple(l, l)] = 1;
+			}
+		}
+	};
+	CompiledSubringLinearTransform mask_transform(CompiledLinearTransform::compile_slot_basis(samller_slot_ring, mask_matrix), slot_ring);
+	const poly masked = mask_transform(b);
+	assert(slot_ring->extract_slot_value(masked, 0)[0] == 1);
+	assert(slot_ring->extract_slot_value(masked, 1)[0] == 2);
+	for (size_t i = masked_slot_count; i < slot_ring->slot_group_len(); ++i) {
+		assert(is_zero(slot_ring->extract_slot_value(masked, i)));
+	}
+	assert(mask_transform.galois_elements().size() < transform.galois_elements().size());
+
+	thin_transform.multiply_scalar(3);
+	poly_scale(b, 3, slot_ring->R().scalar_mod);
+	assert(thin_transform(a) == b);
+
+	bool has_thrown = false;
+	try {
+		CompiledLinearTransform::first_coefficients_to_scalar_slots(samller_slot_ring, nullptr, samller_slot_ring->slot_group_len() + 1);
+	}
+	catch (const std::invalid_argument&) {
+		has_thrown = true;
+	}
+	assert(has_thrown);
+}
+
+void test_save_load_mapped()
+{
+	std::shared_ptr<SlotRing> slot_ring = std::make_shared<SlotRing>(p_257_test_parameters()->power_x_subring(7));
+	std::shared_ptr<SlotRing> smaller_slot_ring = std::make_shared<SlotRing>(slot_ring->power_x_subring(1));
+	CompiledSubringLinearTransform transform(CompiledLinearTransform::first_coefficients_to_scalar_slots(smaller_slot_ring), slot_ring);
+
+	const std::string filename = (std::filesystem::temp_directory_path() / "test_save_load_mapped.bin").string();
+	{
+		std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+		transform.save_mapped(out);
+	}
+	{
+		MappedFile file(filename);
+		CompiledSubringLinearTransform loaded = CompiledSubringLinearTransform::load_mapped(slot_ring, file);
+
+		poly a = { 1, 0, 2, 0, 4, 0, 7 };
+		a.resize(slot_ring->N());
+		assert(loaded(a) == transform(a));
+
+		// the file must be rejected for another ring
+		std::shared_ptr<SlotRing> other_slot_ring = std::make_shared<SlotRing>(slot_ring->change_exponent(1));
+		bool has_thrown = false;
+		try {
+			CompiledSubringLinearTransform::load_mapped(other_slot_ring, file);
+		}
+		catch (const std::invalid_argument&) {
+			has_thrown = true;
+		}
+		assert(has_thrown);
+
+		// a ring that only differs in the order of the slots, i.e. in g2, must be rejected as well
+		const uint64_t g2_candidates[2] = { ((uint64_t)1 << slot_ring->log2N) - 1, ((uint64_t)1 << (slot_ring->log2N - 1)) - 1 };
+		const uint64_t other_g2 = slot_ring->g2 == g2_candidates[0] ? g2_candidates[1] : g2_candidates[0];
+		std::shared_ptr<SlotRing> reordered_slot_ring = std::make_shared<SlotRing>(slot_ring->log2N, slot_ring->p, slot_ring->e, other_g2, slot_ring->unit_vectors[0]);
+		assert(reordered_slot_ring->parameter_hash() != slot_ring->parameter_hash());
+		has_thrown = false;
+		try {
+			CompiledSubringLinearTransform::load_mapped(reordered_slot_ring, file);
+		}
+		catch (const std::invalid_argument&) {
+			has_thrown = true;
+		}
+		assert(has_thrown);
+	}
+	std::filesystem::remove(filename);
+	std::cout << "test_save_load_mapped(): success" << std::endl;
 }
 
 void test_compile_slot_basis()
 {
-	std::shared_ptr<SlotRing> slot_ring = small_test_parameters();
+	std::shared_ptr<const SlotRing> slot_ring = small_test_parameters();
 	auto matrix = [&slot_ring](std::unordered_map<std::tuple<size_t, size_t>, uint64_t>& slotwise_matrix, size_t i, size_t j) {
 
 		if (i == j) {
@@ -387,6 +607,10 @@ void test_compile_slot_basis()
 	poly_add(expected, slot_ring->from_slot_value({ 2, 1 }, 17), slot_ring->R().scalar_mod);
 
 	assert(result_poly == expected);
+
+	ThreadPool thread_pool(3);
+	CompiledSubringLinearTransform parallel_transform = CompiledLinearTransform::compile_slot_basis(slot_ring, matrix, true, 0, &thread_pool).in_ring();
+	assert(parallel_transform(a) == expected);
 	std::cout << "test_compile_slot_basis(): success" << std::endl;
 }
 
@@ -394,7 +618,7 @@ void test_apply_ciphertext()
 {
 	using namespace seal;
 
-	std::shared_ptr<SlotRing> slot_ring = small_test_parameters();
+	std::shared_ptr<const SlotRing> slot_ring = small_test_parameters();
 	auto matrix = [&slot_ring](std::unordered_map<std::tuple<size_t, size_t>, uint64_t>& slotwise_matrix, size_t i, size_t j) {
 		
 		if (i == j) {
@@ -439,7 +663,7 @@ void test_apply_ciphertext()
 	encryptor.encrypt(x_plain, x_enc);
 
 	Ciphertext result_enc;
-	transform.apply_ciphertext(x_enc, evaluator, gk, result_enc);
+	transform.apply_ciphertext(x_enc, context, evaluator, gk, result_enc);
 
 	Plaintext result;
 	decryptor.decrypt(result_enc, result);
@@ -453,6 +677,41 @@ void test_apply_ciphertext()
 	poly_add(expected, slot_ring->from_slot_value({ 2, 1 }, 17), slot_ring->R().scalar_mod);
 
 	assert(result_poly == expected);
+
+	ThreadPool thread_pool(4);
+	Ciphertext parallel_result_enc;
+	transform.apply_ciphertext(x_enc, context, evaluator, gk, parallel_result_enc, &thread_pool);
+	decryptor.decrypt(parallel_result_enc, result);
+	result_poly = poly(result.data(), result.data() + result.coeff_count());
+	result_poly.resize(slot_ring->N());
+	assert(result_poly == expected);
+
+	transform.precompute(context, context.first_parms_id(), &thread_pool);
+	Ciphertext precomputed_result_enc;
+	transform.apply_ciphertext(x_enc, context, evaluator, gk, precomputed_result_enc, &thread_pool);
+	assert(std::equal(precomputed_result_enc.data(), precomputed_result_enc.data() + precomputed_result_enc.dyn_array().size(), parallel_result_enc.data()));
+
+	// a different baby-step-giant-step split computes the same transform, but requires other keys
+	const size_t automorphism_count = transform.babystep_automorphism_count() * transform.giantstep_automorphism_count();
+	transform.set_babystep_automorphism_count(transform.babystep_automorphism_count() * 2 <= automorphism_count ? transform.babystep_automorphism_count() * 2 : transform.babystep_automorphism_count() / 2);
+	assert(!transform.is_precomputed_for(context.first_parms_id()));
+	assert(transform(a) == expected);
+	GaloisKeys split_gk;
+	keygen.create_galois_keys(transform.galois_elements(), split_gk);
+	Ciphertext split_result_enc;
+	transform.apply_ciphertext(x_enc, context, evaluator, split_gk, split_result_enc, &thread_pool);
+	decryptor.decrypt(split_result_enc, result);
+	result_poly = poly(result.data(), result.data() + result.coeff_count());
+	result_poly.resize(slot_ring->N());
+	assert(result_poly == expected);
+
+	// if only giant-step key-switches cost something, all automorphisms should become baby-steps
+	const BabystepGiantstepCosts costs = { 0, 0, 1, 0 };
+	assert(transform.tune_babystep_automorphism_count(costs) == automorphism_count);
+	assert(transform.tune_babystep_automorphism_count(costs, 4) == 4);
+	assert(transform.babystep_automorphism_count() == 4);
+	assert(transform(a) == expected);
+
 	std::cout << "test_apply_ciphertext(): success" << std::endl;
 }
 
@@ -460,7 +719,7 @@ void test_apply_ciphertext_subring()
 {
 	using namespace seal;
 
-	std::shared_ptr<SlotRing> large_slot_ring = small_test_parameters();
+	std::shared_ptr<const SlotRing> large_slot_ring = small_test_parameters();
 	std::shared_ptr<SlotRing> slot_ring = std::make_shared<SlotRing>(large_slot_ring->power_x_subring(2));
 	auto matrix = [&slot_ring](std::unordered_map<std::tuple<size_t, size_t>, uint64_t>& slotwise_matrix, size_t i, size_t j) {
 		if (i == j) {
@@ -505,7 +764,7 @@ void test_apply_ciphertext_subring()
 	encryptor.encrypt(x_plain, x_enc);
 
 	Ciphertext result_enc;
-	transform.apply_ciphertext(x_enc, evaluator, gk, result_enc);
+	transform.apply_ciphertext(x_enc, context, evaluator, gk, result_enc);
 
 	Plaintext result;
 	decryptor.decrypt(result_enc, result);
@@ -562,43 +821,158 @@ size_t CompiledSubringLinearTransform::giantstep_automorphism_count() const
 	return subring_transform.giantstep_automorphism_count();
 }
 
-CompiledSubringLinearTransform::CompiledSubringLinearTransform(CompiledLinearTransform&& transform, std::shared_ptr<const SlotRing> new_ring) : slot_ring(new_ring), subring_transform(std::move(transform))
+void CompiledSubringLinearTransform::set_babystep_automorphism_count(size_t count)
 {
+	subring_transform.set_babystep_automorphism_count(count);
+	lifted_coefficients.clear();
+	lifted_parms_id = seal::parms_id_zero;
+}
+
+void CompiledSubringLinearTransform::multiply_scalar(uint64_t factor)
+{
+	// scalars are fixed by all automorphisms, so this commutes with the coefficient shift of the giant-steps
+	const seal::Modulus& mod = subring_transform.slot_ring->R().scalar_mod;
+	for (poly& coeff : subring_transform.coefficients) {
+		poly_scale(coeff, mod.reduce(factor), mod);
+	}
+	lifted_coefficients.clear();
+	lifted_parms_id = seal::parms_id_zero;
+}
+
+size_t CompiledSubringLinearTransform::tune_babystep_automorphism_count(const BabystepGiantstepCosts& costs, size_t max_babystep_count)
+{
+	const size_t automorphism_count = subring_transform.coefficients.size();
+	size_t best_count = 1;
+	double best_cost = std::numeric_limits<double>::max();
+	for (size_t count = 1; count <= automorphism_count && count <= max_babystep_count; count *= 2) {
+		const double cost = costs.estimate(count, automorphism_count / count);
+		if (cost < best_cost) {
+			best_cost = cost;
+			best_count = count;
+		}
+	}
+	if (best_count != babystep_automorphism_count()) {
+		set_babystep_automorphism_count(best_count);
+	}
+	return best_count;
 }
 
-CompiledSubringLinearTransform CompiledSubringLinearTransform::slots_to_coeffs(std::shared_ptr<const SlotRing> slot_ring)
+BabystepGiantstepCosts BabystepGiantstepCosts::measure(const seal::SEALContext& context, size_t repetitions)
+{
+	seal::KeyGenerator keygen(context);
+	seal::PublicKey pk;
+	keygen.create_public_key(pk);
+	const uint32_t galois_elt = 3;
+	seal::GaloisKeys gk;
+	keygen.create_galois_keys(std::vector<uint32_t>{ galois_elt }, gk);
+	seal::Encryptor encryptor(context, pk);
+	seal::Evaluator eval(context);
+
+	seal::Ciphertext x;
+	encryptor.encrypt_zero(x);
+	seal::Ciphertext result;
+
+	// take the minimum over all repetitions, as this is least affected by other load on the host
+	const auto measure_ms = [repetitions](const auto& f) {
+		double best = std::numeric_limits<double>::max();
+		for (size_t i = 0; i < std::max<size_t>(repetitions, 1); ++i) {
+			const auto start = std::chrono::steady_clock::now();
+			f();
+			const auto end = std::chrono::steady_clock::now();
+			best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+		}
+		return best;
+	};
+	BabystepGiantstepCosts costs;
+	costs.decomposition = measure_ms([&]() { HoistedCiphertext hoisted(x, context); });
+	const HoistedCiphertext hoisted(x, context);
+	costs.hoisted_key_switch = measure_ms([&]() { hoisted.apply_galois(galois_elt, gk, result); });
+	costs.key_switch = measure_ms([&]() { eval.apply_galois(x, galois_elt, gk, result); });
+	costs.ntt = measure_ms([&]() {
+		result = x;
+		transform_to_ntt_inplace(result, context);
+	});
+	return costs;
+}
+
+double BabystepGiantstepCosts::estimate(size_t babystep_count, size_t giantstep_count) const
+{
+	// the baby-step tree has a parent for every even node that has children
+	return decomposition * (babystep_count / 2) + hoisted_key_switch * (babystep_count - 1) + ntt * (babystep_count + giantstep_count) + key_switch * (giantstep_count - 1);
+}
+
+CompiledSubringLinearTransform::CompiledSubringLinearTransform(CompiledLinearTransform&& transform, std::shared_ptr<const SlotRing> new_ring) : slot_ring(new_ring), subring_transform(std::move(transform)), lifted_parms_id(seal::parms_id_zero)
+{
+}
+
+void CompiledSubringLinearTransform::coefficient_plain(size_t index, seal::Plaintext& result) const
+{
+	// the coefficients are stored in the subring, and only expanded to the whole ring here;
+	// storing them expanded would require index times as much memory, but most entries would be zero
+	const poly& coeff = subring_transform.coefficients[index];
+	const size_t subring_index = slot_ring->N() / subring_transform.slot_ring->N();
+	result.resize(slot_ring->N());
+	std::fill(result.data(), result.data() + slot_ring->N(), 0);
+	for (size_t k = 0; k < coeff.size(); ++k) {
+		result[k * subring_index] = coeff[k];
+	}
+}
+
+CompiledSubringLinearTransform CompiledSubringLinearTransform::slots_to_coeffs(std::shared_ptr<const SlotRing> slot_ring, ThreadPool* thread_pool, size_t active_slot_count)
 {
 	assert(slot_ring->is_d_half_sparse());
 	if (slot_ring->is_d_sparse()) {
-		std::shared_ptr<SlotRing> reduced_slot_ring = std::make_shared<SlotRing>(slot_ring->power_x_subring(log2_exact(slot_ring->slot_rank())));
-		CompiledLinearTransform t = CompiledLinearTransform::scalar_slots_to_first_coefficients(reduced_slot_ring);
+		std::shared_ptr<const SlotRing> reduced_slot_ring = slot_ring->shared_power_x_subring(log2_exact(slot_ring->slot_rank()));
+		CompiledLinearTransform t = CompiledLinearTransform::scalar_slots_to_first_coefficients(reduced_slot_ring, thread_pool, active_slot_count);
 		return CompiledSubringLinearTransform(std::move(t), slot_ring);
 	}
 	else {
-		std::shared_ptr<SlotRing> reduced_slot_ring = std::make_shared<SlotRing>(slot_ring->power_x_subring(log2_exact(slot_ring->slot_rank() / 2)));
-		CompiledLinearTransform t = CompiledLinearTransform::scalar_slots_to_first_coefficients(reduced_slot_ring);
+		std::shared_ptr<const SlotRing> reduced_slot_ring = slot_ring->shared_power_x_subring(log2_exact(slot_ring->slot_rank() / 2));
+		CompiledLinearTransform t = CompiledLinearTransform::scalar_slots_to_first_coefficients(reduced_slot_ring, thread_pool, active_slot_count);
 		return CompiledSubringLinearTransform(std::move(t), slot_ring);
 	}
 }
 
-CompiledSubringLinearTransform CompiledSubringLinearTransform::coeffs_to_slots(std::shared_ptr<const SlotRing> slot_ring)
+CompiledSubringLinearTransform CompiledSubringLinearTransform::coeffs_to_slots(std::shared_ptr<const SlotRing> slot_ring, ThreadPool* thread_pool, size_t active_slot_count)
 {
 	assert(slot_ring->is_d_half_sparse());
 	if (slot_ring->is_d_sparse()) {
-		std::shared_ptr<SlotRing> reduced_slot_ring = std::make_shared<SlotRing>(slot_ring->power_x_subring(log2_exact(slot_ring->slot_rank())));
-		CompiledLinearTransform t = CompiledLinearTransform::first_coefficients_to_scalar_slots(reduced_slot_ring);
+		std::shared_ptr<const SlotRing> reduced_slot_ring = slot_ring->shared_power_x_subring(log2_exact(slot_ring->slot_rank()));
+		CompiledLinearTransform t = CompiledLinearTransform::first_coefficients_to_scalar_slots(reduced_slot_ring, thread_pool, active_slot_count);
 		return CompiledSubringLinearTransform(std::move(t), slot_ring);
 	}
 	else {
-		std::shared_ptr<SlotRing> reduced_slot_ring = std::make_shared<SlotRing>(slot_ring->power_x_subring(log2_exact(slot_ring->slot_rank() / 2)));
-		CompiledLinearTransform t = CompiledLinearTransform::first_coefficients_to_scalar_slots(reduced_slot_ring);
+		std::shared_ptr<const SlotRing> reduced_slot_ring = slot_ring->shared_power_x_subring(log2_exact(slot_ring->slot_rank() / 2));
+		CompiledLinearTransform t = CompiledLinearTransform::first_coefficients_to_scalar_slots(reduced_slot_ring, thread_pool, active_slot_count);
 		return CompiledSubringLinearTransform(std::move(t), slot_ring);
 	}
 }
 
+CompiledSubringLinearTransform CompiledSubringLinearTransform::load_mapped(std::shared_ptr<const SlotRing> slot_ring, const MappedFile& file)
+{
+	if (file.size() < mapped_transform_header_len * sizeof(uint64_t)) {
+		throw std::invalid_argument("File too short for transform header");
+	}
+	uint64_t header[mapped_transform_header_len];
+	memcpy(header, file.data(), sizeof(header));
+	const size_t log2N = log2_exact(slot_ring->N());
+	if (header[header_log2n] > log2N || log2N - header[header_log2n] > log2_exact(slot_ring->slot_rank())) {
+		throw std::invalid_argument("Transform was stored for a different ring");
+	}
+	std::shared_ptr<const SlotRing> reduced_slot_ring = slot_ring->shared_power_x_subring(log2N - header[header_log2n]);
+	return CompiledSubringLinearTransform(CompiledLinearTransform::load_mapped(reduced_slot_ring, file), slot_ring);
+}
+
+void CompiledSubringLinearTransform::save_mapped(std::ostream& stream) const
+{
+	subring_transform.save_mapped(stream);
+}
+
 poly CompiledSubringLinearTransform::operator()(const poly& x) const
 {
+	PolyWorkspace& workspace = PolyWorkspace::thread_local_workspace();
 	std::vector<poly> precomputed_values;
+	precomputed_values.reserve(babystep_automorphism_count());
 	precomputed_values.emplace_back(x);
 	for (size_t i = 1; i < babystep_automorphism_count(); ++i) {
 		// starting to remove lower digits has the effect of reusing rotations and recomputing frobenius,
@@ -606,104 +980,161 @@ poly CompiledSubringLinearTransform::operator()(const poly& x) const
 		size_t base_element_index = i - ((size_t)1 << highest_dividing_power2(i));
 		assert(base_element_index < i);
 		SlotRing::RawAuto automorphism_to_apply = difference_automorphism(base_element_index, i);
-		precomputed_values.push_back(automorphism_to_apply(precomputed_values[base_element_index]));
+		precomputed_values.emplace_back();
+		automorphism_to_apply(precomputed_values[base_element_index], precomputed_values.back(), workspace);
 	}
 
 	poly result;
+	PolyWorkspace::Buffer current = workspace.acquire(0);
+	PolyWorkspace::Buffer coeff = workspace.acquire(0);
+	PolyWorkspace::Buffer addition = workspace.acquire(0);
 	for (size_t i = 0; i < giantstep_automorphism_count(); ++i) {
-		poly current;
+		current->clear();
 		for (size_t j = 0; j < babystep_automorphism_count(); ++j) {
 			if (!is_zero(subring_transform.coefficients[i * babystep_automorphism_count() + j])) {
-				poly coeff;
-				slot_ring->from_power_x_subring(*subring_transform.slot_ring, subring_transform.coefficients[i * babystep_automorphism_count() + j], coeff);
-				poly addition = poly_mul_mod(
-					coeff,
+				slot_ring->from_power_x_subring(*subring_transform.slot_ring, subring_transform.coefficients[i * babystep_automorphism_count() + j], *coeff);
+				poly_mul_mod(
+					*coeff,
 					precomputed_values[j],
 					slot_ring->R().scalar_mod,
-					slot_ring->R().poly_mod
+					slot_ring->R().poly_mod,
+					*addition,
+					workspace
 				);
 				poly_add(
-					current,
-					addition,
+					*current,
+					*addition,
 					slot_ring->R().scalar_mod
 				);
 			}
 		}
 		SlotRing::RawAuto automorphism_to_apply = automorphism(i * babystep_automorphism_count());
+		automorphism_to_apply(*current, *addition, workspace);
 		poly_add(
 			result,
-			automorphism_to_apply(current),
+			*addition,
 			slot_ring->R().scalar_mod
 		);
 	}
 	return result;
 }
 
-void CompiledSubringLinearTransform::apply_ciphertext(const seal::Ciphertext& in, const seal::Evaluator& eval, const seal::GaloisKeys& gk, seal::Ciphertext& result) const
+void CompiledSubringLinearTransform::precompute(const seal::SEALContext& context, seal::parms_id_type parms_id, ThreadPool* thread_pool)
 {
-	if (coefficients_plain.size() == 0) {
-		poly coeff;
-		for (const auto& c : subring_transform.coefficients) {
-			slot_ring->from_power_x_subring(*subring_transform.slot_ring, c, coeff);
-			coefficients_plain.push_back(seal::Plaintext(coeff));
+	std::vector<LiftedPlaintext> result(subring_transform.coefficients.size());
+	parallel_for(thread_pool, 0, result.size(), [&](size_t i) {
+		if (!is_zero(subring_transform.coefficients[i])) {
+			seal::Plaintext coeff;
+			coefficient_plain(i, coeff);
+			result[i] = LiftedPlaintext(coeff, context, parms_id);
 		}
-	}
-	else {
-		assert(coefficients_plain.size() == subring_transform.coefficients.size());
-	}
+	});
+	lifted_coefficients = std::move(result);
+	lifted_parms_id = parms_id;
+}
+
+bool CompiledSubringLinearTransform::is_precomputed_for(seal::parms_id_type parms_id) const
+{
+	return lifted_coefficients.size() != 0 && lifted_parms_id == parms_id;
+}
 
+void CompiledSubringLinearTransform::apply_ciphertext(const seal::Ciphertext& in, const seal::SEALContext& context, const seal::Evaluator& eval, const seal::GaloisKeys& gk, seal::Ciphertext& result, ThreadPool* thread_pool, seal::MemoryPoolHandle pool, bool use_thread_local_pools) const
+{
+	// the pool for the temporaries of a task, called on the thread that executes it
+	const auto task_pool = [&pool, use_thread_local_pools]() {
+		return use_thread_local_pools ? thread_local_memory_pool() : pool;
+	};
+	const size_t babystep_count = babystep_automorphism_count();
+	const size_t giantstep_count = giantstep_automorphism_count();
+
+	// copying a ciphertext allocates from the global pool, so all ciphertexts are created explicitly
 	std::vector<seal::Ciphertext> precomputed_values;
-	precomputed_values.emplace_back(in);
-	seal::Ciphertext tmp;
-	for (size_t i = 1; i < babystep_automorphism_count(); ++i) {
-		// starting to remove lower digits has the effect of reusing rotations and recomputing frobenius,
-		// which is faster since rotations take 2 key-switches
-		size_t base_element_index = i - ((size_t)1 << highest_dividing_power2(i));
-		assert(base_element_index < i);
-		SlotRing::RawAuto automorphism_to_apply = difference_automorphism(base_element_index, i);
-		automorphism_to_apply.apply_ciphertext(precomputed_values[base_element_index], eval, gk, tmp);
-		precomputed_values.push_back(tmp);
+	precomputed_values.reserve(babystep_count);
+	for (size_t j = 0; j < babystep_count; ++j) {
+		precomputed_values.emplace_back(pool);
+	}
+	precomputed_values[0] = in;
+	// the baby-steps form a tree, where element i is computed from its parent i - 2^v(i) with v(i) the 2-adic valuation;
+	// starting to remove lower digits has the effect of reusing rotations and recomputing frobenius,
+	// which is faster since rotations take 2 key-switches;
+	// all children base + 2^k (with 2^k < 2^v(base)) of a node are computed from the same ciphertext, hence we
+	// hoist the key-switching decomposition of the parent and reuse it for all children.
+	// The children of nodes with popcount(base) = level - 1 are exactly the nodes with popcount(i) = level, so we
+	// can process the tree level by level, and the parents of one level in parallel
+	for (size_t level = 1; level <= log2_exact(babystep_count); ++level) {
+		std::vector<size_t> parents;
+		for (size_t base_element_index = 0; base_element_index < babystep_count; ++base_element_index) {
+			// a node has children iff it is even (the first child is base + 1)
+			if (static_cast<size_t>(std::popcount(base_element_index)) == level - 1 && base_element_index % 2 == 0 && base_element_index + 1 < babystep_count) {
+				parents.push_back(base_element_index);
+			}
+		}
+		parallel_for(thread_pool, 0, parents.size(), [&](size_t parent_index) {
+			const size_t base_element_index = parents[parent_index];
+			const HoistedCiphertext hoisted(precomputed_values[base_element_index], context, task_pool());
+			for (size_t k = 0; k < highest_dividing_power2(base_element_index); ++k) {
+				const size_t i = base_element_index + ((size_t)1 << k);
+				if (i >= babystep_count) {
+					break;
+				}
+				assert(static_cast<size_t>(std::popcount(i)) == level);
+				SlotRing::RawAuto automorphism_to_apply = difference_automorphism(base_element_index, i);
+				automorphism_to_apply.apply_ciphertext(hoisted, gk, precomputed_values[i]);
+			}
+		});
 	}
-	bool is_result_set = false;
-	for (size_t i = 0; i < giantstep_automorphism_count(); ++i) {
-		seal::Ciphertext current;
-		bool is_current_set = false;
 
-		for (size_t j = 0; j < babystep_automorphism_count(); ++j) {
-			if (!is_zero(subring_transform.coefficients[i * babystep_automorphism_count() + j])) {
-				if (is_current_set) {
-					eval.multiply_plain(
-						precomputed_values[j],
-						coefficients_plain[i * babystep_automorphism_count() + j],
-						tmp
-					);
-					eval.add_inplace(
-						current,
-						tmp
-					);
+	// the baby-steps are only used in inner products with the coefficients, which we compute in NTT form
+	parallel_for(thread_pool, 0, babystep_count, [&](size_t j) {
+		transform_to_ntt_inplace(precomputed_values[j], context);
+	});
+
+	// the giant-steps are independent of each other, and are summed up in a tree afterwards
+	const bool use_lifted_coefficients = is_precomputed_for(in.parms_id());
+	std::vector<seal::Ciphertext> giantstep_values;
+	giantstep_values.reserve(giantstep_count);
+	for (size_t i = 0; i < giantstep_count; ++i) {
+		giantstep_values.emplace_back(pool);
+	}
+	std::vector<char> is_giantstep_set(giantstep_count, false);
+	parallel_for(thread_pool, 0, giantstep_count, [&](size_t i) {
+		const seal::MemoryPoolHandle giantstep_pool = task_pool();
+		PlainInnerProduct inner_product(context, in.parms_id(), giantstep_pool);
+		seal::Plaintext coeff(giantstep_pool);
+		for (size_t j = 0; j < babystep_count; ++j) {
+			const size_t index = i * babystep_count + j;
+			if (!is_zero(subring_transform.coefficients[index])) {
+				if (use_lifted_coefficients) {
+					inner_product.add_product(precomputed_values[j], lifted_coefficients[index]); log_multiply_plain();
 				}
 				else {
-					eval.multiply_plain(
-						precomputed_values[j],
-						coefficients_plain[i * babystep_automorphism_count() + j],
-						current
-					);
-					is_current_set = true;
+					coefficient_plain(index, coeff);
+					inner_product.add_product(precomputed_values[j], LiftedPlaintext(coeff, context, in.parms_id())); log_multiply_plain();
 				}
 			}
 		}
-		if (is_current_set) {
-			SlotRing::RawAuto automorphism_to_apply = automorphism(i * babystep_automorphism_count());
-			automorphism_to_apply.apply_ciphertext(current, eval, gk, tmp);
-			if (!is_result_set) {
-				result = tmp;
-				is_result_set = true;
-			}
-			else {
-				eval.add_inplace(result, tmp);
-			}
+		if (!inner_product.empty()) {
+			seal::Ciphertext current(giantstep_pool);
+			inner_product.finish(current);
+			SlotRing::RawAuto automorphism_to_apply = automorphism(i * babystep_count);
+			automorphism_to_apply.apply_ciphertext(current, eval, gk, giantstep_values[i], giantstep_pool);
+			is_giantstep_set[i] = true;
 		}
+	});
+
+	std::vector<seal::Ciphertext> summands;
+	for (size_t i = 0; i < giantstep_count; ++i) {
+		if (is_giantstep_set[i]) {
+			summands.push_back(std::move(giantstep_values[i]));
+		}
+	}
+	if (summands.size() == 0) {
+		return;
 	}
+	parallel_tree_reduce(thread_pool, summands, [&eval](seal::Ciphertext& lhs, const seal::Ciphertext& rhs) {
+		eval.add_inplace(lhs, rhs);
+	});
+	result = std::move(summands[0]);
 }
 
 std::vector<uint32_t> CompiledSubringLinearTransform::galois_elements() const
@@ -718,8 +1149,17 @@ std::vector<uint32_t> CompiledSubringLinearTransform::galois_elements() const
 		result.push_back(automorphism_to_apply.galois_element());
 	}
 	for (size_t i = 1; i < giantstep_automorphism_count(); ++i) {
-		const auto automorphism = this->automorphism(i * babystep_automorphism_count());
-		result.push_back(automorphism.galois_element());
+		bool is_giantstep_used = false;
+		for (size_t j = 0; j < babystep_automorphism_count(); ++j) {
+			if (!is_zero(subring_transform.coefficients[i * babystep_automorphism_count() + j])) {
+				is_giantstep_used = true;
+				break;
+			}
+		}
+		if (is_giantstep_used) {
+			const auto automorphism = this->automorphism(i * babystep_automorphism_count());
+			result.push_back(automorphism.galois_element());
+		}
 	}
 	return result;
 }
@@ -3,9 +3,15 @@
 #include <assert.h>
 #include <unordered_map>
 #include <iostream>
+#include <optional>
+#include <limits>
+#include <span>
 #include "seal/util/uintarithsmallmod.h"
 #include "polyarith.h"
 #include "slots.h"
+#include "threadpool.h"
+#include "mappedfile.h"
+#include "innerproduct.h"
 
 template <class T>
 constexpr inline std::size_t hash_combine(T const& v,
@@ -42,11 +48,45 @@ public:
 	NegacyclicPowerTable(NegacyclicPowerTable&&) = default;
 	~NegacyclicPowerTable() = default;
 
+	/**
+	 * A view of a stored power, which has to be negated if negated is set.
+	 * The view is valid as long as this table exists.
+	*/
+	struct Entry {
+		std::span<const uint64_t> value;
+		bool negated;
+	};
+
+	/**
+	 * Returns the i-th power without copying; since the generator has order 2N
+	 * and its N-th power is -1, only the first N powers are stored.
+	*/
+	Entry entry(int64_t i) const;
+
 	poly operator[](int64_t i) const;
 };
 
 class CompiledSubringLinearTransform;
 
+//tex:
+//Measured costs (in milliseconds) of the operations whose number depends on the baby-step-giant-step split of
+//CompiledSubringLinearTransform::apply_ciphertext(). For $b$ baby-steps and $g$ giant-steps, this performs $b/2$
+//key-switching decompositions, $b - 1$ hoisted key-switches, $b$ forward and $g$ inverse NTTs and $g - 1$ key-switches.
+//The number of plaintext multiplications does not depend on the split.
+struct BabystepGiantstepCosts {
+	double decomposition;
+	double hoisted_key_switch;
+	double key_switch;
+	double ntt;
+
+	/**
+	 * Measures the costs on this host, using temporary keys of the given context.
+	*/
+	static BabystepGiantstepCosts measure(const seal::SEALContext& context, size_t repetitions = 3);
+
+	double estimate(size_t babystep_count, size_t giantstep_count) const;
+};
+
 //tex:
 //Stores a linear transform $R_t \to R_t$ as
 //$$R_t \to R_t, \quad x \mapsto \sum_i c_i \sigma_i(x)$$
@@ -69,6 +109,9 @@ class CompiledLinearTransform {
 	//approach.
 	std::vector<poly> coefficients;
 
+	// the number of baby-step automorphisms per giant-step, a power of two dividing coefficients.size()
+	size_t babystep_count;
+
 	//tex:
 	//Most general constructor, directly takes the given values into the members.
 	//Note that this does not compute
@@ -113,6 +156,10 @@ class CompiledLinearTransform {
 	size_t babystep_automorphism_count() const;
 	size_t giantstep_automorphism_count() const;
 
+	//tex:
+	//The default baby-step count $2^{\lceil \log_2(n) / 2 \rceil}$ for $n$ automorphisms.
+	static size_t default_babystep_automorphism_count(size_t automorphism_count);
+
 	//tex:
 	//The baby-step-giant-step approach to apply the transform has the side-effect that the giant-step
 	//automorphisms are applied to the coefficients during evaluation. More concretely, during evaluation
@@ -161,15 +208,49 @@ public:
 	//"bad", this does not correspond to using a subgroup of the rotations group, and hence is hard to use (in particular does not
 	//work with the evaluation map). Instead, we just provide the option to set use_g2 = false, which performs the transform using
 	//only the automorphisms $\sigma_{g_1^k}$, but not $\sigma_{g_2}$.
+	//$$~$$
+	//The babystep_count gives the split of the automorphisms into baby-steps and giant-steps, see set_babystep_automorphism_count();
+	//0 chooses the default split.
+	//$$~$$
+	//If a thread pool is given, the $d \times d$ blocks are compiled in parallel, each worker adding into its own
+	//accumulator; in this case, sparse_transform_matrix_per_slot is called concurrently and must be thread-safe.
+	//Note that this requires up to one additional copy of the coefficients per worker.
 	template<typename T>
-	static CompiledLinearTransform compile_slot_basis(std::shared_ptr<const SlotRing> slot_ring, T sparse_transform_matrix_per_slot, bool use_g2 = true);
+	static CompiledLinearTransform compile_slot_basis(std::shared_ptr<const SlotRing> slot_ring, T sparse_transform_matrix_per_slot, bool use_g2 = true, size_t babystep_count = 0, ThreadPool* thread_pool = nullptr);
 
-	static CompiledLinearTransform scalar_slots_to_first_coefficients(std::shared_ptr<const SlotRing> slot_ring);
-	static CompiledLinearTransform first_coefficients_to_scalar_slots(std::shared_ptr<const SlotRing> slot_ring);
+	//tex:
+	//The transforms between scalar slots and the first coefficients, i.e. the scalar in slot $i$ corresponds to the coefficient of $X^i$.
+	//If active_slot_count $k$ is nonzero, only the slots $0, ..., k - 1$ resp. the coefficients of $1, ..., X^{k - 1}$ are assumed to be used;
+	//the transform then ignores the other inputs and produces zeros in the other outputs. This reduces the number of nonzero
+	//$d \times d$ blocks (and hence the compilation time) by a factor of $k / n$.
+	//Throws std::invalid_argument if $k$ is larger than the number $n$ of slots.
+	static CompiledLinearTransform scalar_slots_to_first_coefficients(std::shared_ptr<const SlotRing> slot_ring, ThreadPool* thread_pool = nullptr, size_t active_slot_count = 0);
+	static CompiledLinearTransform first_coefficients_to_scalar_slots(std::shared_ptr<const SlotRing> slot_ring, ThreadPool* thread_pool = nullptr, size_t active_slot_count = 0);
 
 	static CompiledLinearTransform load_binary(std::shared_ptr<const SlotRing> slot_ring, std::istream& in);
 	void save_binary(std::ostream& stream) const;
 
+	/**
+	 * Loads a transform stored by save_mapped(). In contrast to load_binary(), the header identifies
+	 * the ring (p, e, N and a hash of the slot unit vector) and the format version, and a
+	 * std::invalid_argument is thrown if these do not match the given ring.
+	*/
+	static CompiledLinearTransform load_mapped(std::shared_ptr<const SlotRing> slot_ring, const MappedFile& file);
+
+	/**
+	 * Stores the transform in a format suitable for memory-mapping: a fixed-size header, followed
+	 * by the coefficients as contiguous arrays of N uint64_t each, starting at a 64-byte aligned offset.
+	*/
+	void save_mapped(std::ostream& stream) const;
+
+	//tex:
+	//Changes the number $b$ of baby-step automorphisms, so that the transform is evaluated as
+	//$$ x \mapsto \sum_{i = 0}^{n/b - 1} \sigma_{ib}\Bigl(\sum_{j = 0}^{b - 1} \sigma_{ib}^{-1}(c_{ib + j}) \sigma_j(x) \Bigr) $$
+	//This requires $b - 1$ (hoisted) baby-step and $n/b - 1$ giant-step key-switches, and $b$ ciphertexts of memory for the baby-steps.
+	//$b$ must be a power of two dividing the number $n$ of automorphisms, otherwise std::invalid_argument is thrown.
+	//The stored coefficients are shifted accordingly, so this changes galois_elements() but not the transform itself.
+	void set_babystep_automorphism_count(size_t count);
+
 	CompiledSubringLinearTransform in_ring() &&;
 
 	friend class CompiledSubringLinearTransform;
@@ -193,13 +274,18 @@ class CompiledSubringLinearTransform {
 
 	CompiledLinearTransform subring_transform;
 	std::shared_ptr<const SlotRing> slot_ring;
-	mutable std::vector<seal::Plaintext> coefficients_plain = {};
+
+	// the coefficients lifted by precompute(), with the same indices as subring_transform.coefficients;
+	// zero coefficients are left empty
+	std::vector<LiftedPlaintext> lifted_coefficients;
+	seal::parms_id_type lifted_parms_id;
+
+	// writes the coefficient with the given index, embedded into the whole ring, into the given plaintext
+	void coefficient_plain(size_t index, seal::Plaintext& result) const;
 
 	SlotRing::RawAuto automorphism(size_t index) const;
 	SlotRing::RawAuto difference_automorphism(size_t from, size_t to) const;
 	SlotRing::RawAuto reverse_automorphism(size_t index) const;
-	size_t babystep_automorphism_count() const;
-	size_t giantstep_automorphism_count() const;
 
 public:
 	CompiledSubringLinearTransform(CompiledLinearTransform&& transform, std::shared_ptr<const SlotRing> new_ring);
@@ -207,43 +293,95 @@ public:
 	CompiledSubringLinearTransform(CompiledSubringLinearTransform&&) = default;
 	~CompiledSubringLinearTransform() = default;
 
-	static CompiledSubringLinearTransform slots_to_coeffs(std::shared_ptr<const SlotRing> slot_ring);
-	static CompiledSubringLinearTransform coeffs_to_slots(std::shared_ptr<const SlotRing> slot_ring);
+	/**
+	 * The transforms used for bootstrapping, see CompiledLinearTransform::scalar_slots_to_first_coefficients() for the meaning
+	 * of active_slot_count (0 means that all slots are used).
+	*/
+	static CompiledSubringLinearTransform slots_to_coeffs(std::shared_ptr<const SlotRing> slot_ring, ThreadPool* thread_pool = nullptr, size_t active_slot_count = 0);
+	static CompiledSubringLinearTransform coeffs_to_slots(std::shared_ptr<const SlotRing> slot_ring, ThreadPool* thread_pool = nullptr, size_t active_slot_count = 0);
+
+	/**
+	 * Loads a transform stored by save_mapped(); The power-of-X subring in which the transform acts
+	 * is derived from the stored data. Throws std::invalid_argument if the data does not belong to the given ring.
+	*/
+	static CompiledSubringLinearTransform load_mapped(std::shared_ptr<const SlotRing> slot_ring, const MappedFile& file);
+	void save_mapped(std::ostream& stream) const;
 
 	poly operator()(const poly& x) const;
-	void apply_ciphertext(const seal::Ciphertext& in, const seal::Evaluator& eval, const seal::GaloisKeys& gk, seal::Ciphertext& result) const;
+
+	/**
+	 * Expands all coefficients to the whole ring and lifts them to the ciphertext modulus of the given level, so that
+	 * apply_ciphertext() can use them directly for ciphertexts at this level. This requires N * coeff_modulus_size words
+	 * per nonzero coefficient, and replaces the coefficients lifted by a previous call.
+	 * Must not be called concurrently with apply_ciphertext().
+	*/
+	void precompute(const seal::SEALContext& context, seal::parms_id_type parms_id, ThreadPool* thread_pool = nullptr);
+	bool is_precomputed_for(seal::parms_id_type parms_id) const;
+
+	//tex:
+	//Applies the transform to the given ciphertext. The baby-step automorphisms are computed using hoisted
+	//key-switching, i.e. all baby-steps that are computed from the same ciphertext share its RNS decomposition.
+	//If a thread pool is given, the baby-steps of one level of the baby-step tree and the giant-steps are
+	//computed in parallel, and the giant-steps are summed up in a tree.
+	//All temporaries are allocated from the given memory pool, which must be thread-safe if a thread pool is given.
+	//If use_thread_local_pools is set, the temporaries of the parallel tasks are instead allocated from
+	//thread_local_memory_pool() of the thread that executes them; only the baby-step and giant-step results use pool.
+	void apply_ciphertext(const seal::Ciphertext& in, const seal::SEALContext& context, const seal::Evaluator& eval, const seal::GaloisKeys& gk, seal::Ciphertext& result,
+		ThreadPool* thread_pool = nullptr, seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool(), bool use_thread_local_pools = false) const;
 
 	//tex:
 	//Returns a set of elements of $(\mathbb{Z}/2N\mathbb{Z})^*$ such that the corresponding Galois automorphisms
-	//suffice to compute this transform.
+	//suffice to compute this transform. Giant-steps whose coefficients are all zero are skipped by apply_ciphertext(),
+	//so their automorphisms are not included.
 	std::vector<uint32_t> galois_elements() const;
 
+	size_t babystep_automorphism_count() const;
+	size_t giantstep_automorphism_count() const;
+
+	/**
+	 * See CompiledLinearTransform::set_babystep_automorphism_count(); This discards the coefficients lifted by precompute(),
+	 * as they depend on the split. The galois keys must be created after choosing the split.
+	*/
+	void set_babystep_automorphism_count(size_t count);
+
+	/**
+	 * Sets the baby-step count that minimizes the cost of apply_ciphertext() as estimated by the given cost model,
+	 * among all valid counts of at most max_babystep_count, and returns it.
+	*/
+	size_t tune_babystep_automorphism_count(const BabystepGiantstepCosts& costs, size_t max_babystep_count = std::numeric_limits<size_t>::max());
+
+	/**
+	 * Replaces the transform f by x -> factor * f(x), by scaling all coefficients; this saves a plaintext multiplication
+	 * when the input or the result of the transform must be scaled anyway. Discards the coefficients lifted by precompute().
+	*/
+	void multiply_scalar(uint64_t factor);
+
 	CompiledLinearTransform&& transform() &&;
 };
 
 void test_first_coeffs_to_scalar_slots();
+void test_save_load_mapped();
 void test_compile_slot_basis();
 void test_apply_ciphertext();
 void test_apply_ciphertext_subring();
 
 template<typename T>
-inline CompiledLinearTransform CompiledLinearTransform::compile_slot_basis(std::shared_ptr<const SlotRing> slot_ring, T sparse_transform_matrix_per_slot, bool use_g2)
+inline CompiledLinearTransform CompiledLinearTransform::compile_slot_basis(std::shared_ptr<const SlotRing> slot_ring, T sparse_transform_matrix_per_slot, bool use_g2, size_t babystep_count, ThreadPool* thread_pool)
 {
 	size_t block_size = slot_ring->slot_group_len();
 	if (!use_g2) {
 		block_size = block_size / 2;
 	}
-	std::vector<SlotRing::Rotation> rotations;
-	for (size_t i = 0; i < block_size; ++i) {
-		rotations.push_back(slot_ring->block_rotate(i, block_size));
-	}
+	std::vector<std::optional<SlotRing::Rotation>> rotations(block_size);
+	parallel_for(thread_pool, 0, block_size, [&](size_t i) {
+		rotations[i].emplace(slot_ring->block_rotate(i, block_size));
+	});
 	std::unique_ptr<SlotRing::Rotation> lane_switch;
 	if (!use_g2) {
 		lane_switch = std::make_unique<SlotRing::Rotation>(slot_ring->rotate(block_size));
 	}
 
 	const size_t d = slot_ring->slot_rank();
-	std::unordered_map<std::tuple<size_t, size_t>, uint64_t> slotwise_matrix;
 	NegacyclicPowerTable powertable(slot_ring->R(), slot_ring->from_slot_value({ 0, 1 }, 0), slot_ring->N());
 
 	std::vector<poly> coefficients;
@@ -252,9 +390,27 @@ inline CompiledLinearTransform CompiledLinearTransform::compile_slot_basis(std::
 		c.resize(slot_ring->N());
 	}
 	CompiledLinearTransform result(slot_ring, std::move(coefficients));
+	if (babystep_count != 0) {
+		// the coefficients are still zero, so this only checks the count
+		result.set_babystep_automorphism_count(babystep_count);
+	}
 
-	for (size_t s = 0; s < block_size; ++s) {
-		for (size_t j = 0; j < block_size; ++j) {
+	// every worker adds into its own accumulator, whose coefficients are only allocated once they are touched;
+	// the (s, j) pairs are distributed round-robin, since the number of nonzero blocks may vary a lot between rows
+	const size_t block_count = block_size * block_size;
+	const size_t worker_count = thread_pool == nullptr ? 1 : std::min(block_count, thread_pool->thread_count() + 1);
+	std::vector<CompiledLinearTransform> accumulators;
+	for (size_t w = 0; w < worker_count; ++w) {
+		accumulators.push_back(CompiledLinearTransform(slot_ring, std::vector<poly>(result.coefficients.size())));
+	}
+	parallel_for(thread_pool, 0, worker_count, [&](size_t w) {
+		CompiledLinearTransform& accumulator = accumulators[w];
+		std::unordered_map<std::tuple<size_t, size_t>, uint64_t> slotwise_matrix;
+		PolyWorkspace& workspace = PolyWorkspace::thread_local_workspace();
+		PolyWorkspace::Buffer coeff = workspace.acquire(0);
+		for (size_t block = w; block < block_count; block += worker_count) {
+			const size_t s = block / block_size;
+			const size_t j = block % block_size;
 			const size_t block_row = j;
 			const size_t block_col = (j + block_size - s) % block_size;
 			slotwise_matrix.clear();
@@ -270,23 +426,30 @@ inline CompiledLinearTransform CompiledLinearTransform::compile_slot_basis(std::
 				powertable
 			);
 			for (size_t l = 0; l < d; ++l) {
-				poly coeff = rotations[j](frobenius_form[l]);
-				result.add_scaled_transform(
-					coeff,
-					rotations[s],
+				(*rotations[j])(frobenius_form[l], *coeff, workspace);
+				accumulator.add_scaled_transform(
+					*coeff,
+					*rotations[s],
 					slot_ring->frobenius(l)
 				);
 				if (!use_g2) {
-					coeff = (*lane_switch)(coeff);
-					result.add_scaled_transform(
-						coeff,
-						rotations[s],
+					(*lane_switch)(*coeff, *coeff, workspace);
+					accumulator.add_scaled_transform(
+						*coeff,
+						*rotations[s],
 						slot_ring->frobenius(l)
 					);
 				}
 			}
 		}
-	}
+	});
+	parallel_for(thread_pool, 0, result.coefficients.size(), [&](size_t k) {
+		for (const CompiledLinearTransform& accumulator : accumulators) {
+			poly_add(result.coefficients[k], accumulator.coefficients[k], slot_ring->R().scalar_mod);
+		}
+	});
+	accumulators.clear();
+
 	result.fix_coefficient_shift();
 	return result;
 }